@@ -0,0 +1,461 @@
+/*********************************************************************/
+/* Filename: Crowd.h                                                 */
+/* The pedestrians on the sidewalks, kept as arrays of their state   */
+/* rather than as a Person apiece, and posed onto one shared figure  */
+/* when they are drawn.                                              */
+/*********************************************************************/
+
+#ifndef CROWD_H
+#define CROWD_H
+
+#include <vector>
+#include <algorithm>
+
+#include "Graphics.Random.h"
+#include "Graphics.ThreadPool.h"
+#include "Person.h"
+#include "Obstacles.h"
+
+// One full cycle of the walk, sampled once into a table of poses (a row
+// of joint angles per animation frame), so that posing anyone at any
+// point of the cycle is a lookup and a blend of two rows.
+class WalkCycle
+{
+public:
+  enum
+  {
+    FRAMES = 60  // Every joint's swing repeats in this many frames.
+  };
+
+  WalkCycle( float (*angle)( int joint, int frame ) )
+  {
+    // The swings settle into the cycle once every joint has made its
+    // first swing out from 0, which the table starts after.
+    for( int k = 0; k <= FRAMES; k++ )
+      for( int j = 0; j < Joint::COUNT; j++ )
+        this->poses[k][j] = angle( j, FRAMES + k );
+  }
+
+  // The pose phase of the way (from 0 to 1) through the cycle.
+  void sample( float phase, float pose[] ) const
+  {
+    float        t = phase * FRAMES;
+    int          k = int( t );
+    float        f = t - k;
+
+    if( k >= FRAMES ) { k = FRAMES - 1; f = 1.0f; }
+
+    const float* a = this->poses[k];
+    const float* b = this->poses[k + 1];
+
+    for( int j = 0; j < Joint::COUNT; j++ )
+      pose[j] = a[j] + f * ( b[j] - a[j] );
+  }
+
+private:
+  float poses[FRAMES + 1][Joint::COUNT];  // The last row repeats the first.
+};
+
+class Crowd
+{
+public:
+  enum
+  {
+    CHUNK = 1024  // The most people on a sidewalk steered as one task.
+  };
+
+  // When steered, people keep clearance from every obstacle and spacing
+  // from each other.
+  Crowd( float clearance = 1.0f, float spacing = 1.0f )
+  {
+    this->clearance = clearance;
+    this->spacing   = spacing;
+    this->spawned   = 0;
+  }
+
+  // The angle of a swinging joint after frame frames of animation,
+  // swung from 0 frame by frame as a Person swings it.  This only builds
+  // the walk cycle, once, so the frames are not skipped.
+  static float joint_angle( int joint, int frame )
+  {
+    const JointSwing& s = Person::swing( joint );
+
+    float angle = 0.0f;
+    float start = 0.0f;
+    float end   = s.first;
+    int   i     = 0;
+
+    for( int f = 0; f < frame; f++ )
+      swing_range( angle, start, end, i, s.frames, s.range, Quadratic::ease_in_and_out );
+
+    return( angle );
+  }
+
+  // The walk cycle that everyone in every crowd is posed from.
+  static const WalkCycle& walk_cycle()
+  {
+    static const WalkCycle cycle( Crowd::joint_angle );
+    return( cycle );
+  }
+
+  // Adds a person at z, on the left (side 1) or right (side -1) of the
+  // road, walking up (direction 1) or down (direction -1) it.  The person
+  // starts phase of the way (from 0 to 1) through the walk cycle, and
+  // walks rate times as fast as the figure was first animated (one frame
+  // of the cycle per step).
+  int add( float z, int side, int direction, float phase = 0.0f, float rate = 1.0f )
+  {
+    int i = this->size();
+
+    this->position.push_back( z );
+    this->previous_position.push_back( z );
+    this->direction.push_back( direction );
+    this->side.push_back( side );
+    this->phase.push_back( phase );
+    this->rate.push_back( rate );
+    this->lod.push_back( 0 );
+    for( int j = 0; j < Joint::COUNT; j++ )
+      this->angle[j].push_back( 0.0f );
+
+    this->spawn( i, z, side, direction, phase, rate );
+    this->spawned++;
+    return( i );
+  }
+
+  int size()
+  {
+    return( int( this->position.size() ) );
+  }
+
+  // Everyone ever added or respawned.
+  int get_spawn_count()
+  {
+    return( int( this->spawned ) );
+  }
+
+  float get_position( int i )  { return( this->position[i] ); }
+  int   get_direction( int i ) { return( this->direction[i] ); }
+  int   get_side( int i )      { return( this->side[i] ); }
+  int   get_lod( int i )       { return( this->lod[i] ); }
+
+  // Chooses the level of detail of person i, this far from the camera.
+  void update_lod( int i, float distance )
+  {
+    this->lod[i] = Person::choose_lod( this->lod[i], distance );
+  }
+
+  // The angle of every joint of person i, in the order of Joint.
+  void get_pose( int i, float pose[] )
+  {
+    for( int j = 0; j < Joint::COUNT; j++ )
+      pose[j] = this->angle[j][i];
+  }
+
+  // Everyone who has fallen behind z leaves, and their place in the crowd
+  // is taken by someone new, distance further on, so that the sidewalks
+  // stay as full and nothing is allocated or freed.  Newcomers walk either
+  // way, from anywhere in the walk cycle, at a rate in rates, all hashed
+  // from the seed and the number of people spawned before them.  They are
+  // not interpolated from where the person before them was.  Returns the
+  // number of people spawned.
+  int respawn( float z, float distance, unsigned int seed, const Range<>& rates )
+  {
+    int count = 0;
+
+    for( int i = 0, n = this->size(); i < n; i++ )
+    {
+      if( this->position[i] < z )
+      {
+        Random<> r( seed, 1, this->spawned++ );
+        this->spawn( i, this->position[i] + distance, this->side[i], ( r.next( 2 ) < 0.5f ) ? 1 : -1,
+                     r.next( 0 ), r.next( 1, rates ) );
+        count++;
+      }
+    }
+
+    return( count );
+  }
+
+  // One simulation step: everyone walks distance (scaled by their rate)
+  // in their direction, and moves on through the walk cycle.
+  void step( float distance )
+  {
+    for( int i = 0, n = this->size(); i < n; i++ )
+      this->walk( i, this->rate[i] * distance, false );
+  }
+
+  // One simulation step as above, but steered around the obstacles on
+  // either side of the road and around each other: anyone who would walk
+  // into an obstacle, or into someone coming the other way, turns around
+  // instead, and anyone catching up with the person ahead holds back.
+  // Steering keeps people in the arrays in sidewalk order, so after a
+  // steered step someone may be found at a different index.
+  void step( float distance, const ObstacleIndex& left, const ObstacleIndex& right )
+  {
+    int chunks = this->sort_sides();
+
+    for( int c = 0; c < chunks; c++ )
+      this->steer_chunk( c, distance, left, right );
+  }
+
+  // The steered step, with each sidewalk cut into runs of CHUNK people
+  // (by Z) that are steered and walked as separate tasks in the pool.
+  // People are kept in the arrays in the order they are steered in, so
+  // each task writes its own run of them and no two tasks share a cache
+  // line but at the ends of their runs.  They are steered from a copy of
+  // where everyone was at the start of the step, so the result is the
+  // same however many threads there are.
+  void step( float distance, const ObstacleIndex& left, const ObstacleIndex& right, ThreadPool& pool )
+  {
+    int chunks = this->sort_sides();
+
+    pool.run( chunks, [&]( int c )
+    {
+      this->steer_chunk( c, distance, left, right );
+    } );
+  }
+
+  // Puts everyone alpha of the way from their previous position to their
+  // current one, until restore() puts the current ones back.
+  void interpolate( float alpha )
+  {
+    this->simulated = this->position;
+    for( int i = 0, n = this->size(); i < n; i++ )
+      this->position[i] = this->previous_position[i] + alpha * ( this->position[i] - this->previous_position[i] );
+  }
+
+  // People added since interpolate() have nothing to restore.
+  void restore()
+  {
+    for( int i = 0, n = int( this->simulated.size() ); i < n; i++ )
+      this->position[i] = this->simulated[i];
+  }
+
+private:
+  // Someone on a sidewalk, sorted by where they are along it.
+  struct Walker
+  {
+    float z;
+    int   direction;
+    int   person;
+
+    bool operator<( const Walker& other ) const
+    {
+      return( this->z < other.z || ( this->z == other.z && this->person < other.person ) );
+    }
+  };
+
+  // Puts the people on the left (side 1) and right (side -1) sidewalks
+  // in order of Z, along with their direction at the start of the step,
+  // returning the number of chunks the sidewalks are cut into.  As nobody
+  // passes anyone else on their own sidewalk, last step's order usually
+  // still holds and only needs checking; it is sorted again when it does
+  // not (after recycling, say) or when people have been added, and then
+  // everyone is moved to the same place in the arrays, the left sidewalk
+  // first, so that the people in a chunk are next to each other there.
+  int sort_sides()
+  {
+    int  n         = this->size();
+    bool reordered = false;
+
+    if( int( this->sides[0].size() + this->sides[1].size() ) != n )
+    {
+      reordered = true;
+
+      for( int s = 0; s < 2; s++ )
+        this->sides[s].clear();
+
+      for( int i = 0; i < n; i++ )
+      {
+        Walker w;
+        w.person = i;
+        this->sides[( this->side[i] == 1 ) ? 0 : 1].push_back( w );
+      }
+    }
+
+    for( int s = 0; s < 2; s++ )
+    {
+      std::vector<Walker>& walkers = this->sides[s];
+      bool                 sorted  = true;
+
+      for( int w = 0, m = int( walkers.size() ); w < m; w++ )
+      {
+        int i = walkers[w].person;
+        walkers[w].z         = this->position[i];
+        walkers[w].direction = this->direction[i];
+
+        if( w > 0 && walkers[w] < walkers[w - 1] )
+          sorted = false;
+      }
+
+      if( !sorted )
+      {
+        std::sort( walkers.begin(), walkers.end() );
+        reordered = true;
+      }
+    }
+
+    if( reordered )
+      this->reorder();
+
+    return( this->chunk_count( 0 ) + this->chunk_count( 1 ) );
+  }
+
+  // Moves everyone to their place on the sidewalks: the left one's people
+  // first, each sidewalk in order of Z.
+  void reorder()
+  {
+    this->order.clear();
+    for( int s = 0; s < 2; s++ )
+    {
+      for( int w = 0, m = int( this->sides[s].size() ); w < m; w++ )
+      {
+        this->order.push_back( this->sides[s][w].person );
+        this->sides[s][w].person = int( this->order.size() ) - 1;
+      }
+    }
+
+    Crowd::permute( this->position, this->order, this->float_scratch );
+    Crowd::permute( this->previous_position, this->order, this->float_scratch );
+    Crowd::permute( this->phase, this->order, this->float_scratch );
+    Crowd::permute( this->rate, this->order, this->float_scratch );
+    Crowd::permute( this->direction, this->order, this->int_scratch );
+    Crowd::permute( this->side, this->order, this->int_scratch );
+    Crowd::permute( this->lod, this->order, this->int_scratch );
+    for( int j = 0; j < Joint::COUNT; j++ )
+      Crowd::permute( this->angle[j], this->order, this->float_scratch );
+  }
+
+  // Puts values[order[k]] at k, through scratch, which is swapped with
+  // values; once every array has been through, none of them grows again.
+  template<typename T>
+  static void permute( std::vector<T>& values, const std::vector<int>& order, std::vector<T>& scratch )
+  {
+    scratch.resize( values.size() );
+    for( int k = 0, n = int( order.size() ); k < n; k++ )
+      scratch[k] = values[order[k]];
+
+    values.swap( scratch );
+  }
+
+  int chunk_count( int s )
+  {
+    return( ( int( this->sides[s].size() ) + CHUNK - 1 ) / CHUNK );
+  }
+
+  // Steers and walks the people in chunk c (counting the left sidewalk's
+  // chunks first) alongside the sidewalk's obstacles, each turning around
+  // or holding back as it has to.  Everything read of anyone else is in
+  // the sorted copy, which nothing writes to while chunks are steered.
+  void steer_chunk( int c, float distance, const ObstacleIndex& left, const ObstacleIndex& right )
+  {
+    int                        s         = ( c < this->chunk_count( 0 ) ) ? 0 : 1;
+    const std::vector<Walker>& walkers   = this->sides[s];
+    const ObstacleIndex&       obstacles = ( s == 0 ) ? left : right;
+    int                        n         = int( walkers.size() );
+    int                        first     = ( ( s == 0 ) ? c : c - this->chunk_count( 0 ) ) * CHUNK;
+    int                        last      = std::min( first + CHUNK, n );
+
+    // The obstacle ahead of the walker, up the sidewalk.
+    int ahead = obstacles.count_before( walkers[first].z );
+
+    for( int w = first; w < last; w++ )
+    {
+      int   i       = walkers[w].person;
+      float z       = walkers[w].z;
+      int   d       = walkers[w].direction;
+      float stride  = this->rate[i] * distance;
+      bool  blocked = false;
+
+      while( ahead < obstacles.size() && obstacles.get( ahead ) <= z )
+        ahead++;
+
+      // The nearest obstacle and the nearest person in the way.
+      int obstacle = ( d > 0 ) ? ahead : ahead - 1;
+      int next     = w + d;
+
+      if( obstacle >= 0 && obstacle < obstacles.size() )
+      {
+        float limit = obstacles.get( obstacle ) - d * this->clearance;
+        blocked = ( d * ( z + d * stride - limit ) > 0.0f );
+      }
+
+      if( !blocked && next >= 0 && next < n )
+      {
+        float gap = d * ( walkers[next].z - z ) - this->spacing;
+
+        if( walkers[next].direction != d )
+        {
+          // Walking towards each other: each may close half the gap.
+          blocked = ( stride > 0.5f * gap );
+        }
+        else if( stride > gap )
+        {
+          // Walking after someone: keep behind them.
+          stride = ( gap > 0.0f ) ? gap : 0.0f;
+        }
+      }
+
+      this->walk( i, stride, blocked );
+    }
+  }
+
+  // Puts a new person in slot i, posed where they start in the walk cycle.
+  void spawn( int i, float z, int side, int direction, float phase, float rate )
+  {
+    float pose[Joint::COUNT];
+
+    this->position[i]          = z;
+    this->previous_position[i] = z;
+    this->direction[i]         = direction;
+    this->side[i]              = side;
+    this->phase[i]             = phase;
+    this->rate[i]              = rate;
+    this->lod[i]               = 0;
+
+    Crowd::walk_cycle().sample( phase, pose );
+    for( int j = 0; j < Joint::COUNT; j++ )
+      this->angle[j][i] = pose[j];
+  }
+
+  // Person i walks stride, or turns around where they are instead;
+  // either way they move on through the walk cycle.
+  void walk( int i, float stride, bool turning )
+  {
+    const WalkCycle& cycle = Crowd::walk_cycle();
+    float            pose[Joint::COUNT];
+
+    this->previous_position[i] = this->position[i];
+    if( turning )
+      this->direction[i] = -this->direction[i];
+    else
+      this->position[i] += this->direction[i] * stride;
+
+    this->phase[i] += this->rate[i] * ( 1.0f / WalkCycle::FRAMES );
+    if( this->phase[i] >= 1.0f )
+      this->phase[i] -= 1.0f;
+
+    cycle.sample( this->phase[i], pose );
+    for( int j = 0; j < Joint::COUNT; j++ )
+      this->angle[j][i] = pose[j];
+  }
+
+  float               clearance;
+  float               spacing;
+  unsigned int        spawned;
+  std::vector<float>  position;
+  std::vector<float>  previous_position;
+  std::vector<float>  simulated;
+  std::vector<int>    direction;
+  std::vector<int>    side;
+  std::vector<float>  phase;
+  std::vector<float>  rate;
+  std::vector<int>    lod;
+  std::vector<float>  angle[Joint::COUNT];
+  std::vector<Walker> sides[2];  // Left and right, in order of Z.
+  std::vector<int>    order;     // Where reorder() takes each person from.
+  std::vector<float>  float_scratch;
+  std::vector<int>    int_scratch;
+};
+
+#endif
@@ -16,9 +16,12 @@
 #include <math.h>		// Contains math functions         //
 #include <time.h>		// Accesses system time info       //
 #include <stdlib.h>		// Enables random number generator //
+#include <string.h>		// For command-line option parsing //
+#define GL_GLEXT_PROTOTYPES	// Declares buffer object functions //
 #include <GLUT/glut.h>
 
 #include <vector>
+#include <string>
 #include <algorithm>
 
 #include <list>
@@ -27,43 +30,42 @@
 #include "Graphics.Range.h"
 #include "Graphics.Random.h"
 #include "Graphics.Transformation.h"
+#include "Graphics.GeometryCache.h"
+#include "Graphics.Instancing.h"
+#include "Graphics.RenderDevice.h"
+#include "Graphics.RenderQueue.h"
+#include "Graphics.Frustum.h"
+#include "Graphics.Benchmark.h"
+#include "Graphics.Profiler.h"
+#include "Graphics.AllocationCounter.h"
+#include "Graphics.SimulationClock.h"
+#include "Graphics.Precipitation.h"
+#include "Graphics.StreamBuffer.h"
+#include "Graphics.ThreadPool.h"
+#include "Graphics.ParticleSystem.h"
+#include "Graphics.AnimationSystem.h"
 #include "Person.h"
+#include "Crowd.h"
+#include "Obstacles.h"
 
 #include "LinkedList.h"
 
 using namespace std;
 using namespace Graphics;
 
-struct P
-{
-  P() : position( 0.0f ), direction( 0 ) 
-  {}
-
-  Person person;
-  float  position;
-  int    direction;
-  int    side;
-};
-
-
-Person* a;
-vector<Person*>* g_people_left;
-vector<Person*>* g_people_right;
-vector<float>* g_people_positions_left;
-vector<float>* g_people_positions_right;
-
-vector<P*>* g_people_struct_left;
-
-vector<bool>* g_filled_left;
-vector<bool>* g_filled_right;
-vector<float>* g_obstacles_right;
-vector<float>* g_obstacles_left;
-
-
-
 enum TOD {dawn,noon,dusk};			// Time-of-day enumerated type       //
 enum weather {sunny,rainy,snowy};	// Weather condition enumerated type //
 enum SOR {LHS,RHS};					// Side-of-road enumerated type      //
+enum WindowMode {LoopedWindows,InstancedWindows};	// Skyscraper window rendering path //
+enum PeopleMode {LoopedPeople,InstancedPeople};		// Pedestrian rendering path        //
+
+/* Random values in the city are keyed by the road block they  */
+/* belong to, the object within that block, and the attribute  */
+/* of that object, so a block generates identically whenever,  */
+/* in whatever order, and on whichever thread it is generated. */
+enum CityObject {BusStopSign,CityProp,LeftSkyscraper,RightSkyscraper,FirstWindow};
+enum CityAttribute {RedAttribute,GreenAttribute,BlueAttribute,
+					HeightAttribute,DepthAttribute,KindAttribute};
 
 /**********************************/
 /* Global constants and variables */
@@ -136,6 +138,63 @@ float precipIncrement[]    = {0.01, -0.01, 0.0};
 float snowIncrementDelta[] = {0.01, -0.1, -0.2};
 float rainIncrementDelta[] = {0.01, -0.05, 0.0};
 
+/* The increment is brought back by PrecipWrap whenever it   */
+/* gets that far from zero, so that the fields it shifts     */
+/* keep their precision however long the program runs.  The  */
+/* shift across the view depends on each particle's depth,   */
+/* so no wrap is seamless: each one reshuffles the field for */
+/* a frame, about once every eight minutes of snow.         */
+const float PrecipWrap = 1024.0;
+
+/* Each snowflake's or raindrop's place in the view is hashed */
+/* from its number under one of these seeds, once, into       */
+/* fields that are shifted every frame.  The fields fill the  */
+/* view frustum between the near and far distances below, so  */
+/* every particle is on screen; the old fixed corridor drew   */
+/* 10,000 snowflakes and 10,000 to 20,000 raindrops, of which */
+/* only about 3,000 and 2,700 to 5,200 were ever in view.     */
+/* Their vertices are written straight into a stream buffer,  */
+/* in chunks that are spread over a pool of threads, which    */
+/* the pedestrians are stepped on as well.                    */
+const unsigned int SnowSeed = 99;
+const unsigned int RainSeed = 13;
+const int          NbrOfSnowflakes = 4000;
+const int          MaxNbrOfRaindrops = 5000;
+const GLfloat      SnowNear = 0.5;
+const GLfloat      SnowFar = 10.0;
+const GLfloat      RainNear = 0.5;
+const GLfloat      RainFar = 5.0;
+const int          PrecipitationChunk = 8192;
+PrecipitationField snowfall;
+PrecipitationField rainfall;
+StreamBuffer       precipitationStream;
+ThreadPool         workerPool;
+
+/* Raindrops splash up off the road ahead, and pedestrians   */
+/* kick up snow as they walk.  Each effect is a fixed pool   */
+/* of particles, emitted into and moved on every simulation  */
+/* step, and drawn as points through a stream buffer of its  */
+/* own, so that every stream buffer is mapped once a frame   */
+/* and each of its regions is only written again two frames  */
+/* after it was drawn from.  The emitters are reused from    */
+/* step to step too, so neither effect allocates once it is  */
+/* running.                                                  */
+const int       NbrOfSplashesPerStep = 40;
+const int       NbrOfDropletsPerSplash = 6;
+const int       NbrOfPuffParticlesPerStep = 6;
+const GLfloat   SplashNear = 1.0;
+const GLfloat   SplashFar = 20.0;
+const GLfloat   RoadSurfaceY = -2.8;
+const GLfloat   PedestrianFeetY = -2.1;
+const GLfloat   SplashGravity[] = { 0.0, -9.8, 0.0 };
+const GLfloat   PuffGravity[] = { 0.0, -1.0, 0.0 };
+ParticleSystem  rainSplashes(2048, SplashGravity, RainSeed);
+ParticleSystem  snowPuffs(1024, PuffGravity, SnowSeed);
+vector<ParticleEmitter> splashEmitters(NbrOfSplashesPerStep);
+vector<ParticleEmitter> puffEmitters;
+StreamBuffer    splashStream;
+StreamBuffer    puffStream;
+
 /* Early morning fog is set up to be lightly colored     */
 /* and very dense; late evening fog is set up to be      */
 /* darker and less dense; and midday fog is nonexistent. */
@@ -187,6 +246,73 @@ const GLfloat SkyscraperDisplacement   = 13.0;
 const GLfloat WindowDisplacement       = 2.9;
 const GLfloat StoryHeight              = 20.0;
 
+/* Each road block is baked into the cache the first time it is */
+/* drawn and replayed with one call per frame after that.  The   */
+/* baked geometry depends on the time of day (building and lamp  */
+/* colors), so the cache is flushed whenever that changes.       */
+GeometryCache cityBlockCache( NbrOfRoadIterations );
+TOD           cityBlockCacheTimeOfDay = dawn;
+
+/* The seed from which every block's random values are hashed, */
+/* chosen from the clock when the city is first drawn.         */
+unsigned int  citySeed = 0;
+
+/* Besides OpenGL, the scene can be drawn through a device that */
+/* discards everything, or one that records each frame's calls. */
+NullRenderDevice      nullDevice;
+RecordingRenderDevice recordingDevice;
+
+/* All city geometry is submitted to the render queue and drawn */
+/* sorted by material.  Each baked block remembers the material */
+/* changes it needed (unsorted and sorted) for the statistics.  */
+RenderQueue renderQueue;
+int         cityBlockMaterialChanges[NbrOfRoadIterations][2];
+
+/* The city blocks and pedestrians are culled against the view */
+/* frustum in one batch before any of them are drawn.  Blocks  */
+/* take indices 0 to NbrOfRoadIterations-2, followed by the    */
+/* people on the left and then on the right of the road.       */
+FrustumCuller sceneCuller;
+BoundingBox   cityBlockBounds[NbrOfRoadIterations];
+
+/* Skyscraper windows are normally drawn as one instanced batch */
+/* per building; the per-window loop is kept for comparison.    */
+WindowMode windowRenderMode = InstancedWindows;
+
+/* Pedestrians are normally gathered into one instanced batch per */
+/* body part and level of detail; drawing each person's parts in  */
+/* turn is kept for comparison.                                   */
+PeopleMode peopleRenderMode = InstancedPeople;
+
+/* The scene is simulated in fixed steps of SimulationStep   */
+/* seconds (the length of the original timer tick, so every  */
+/* speed is unchanged), however often it is drawn.  The      */
+/* viewer and the precipitation keep their state from the    */
+/* step before, and each frame is drawn part way between the */
+/* two according to how much real time is left over.         */
+const double    SimulationStep = 0.1;
+SimulationClock simulationClock(SimulationStep);
+GLfloat         previousViewPosition[3];
+float           previousPrecipIncrement[3];
+GLfloat         simulatedViewPosition[3];
+float           simulatedPrecipIncrement[3];
+
+
+/* Rendering statistics for the current frame, which are */
+/* printed after each frame when toggled with the S key.  */
+struct FrameStatistics
+{
+	int unsortedMaterialChanges;
+	int sortedMaterialChanges;
+	int visibleObjects;
+	int culledObjects;
+	int personTriangles;
+	int particles;
+	size_t bytesUploaded;
+};
+FrameStatistics frameStatistics;
+bool showFrameStatistics = false;
+
 
 /////////////////////////////////////////////////
 // Constants & variables for the display panel //
@@ -199,21 +325,57 @@ const GLfloat StoryHeight              = 20.0;
 /* Function prototypes */
 /***********************/
 void KeyboardPress(unsigned char pressedKey, int mouseXPosition, int mouseYPosition);
-void TimerFunction(int value);
+void IdleFunction();
+void StepSimulation();
+void SaveSceneState();
+void StepPedestrians();
+void StepParticles();
 void Display();
+void DrawFrame(float alpha);
+void InterpolateSceneState(float alpha);
+void RestoreSceneState();
 void ResizeWindow(GLsizei w, GLsizei h);
 void DrawCityElements();
+GLfloat CityBlockOrigin(GLfloat firstZ, int index);
+void BakeCityBlock(GLfloat firstZ, int index, bool collectObstacles);
+void DrawCityBlock(GLfloat firstZ, int index);
+void FlushRenderQueue();
+void CullSceneObjects(GLfloat firstZ);
 void DrawIntersection(GLfloat firstZ);
 float DrawRoadCube(GLfloat firstZ, int index);
 void DrawSidewalkCubePair(GLfloat firstZ, int index);
 float DrawStreetlight(GLfloat firstZ, int index, SOR roadside);
 float DrawCityProp(GLfloat firstZ, int index);
 void DrawSkyscraper(GLfloat firstZ, int index, SOR roadside);
+void DrawSkyscraperWindows(GLfloat firstZ, int index, SOR roadside,
+						   GLfloat heightScale, GLfloat depthScale);
+void GenerateWindowColor(int index, SOR roadside, int row, int col, GLfloat windowColor[]);
 void DrawCityFarPlaneCube();
 void RenderPrecipitation();
+void RenderParticles(float alpha);
+void DrawParticles(ParticleSystem& system, StreamBuffer& stream, float dt);
+void UpdatePrecipitation(ThreadPool& pool, PrecipitationField& field, int count,
+						 const PrecipitationVolume& volume, const GLfloat streak[],
+						 float vertices[]);
 void DrawDisplayPanel();
 void UpdateFog();
-float GenerateRandomNumber(float lowerBound, float upperBound);
+void ReportFrameStatistics();
+void DumpProfile();
+bool SelectRenderDevice(const char* name);
+int RunBenchmark(const char* name);
+void BenchmarkSkyscraperWindows();
+void BenchmarkFrame();
+void BenchmarkPrecipitation();
+void BenchmarkPrecipitationStress();
+void BenchmarkParticles();
+void BenchmarkWalk();
+void BenchmarkPeople();
+void BenchmarkObstacles();
+void BenchmarkSteering();
+void BenchmarkCrowdThreads();
+void BenchmarkFlythrough();
+void BenchmarkAnimation();
+void ReportRecordedCommands(const char* prefix);
 
 
 /************************************************/
@@ -224,39 +386,76 @@ float GenerateRandomNumber(float lowerBound, float upperBound);
 
 int main(int argc, char** argv)
 {
-  glutInit(&argc, argv);
+	/* "-benchmark <name>" times one subsystem instead of running */
+	/* the interactive animation, and "-device null|recording"    */
+	/* draws through a device that needs no window (and so no     */
+	/* display) instead of through OpenGL.                        */
+	const char* benchmarkName = NULL;
+	const char* deviceName = "gl";
+	for (int i = 1; i+1 < argc; i++)
+	{
+		if (strcmp(argv[i], "-benchmark") == 0)
+			benchmarkName = argv[++i];
+		else if (strcmp(argv[i], "-device") == 0)
+			deviceName = argv[++i];
+	}
+	if (!SelectRenderDevice(deviceName))
+		return 1;
+
+#ifdef PROFILING
+	/* Print the frame profile when the program exits (creating */
+	/* the profiler first, so that it outlives the exit hook).  */
+	Profiler::instance();
+	atexit(DumpProfile);
+#endif
+	if (benchmarkName == NULL && strcmp(deviceName, "gl") != 0)
+	{
+		cout << "The " << deviceName << " device can only be used with -benchmark" << endl;
+		return 1;
+	}
+
+	if (strcmp(deviceName, "gl") == 0)
+	{
+		glutInit(&argc, argv);
 
-  //viewPosition[2] = 1.0f;
+		//viewPosition[2] = 1.0f;
 
-	/* Set up the display window. */
-	glutInitDisplayMode( GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH );
-    glutInitWindowPosition( InitWindowPosition[0], InitWindowPosition[1] );
-	glutInitWindowSize( currWindowSize[0], currWindowSize[1] );
-    glutCreateWindow( "Speed: +/-; Time: T/t; Weather: W/w; Incline: I/i" );
+		/* Set up the display window. */
+		glutInitDisplayMode( GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH );
+		glutInitWindowPosition( InitWindowPosition[0], InitWindowPosition[1] );
+		glutInitWindowSize( currWindowSize[0], currWindowSize[1] );
+		glutCreateWindow( "Speed: +/-; Time: T/t; Weather: W/w; Incline: I/i" );
 
-	/* Specify the resizing and refreshing routines. */
-	glutReshapeFunc( ResizeWindow );
-	glutKeyboardFunc( KeyboardPress );
-	glutDisplayFunc( Display );
-	glutTimerFunc( 100, TimerFunction, 1 );
+		/* Specify the resizing and refreshing routines. */
+		glutReshapeFunc( ResizeWindow );
+		glutKeyboardFunc( KeyboardPress );
+		glutDisplayFunc( Display );
+		glutIdleFunc( IdleFunction );
+	}
 
 	/* Set up standard lighting, shading, and depth testing. */
-	glEnable(GL_LIGHTING);
-	glEnable(GL_LIGHT0);
-	glShadeModel(GL_SMOOTH);
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_NORMALIZE);
-	glEnable(GL_CULL_FACE);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glClearColor(0.2, 0.7, 0.9, 0.0);
-	glViewport(0, 0, currWindowSize[0], currWindowSize[1]);
+	render_device().enable(GL_LIGHTING);
+	render_device().enable(GL_LIGHT0);
+	render_device().shade_model(GL_SMOOTH);
+	render_device().enable(GL_DEPTH_TEST);
+	render_device().enable(GL_NORMALIZE);
+	render_device().enable(GL_CULL_FACE);
+	render_device().pixel_store(GL_UNPACK_ALIGNMENT, 1);
+	render_device().clear_color(0.2, 0.7, 0.9, 0.0);
+	render_device().viewport(0, 0, currWindowSize[0], currWindowSize[1]);
 
 	/* Enable alpha test for transparency. */
-	glAlphaFunc( GL_GREATER, 0.5 );
-	glEnable( GL_ALPHA_TEST );
+	render_device().alpha_func( GL_GREATER, 0.5 );
+	render_device().enable( GL_ALPHA_TEST );
 	
 	/* Set up all fonts, initializing to medium size. */
 
+	/* Start with no motion to interpolate over. */
+	SaveSceneState();
+
+	if (benchmarkName != NULL)
+		return RunBenchmark(benchmarkName);
+
 	glutMainLoop();
 }
 
@@ -317,6 +516,12 @@ void KeyboardPress(unsigned char pressedKey, int mouseXPosition, int mouseYPosit
 					}
 					break; 
 				}
+	/* Upper- or lower-case s: Toggle the per-frame statistics */
+	case 's':
+	case 'S':	{
+					showFrameStatistics = !showFrameStatistics;
+					break;
+				}
 	/* Lower-case t: Move time-of-day backwards */
 	case 't':	{ 
 					if (timeOfDay == dawn)
@@ -355,100 +560,175 @@ void KeyboardPress(unsigned char pressedKey, int mouseXPosition, int mouseYPosit
 }
 
 
+/*****************************************************************/
+/* Idle callback: keep redrawing, leaving it to Display to run   */
+/* however many simulation steps have come due since last frame. */
+/*****************************************************************/
+void IdleFunction()
+{
+	glutPostRedisplay();
+}
+
+
 /********************************************************************/
-/* Function to update the viewer's position, the far wall location, */
-/* and the current position of each element of precipitation.       */
+/* Advance the simulation one fixed step: update the viewer's       */
+/* position, the current position of each element of precipitation */
+/* and of each pedestrian, the splashes and snow puffs, and the     */
+/* distance travelled.                                              */
 /********************************************************************/
-void TimerFunction(int value)
+void StepSimulation()
 {
+	PROFILE_SCOPE("StepSimulation");
+
 	int i;
 
+	SaveSceneState();
+
 	for (i = 0; i < 3; i++)
 		viewPosition[i] += viewIncrement[i];
 
 	for (i = 0; i < 3; i++)
+	{
 		if (weatherCondition == snowy)
 			precipIncrement[i] += snowIncrementDelta[i];
 		else if (weatherCondition == rainy)
 			precipIncrement[i] += rainIncrementDelta[i];
 
-	glutPostRedisplay();
-	glutTimerFunc(100, TimerFunction, 1);
+		/* The step's starting point is wrapped along with it, so */
+		/* the frames drawn between the two do not sweep across.  */
+		if (fabs(precipIncrement[i]) >= PrecipWrap)
+		{
+			float wrap = (precipIncrement[i] > 0.0) ? PrecipWrap : -PrecipWrap;
+			precipIncrement[i] -= wrap;
+			previousPrecipIncrement[i] -= wrap;
+		}
+	}
+
+	/* The speed readout is in miles per hour. */
+	distanceTravelled += currentSpeed*SimulationStep/3600.0;
+
+	StepPedestrians();
+	StepParticles();
+}
+
+
+/***************************************************************/
+/* Remember the viewer's and the precipitation's state before  */
+/* a step, as the starting point for interpolating frames.     */
+/***************************************************************/
+void SaveSceneState()
+{
+	for (int i = 0; i < 3; i++)
+	{
+		previousViewPosition[i] = viewPosition[i];
+		previousPrecipIncrement[i] = precipIncrement[i];
+	}
 }
 
 
 /**********************************************************/
-/* Principal display routine: sets up material, lighting, */
-/* and camera properties, clears the frame buffer, and    */
-/* draws all texture-mapped objects within the window.    */
+/* Display callback: runs the simulation steps due for    */
+/* the real time elapsed since the last frame, then draws */
+/* the scene between the last two steps.                  */
 /**********************************************************/
 void Display()
+{
+	PROFILE_SCOPE("Display");
+
+	static Stopwatch frameTimer;
+	int steps = simulationClock.advance(frameTimer.elapsed_ms()/1000.0);
+	frameTimer.reset();
+
+	for (int i = 0; i < steps; i++)
+		StepSimulation();
+
+	DrawFrame(simulationClock.get_alpha());
+}
+
+
+/**********************************************************/
+/* Principal drawing routine: sets up material, lighting, */
+/* and camera properties, clears the frame buffer, and    */
+/* draws all texture-mapped objects within the window,    */
+/* alpha of the way from the previous simulation step to  */
+/* the current one.                                       */
+/**********************************************************/
+void DrawFrame(float alpha)
 {
 	/* Set up the properties of the light source. */
-	glLightfv(GL_LIGHT0, GL_DIFFUSE, LightIntensity);
-	glLightfv(GL_LIGHT0, GL_POSITION, LightPosition);
+	render_device().light(GL_LIGHT0, GL_DIFFUSE, LightIntensity);
+	render_device().light(GL_LIGHT0, GL_POSITION, LightPosition);
 
 	/* Limit the animation to above the "control panel". */
 	if (AspectRatio > currWindowSize[0]/currWindowSize[1])
 	{
-		glViewport(0, 0.5*(currWindowSize[1]-currViewportSize[1])+currViewportSize[1]/6, 
+		render_device().viewport(0, 0.5*(currWindowSize[1]-currViewportSize[1])+currViewportSize[1]/6, 
 						currViewportSize[0], currViewportSize[1]);
-		glScissor(0, 0.5*(currWindowSize[1]-currViewportSize[1])+currViewportSize[1]/6, 
+		render_device().scissor(0, 0.5*(currWindowSize[1]-currViewportSize[1])+currViewportSize[1]/6, 
 						currViewportSize[0], currViewportSize[1]);
 	}
 	else
 	{
-		glViewport(0.5*(currWindowSize[0]-currViewportSize[0]), currViewportSize[1]/6, 
+		render_device().viewport(0.5*(currWindowSize[0]-currViewportSize[0]), currViewportSize[1]/6, 
 						currViewportSize[0], currViewportSize[1]);
-		glScissor(0.5*(currWindowSize[0]-currViewportSize[0]), currViewportSize[1]/6, 
+		render_device().scissor(0.5*(currWindowSize[0]-currViewportSize[0]), currViewportSize[1]/6, 
 						currViewportSize[0], currViewportSize[1]);
 	}
-	glEnable(GL_SCISSOR_TEST);
+	render_device().enable(GL_SCISSOR_TEST);
 
 	/* Set up the current fog properties. */
-	glEnable(GL_FOG);
-	glFogf(GL_FOG_DENSITY, fogDensity);
-	glFogi(GL_FOG_MODE, GL_EXP);
-	glFogfv(GL_FOG_COLOR, fogColor);
+	render_device().enable(GL_FOG);
+	render_device().fog(GL_FOG_DENSITY, fogDensity);
+	render_device().fog(GL_FOG_MODE, GL_EXP);
+	render_device().fog(GL_FOG_COLOR, fogColor);
 
 	/* Set up the properties of the viewing camera. */
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-    gluPerspective(60.0, AspectRatio, 0.1, 300.0);
+	render_device().matrix_mode(GL_PROJECTION);
+	render_device().load_identity();
+    render_device().perspective(60.0, AspectRatio, 0.1, 300.0);
 
 	/* ??? When scissor is disabled AFTER rendering the animation    ??? */
 	/* ??? (where it logically SHOULD be disabled, instead of here), ??? */
 	/* ??? the control panel is still clipped from the screen.  WHY? ??? */
-	glDisable(GL_SCISSOR_TEST);
+	render_device().disable(GL_SCISSOR_TEST);
 
 	/* Position the camera and draw the texture-mapped environment. */
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
-	glPushMatrix();
+	render_device().matrix_mode(GL_MODELVIEW);
+	render_device().load_identity();
+	render_device().push_matrix();
+
+		InterpolateSceneState(alpha);
 
 		/* Position camera to always be aimed down the z-axis */
 		/* (modified slightly to accommodate any incline).    */
-		gluLookAt(viewPosition[0], viewPosition[1], viewPosition[2],
+		render_device().look_at(viewPosition[0], viewPosition[1], viewPosition[2],
 				  viewPosition[0], viewPosition[1]+lookAtYDelta, viewPosition[2]+1,
 				  0.0, 1.0, 0.0);
 
 		/* Draw the objects comprising the city scene. */
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		render_device().clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		memset(&frameStatistics, 0, sizeof(frameStatistics));
 		DrawCityElements();
 		RenderPrecipitation();
+		RenderParticles(alpha);
 
-		glPopMatrix();
+		RestoreSceneState();
+
+		render_device().pop_matrix();
 
 	/* Expand viewport so display panel can be drawn. */
-	glDisable(GL_LIGHTING);
-	glViewport(0,0,currWindowSize[0],currWindowSize[1]);
+	render_device().disable(GL_LIGHTING);
+	render_device().viewport(0,0,currWindowSize[0],currWindowSize[1]);
 	DrawDisplayPanel();
 
     
 
 	/* Exchange old and new display buffers (i.e., animate). */
-	glutSwapBuffers();
-	glFlush();
+	render_device().swap_buffers();
+	render_device().flush();
+
+	if (showFrameStatistics)
+		ReportFrameStatistics();
 }
 
 
@@ -473,228 +753,48 @@ void ResizeWindow(GLsizei w, GLsizei h)
 	}
 
 	/* Center the image within the resized window. */
-	glViewport(0.5*(w-currWindowSize[0]), 0, currWindowSize[0], currWindowSize[1]);
-
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluPerspective(60.0, (GLfloat)w / (GLfloat)h, 0.1, 200.0);
-    glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
-}
-
-
+	render_device().viewport(0.5*(w-currWindowSize[0]), 0, currWindowSize[0], currWindowSize[1]);
 
-
-void draw_person( Person* p, float z, SOR sor )
-{
-  int side = ( sor == RHS ) ? -1 : 1;
-  int rotation = ( sor == RHS ) ? 180 : 0;
-
-  glPushMatrix();
-
-    glTranslatef( side * 2.0f, -0.8f, z );
-    p->draw();
-    glRotateft( Rotation( Axis::Y, rotation ) );
-
-  glPopMatrix();
+    render_device().matrix_mode(GL_PROJECTION);
+    render_device().load_identity();
+    render_device().perspective(60.0, (GLfloat)w / (GLfloat)h, 0.1, 200.0);
+    render_device().matrix_mode(GL_MODELVIEW);
+	render_device().load_identity();
 }
 
-void draw_person( P* p, SOR sor )
-{
-  int side = ( sor == RHS ) ? -1 : 1;
-  int rotation = ( sor == RHS ) ? 180 : 0;
-  rotation += ( p->direction == -1 ) ? 180 : 0;
-
-  glPushMatrix();
-
-    glTranslatef( side * 2.0f, -0.8f, p->position );
-    p->person.draw();
-    glRotateft( Rotation( Axis::Y, rotation ) );
 
-  glPopMatrix();
-}
-
-void draw_people( vector<P*>* people_list, SOR sor )
-{
-  for( int i = 0, n = people_list->size(); i < n; ++i )
-  {
-    draw_person( (*people_list)[i], sor );
-  }
-}
 
-void draw_people( vector<Person*>* people_list, vector<float>* people_positions_list, SOR sor )
-{
-  for( int i = 0, n = people_list->size(); i < n; ++i )
-  {
-    draw_person( (*people_list)[i], (*people_positions_list)[i], sor );
-  }
-}
 
 const float g_threshold = 1.0f;
 
-bool is_valid_spot( vector<float>* obstacles_list, float spot, vector<bool>* filled_list )
-{
-  Range<> r;
-  bool spot_is_filled = false;
-  for( int i = 0, n = obstacles_list->size()-1; i < n; ++i )
-  {
-    r = Range<>( (*obstacles_list)[i] + g_threshold, (*obstacles_list)[i+1] - g_threshold );
-    
-    spot_is_filled = (*filled_list)[i];
-
-    if( !spot_is_filled && r.is_in_range_exclusive( spot ) && r.size() > 10.0f )
-      return( (*filled_list)[i] = true ); //Sets that spot in the filled array to true, then returns
-  }
-
-  return( false );
-}
-
-bool is_valid_spot( vector<float>* obstacles_list, float spot )
-{
-  Range<> r;
-  for( int i = 0, n = obstacles_list->size()-1; i < n; ++i )
-  {
-    r = Range<>( (*obstacles_list)[i] + g_threshold, (*obstacles_list)[i+1] - g_threshold );
-    
-    if( r.is_in_range_exclusive( spot ) && r.size() > 10.0f )
-      return( true );
-  }
-
-  return( false );
-}
-
-void place_people( vector<Person*>* people_list, vector<float>* people_positions, vector<float>* obstacles_list,
-                   vector<bool>* filled_list, int people_count, float first_z )
-{
-  float z;
-  int people_left = people_count;
-
-  for( int i = 0, n = people_list->size(); i < n; ++i, people_list->pop_back() )
-  {
-    garbage_collect( (*people_list)[people_list->size()-1] );
-  }
-
-  filled_list->resize( obstacles_list->size()-1 );
-
-  while( people_left > 0 )
-  {
-    do
-    {
-      z = Random<>().next( 0.0f, 200.0f ) + first_z;
-    } while ( !is_valid_spot( obstacles_list, z, filled_list ) );
-
-    people_list->push_back( new Person() );
-    people_positions->push_back( z );  
-
-    --people_left;
-  }
-}
-
-void place_people( vector<P*>* people_list, vector<float>* obstacles_list,
-                   vector<bool>* filled_list, int people_count, float first_z )
-{
-  float z;
-  int people_left = people_count;
-  P* p;
-
-  for( int i = 0, n = people_list->size(); i < n; ++i, people_list->pop_back() )
-  {
-    garbage_collect( (*people_list)[people_list->size()-1] );
-  }
-
-  filled_list->resize( obstacles_list->size()-1 );
-
-  while( people_left > 0 )
-  {
-    do
-    {
-      z = Random<>().next( 0.0f, 200.0f ) + first_z;
-    } while ( !is_valid_spot( obstacles_list, z, filled_list ) );
-
-    p = new P();
-    p->position = z;
-
-    people_list->push_back( p );
-
-    --people_left;
-  }
-}
-
-void delete_obstacles_behind_camera( vector<float>*& list, float camera_pos )
+// Whether spot is in a gap between obstacles long enough for people to
+// walk in.
+bool is_valid_spot( const ObstacleIndex& obstacles, float spot )
 {
-  int i;
-  for( i = 0; i < list->size() && (*list)[i] < camera_pos; ++i );
-
-  if( i == 0 ) return;
-
-  vector<float>* tmp = new vector<float>;
-
-  for(; i < list->size(); ++i)
-    tmp->push_back( (*list)[i] );
-
-  garbage_collect( list );
-
-  list = tmp;
+  return( obstacles.is_in_gap( spot, g_threshold, 10.0f ) );
 }
 
 const float g_person_delta = 0.5f;
-
-void walk( Person* p, float& pos, vector<float>* obstacles, int direction, SOR sor )
-{
-  int side = ( sor == RHS ) ? -1 : 1;
-
-  if( is_valid_spot(obstacles, pos + ( direction * side * g_person_delta ) ) )
-  {
-    pos += ( direction * side * g_person_delta );
-  }
-  else
-  {
-    // turn aroudn and walk other way;
-  }
-
-}
-
-void walk( P* p, vector<float>* obstacles, SOR sor )
-{
-  int side = ( sor == RHS ) ? -1 : 1;
-
-  if( is_valid_spot(obstacles, p->position + ( p->direction * side * g_person_delta ) ) )
-  {
-    p->position += ( p->direction * side * g_person_delta );
-  }
-  else
-  {
-    // turn aroudn and walk other way;
-  }
-
-}
-
-void march( vector<Person*>* people, vector<float>* people_positions, vector<float>* obstacles, SOR sor )
-{
-  for( int i = 0, n = people->size(); i < n; ++i )
-  {
-    walk( (*people)[i], (*people_positions)[i], obstacles, 1, sor );
-  }
-}
-
-void march( vector<P*>* people, vector<float>* obstacles, SOR sor )
-{
-  for( int i = 0, n = people->size(); i < n; ++i )
-  {
-    walk( (*people)[i], obstacles, sor );
-  }
-}
-
-list<P> new_people_left;
-list<P> new_people_right;
-list<float> obstacles_left;
-list<float> obstacles_right;
-
-void place_people( float firstZ, list<P>& l, int direction )
+const float g_pedestrian_spacing = 1.0f;
+
+// Everyone on the sidewalks, the figure whose bounds they are all culled
+// by, and the batch they are drawn in.  People set off at their own point
+// in the walk cycle, some a little faster or slower than others, so that
+// they do not all step in time, and keep out of each other's way.
+Crowd              pedestrians( g_threshold, g_pedestrian_spacing );
+Person             pedestrian_figure;
+PersonBatch        pedestrian_batch;
+const unsigned int g_pedestrian_seed = 7;
+const Range<>      g_walk_rate( 0.85f, 1.15f );
+
+// The streetlights and props along each sidewalk, by Z.
+ObstacleIndex obstacles_left;
+ObstacleIndex obstacles_right;
+
+void place_people( float firstZ, int direction )
 {
   bool wtf;
   float z;
-  P tmp;
 
   for( int i = 1; i < 10; i += 2 )
   {
@@ -704,77 +804,105 @@ void place_people( float firstZ, list<P>& l, int direction )
       z = firstZ-(0.5*RoadBlockLength)+i*RoadBlockLength;
     else
       z = firstZ-(NbrOfRoadIterations*RoadBlockLength+0.5*RoadBlockLength)+i*RoadBlockLength;
-    
-    tmp = P();
-    tmp.position  = z;
-    tmp.direction = direction;
-    tmp.side      = direction;
-    l.push_front( tmp );
+
+    Random<> r( g_pedestrian_seed, 0, pedestrians.size() );
+    pedestrians.add( z, direction, direction, r.next( 0 ), r.next( 1, g_walk_rate ) );
   }
 }
 
-// Checks all people... if they are behind the camera's Z
-// value, add 200
-void replace_people( list<P>& l )
+// One simulation step for the pedestrians: obstacles that have fallen
+// behind the camera are moved ahead, and people who have are replaced by
+// newcomers ahead, in the same slots of the crowd.  Then everyone walks,
+// steered around the obstacles and each other in chunks spread over the
+// worker pool.  Recycling comes first so that nobody is interpolated
+// across the jump, and so that the obstacles are in order.
+void StepPedestrians()
 {
-  for( list<P>::iterator i = l.begin(), n = l.end(); i != n; ++i )
-  {
-    if( (*i).position < viewPosition[2] )
-      (*i).position += 200;
-  }
+  obstacles_left.recycle( viewPosition[2], NbrOfRoadIterations*RoadBlockLength );
+  obstacles_right.recycle( viewPosition[2], NbrOfRoadIterations*RoadBlockLength );
+  pedestrians.respawn( viewPosition[2], NbrOfRoadIterations*RoadBlockLength, g_pedestrian_seed, g_walk_rate );
+  pedestrians.step( g_person_delta, obstacles_left, obstacles_right, workerPool );
 }
 
-// Checks all obstacles... if they are behind the camera's Z
-// value, add 200
-void replace_obstacles( list<float>& l )
+void cull_people()
 {
-  for( list<float>::iterator i = l.begin(), n = l.end(); i != n; ++i )
-  {
-    if( (*i) < viewPosition[2] )
-      (*i) += 200;
-  }
+  BoundingBox bounds = pedestrian_figure.get_bounds();
 
-  l.sort();
-}
-/*
-void turn_around( P& p )
-{
-  p.direction *= -1;
-  // Animate this!
+  for( int i = 0, n = pedestrians.size(); i < n; ++i )
+    sceneCuller.add( bounds.translated( pedestrians.get_side( i ) * 2.0, -0.8, pedestrians.get_position( i ) ) );
 }
 
-bool check_collision( P& p, list<float> l )
+// Draws the people whose boxes were added to the scene culler starting
+// at cull_index, each at the level of detail for its distance from the
+// camera.  Each is evaluated into the matrices of the figure's parts,
+// which are drawn straight away or added to the batch, which is drawn
+// once everyone is in it.
+void draw_people( int cull_index )
 {
-  for( list<float>::iterator i1 = l.begin(), i2 = (++l.begin()), n = l.end(); i2 != n; ++i1, ++i2 )
+  PROFILE_SCOPE( "draw_people" );
+
+  pedestrian_batch.clear();
+  pedestrian_batch.reserve( pedestrians.size() );
+
+  float  pose[Joint::COUNT];
+  Matrix parts[Person::PART_COUNT];
+
+  for( int i = 0, n = pedestrians.size(); i < n; ++i, ++cull_index )
   {
-    if(
-      Range<>(
-        (*i1) + g_threshold,
-        (*i2) - g_threshold
-      ).is_in_range_exclusive( p.position )
-    )
-      return( true );
+    if( !sceneCuller.is_visible( cull_index ) )
+      continue;
+
+    float x  = pedestrians.get_side( i ) * 2.0;
+    float z  = pedestrians.get_position( i );
+    float dx = x - viewPosition[0];
+    float dy = -0.8 - viewPosition[1];
+    float dz = z - viewPosition[2];
+    pedestrians.update_lod( i, sqrt( dx*dx + dy*dy + dz*dz ) );
+
+    Matrix model;
+    model.translate( x, -0.8, z );
+
+    pedestrians.get_pose( i, pose );
+    Person::pose_parts( pose, model, parts );
+    if( peopleRenderMode == InstancedPeople )
+      pedestrian_batch.add( parts, pedestrians.get_lod( i ) );
+    else
+      Person::draw_parts( parts, pedestrians.get_lod( i ) );
   }
 
-  return( false );
+  if( peopleRenderMode == InstancedPeople )
+    pedestrian_batch.draw();
 }
-*/
-void draw_people( list<P>& l, list<float> obstacles )
+
+/****************************************************************/
+/* Put the viewer, the precipitation and the pedestrians alpha  */
+/* of the way from their previous simulated state to their      */
+/* current one, for drawing.  RestoreSceneState puts the        */
+/* simulated state back, so that drawing never alters it.       */
+/****************************************************************/
+void InterpolateSceneState(float alpha)
 {
-  for( list<P>::iterator i = l.begin(), n = l.end(); i != n; ++i )
-  {
-    glPushMatrix();
-      // Animates character
+	for (int i = 0; i < 3; i++)
+	{
+		simulatedViewPosition[i] = viewPosition[i];
+		viewPosition[i] = previousViewPosition[i] + alpha*(viewPosition[i]-previousViewPosition[i]);
 
-      //if( check_collision( (*i), obstacles ) )
-      //  turn_around( (*i) );
+		simulatedPrecipIncrement[i] = precipIncrement[i];
+		precipIncrement[i] = previousPrecipIncrement[i] + alpha*(precipIncrement[i]-previousPrecipIncrement[i]);
+	}
 
-      (*i).position += (*i).direction * g_person_delta;
+	pedestrians.interpolate( alpha );
+}
 
-      glTranslatef( (*i).side * 2.0, -0.8, (*i).position );
-      (*i).person.draw();
-    glPopMatrix();
-  }
+void RestoreSceneState()
+{
+	for (int i = 0; i < 3; i++)
+	{
+		viewPosition[i] = simulatedViewPosition[i];
+		precipIncrement[i] = simulatedPrecipIncrement[i];
+	}
+
+	pedestrians.restore();
 }
 
 /**************************************************************/
@@ -783,131 +911,177 @@ void draw_people( list<P>& l, list<float> obstacles )
 /**************************************************************/
 void DrawCityElements()
 {	
+	PROFILE_SCOPE("DrawCityElements");
+
 	static bool firstTime = true;
-  static float old_z = -1.0f;
-	static time_t randomNumberSeed;
 
 	if (firstTime)
 	{
-		time(&randomNumberSeed);
+		citySeed = (unsigned int)time(NULL);
 	}
-	srand(randomNumberSeed);
 
 	GLfloat firstZ = 0.0;				// z-position of first recycled cube
 	while (firstZ < viewPosition[2])
 		firstZ += 200.0;
 
 
-	glEnable(GL_LIGHTING);
-	glEnable(GL_LIGHT0);
+	render_device().enable(GL_LIGHTING);
+	render_device().enable(GL_LIGHT0);
 	DrawIntersection(firstZ);
+	DrawCityFarPlaneCube();
+	FlushRenderQueue();
+
+	if (timeOfDay != cityBlockCacheTimeOfDay)
+	{
+		cityBlockCache.invalidate();
+		cityBlockCacheTimeOfDay = timeOfDay;
+	}
+
+	for (int i = 1; i < NbrOfRoadIterations; i++)
+	{
+		if (!cityBlockCache.is_baked(i))
+			BakeCityBlock(firstZ, i, firstTime);
+	}
 
 	if (firstTime)
 	{
-    float tmp;
-    for (int i = 1; i < NbrOfRoadIterations; i++)
-    {
-  	  obstacles_right.push_front( DrawStreetlight(firstZ, i, RHS) );
-  	  obstacles_left.push_front( DrawStreetlight(firstZ, i, LHS) );
-
-  	  tmp = DrawCityProp(firstZ, i);
-      if( tmp > 0.0f )
-        obstacles_left.push_front( tmp );
-      else
-        obstacles_right.push_front( -tmp );
-    }
+		place_people( firstZ, 1 );
+		place_people( firstZ, -1 );
+	}
 
-    place_people( firstZ, new_people_left, 1 );
-    place_people( firstZ, new_people_right, -1 );
+	CullSceneObjects(firstZ);
+
+	for (int i = 1; i < NbrOfRoadIterations; i++)
+	{
+		if (sceneCuller.is_visible(i-1))
+			DrawCityBlock(firstZ, i);
 	}
-  else
-  {
-    for (int i = 1; i < NbrOfRoadIterations; i++)
-    {
-      DrawStreetlight(firstZ, i, RHS);
-      DrawStreetlight(firstZ, i, LHS);
-      DrawCityProp(firstZ, i);
-    }
-  }
 
-  replace_obstacles( obstacles_left );
-  replace_obstacles( obstacles_right );
-  replace_people( new_people_left );
-  replace_people( new_people_right );
+  Person::triangle_count() = 0;
+  draw_people( NbrOfRoadIterations-1 );
+  frameStatistics.personTriangles = Person::triangle_count();
 
+	render_device().disable(GL_LIGHTING);
+	render_device().disable(GL_LIGHT0);
+  
+	if (firstTime)
+		firstTime = false;
+}
 
-/*
-  if( old_z != firstZ )
-  {
-    old_z = firstZ;
+/*****************************************************************/
+/* Return the z-value at which the indexed road block currently  */
+/* begins, taking into account whether that block has already    */
+/* been recycled in front of the viewer.  Every element of the   */
+/* block is positioned relative to this value.                   */
+/*****************************************************************/
+GLfloat CityBlockOrigin(GLfloat firstZ, int index)
+{
+	GLfloat z = firstZ+(index-1)*RoadBlockLength;
+	if (firstZ+index*RoadBlockLength > viewPosition[2]+NbrOfRoadIterations*RoadBlockLength)
+		z -= NbrOfRoadIterations*RoadBlockLength;
+	return z;
+}
 
-    float tmp;
+/*******************************************************************/
+/* Compile the indexed road block (road, sidewalks, streetlights,  */
+/* prop and skyscrapers) into the block cache, relative to the     */
+/* block's origin so that the same geometry can be replayed every  */
+/* time the block is recycled.  Each block's random values are     */
+/* keyed by its index, so that it always bakes to the same         */
+/* buildings and props, no matter when it is (re)baked.  On the    */
+/* first pass, the z-values of the streetlights and props are      */
+/* recorded as sidewalk obstacles.                                 */
+/*******************************************************************/
+void BakeCityBlock(GLfloat firstZ, int index, bool collectObstacles)
+{
+	float rightLight, leftLight, prop;
 
-    delete_obstacles_behind_camera( g_obstacles_left,  viewPosition[2] );
-    delete_obstacles_behind_camera( g_obstacles_right, viewPosition[2] );
+	renderQueue.push();
+		renderQueue.translate( 0.0, 0.0, -CityBlockOrigin(firstZ, index) );
 
+		rightLight = DrawStreetlight(firstZ, index, RHS);
+		leftLight  = DrawStreetlight(firstZ, index, LHS);
+		prop       = DrawCityProp(firstZ, index);
 
-    for (int i = 1; i < NbrOfRoadIterations; i++)
-    {
-      g_obstacles_right->push_back( rsl[i] );
-	  	g_obstacles_left->push_back(  lsl[i] );
+		DrawRoadCube(firstZ, index);
+		DrawSidewalkCubePair(firstZ, index);
+		DrawSkyscraper(firstZ, index, RHS);
+		DrawSkyscraper(firstZ, index, LHS);
+	renderQueue.pop();
 
-	  	tmp = cp[i];
+	cityBlockCache.begin_bake(index);
+	renderQueue.flush();
+	cityBlockCache.end_bake(index);
 
-      if( tmp > 0.0f )
-        g_obstacles_right->push_back( firstZ + tmp );
-      else
-        g_obstacles_left->push_back( firstZ + -tmp );
-    }
+	cityBlockMaterialChanges[index][0] = renderQueue.get_unsorted_state_changes();
+	cityBlockMaterialChanges[index][1] = renderQueue.get_sorted_state_changes();
+	cityBlockBounds[index] = renderQueue.get_bounds();
 
-    sort( g_obstacles_left->begin(), g_obstacles_left->end() );
-    sort( g_obstacles_right->begin(), g_obstacles_right->end() );
+	if (collectObstacles)
+	{
+		obstacles_right.insert( rightLight );
+		obstacles_left.insert( leftLight );
 
+		if( prop > 0.0f )
+			obstacles_left.insert( prop );
+		else
+			obstacles_right.insert( -prop );
+	}
+}
 
-    static int ignore_second_time = 0;
-    ++ignore_second_time;
+/************************************************************/
+/* Replay the baked geometry of the indexed road block at   */
+/* the block's current position.                            */
+/************************************************************/
+void DrawCityBlock(GLfloat firstZ, int index)
+{
+	render_device().push_matrix();
+		render_device().translate( 0.0, 0.0, CityBlockOrigin(firstZ, index) );
+		cityBlockCache.draw(index);
+	render_device().pop_matrix();
+	Material<>::forget_applied();
+
+	frameStatistics.unsortedMaterialChanges += cityBlockMaterialChanges[index][0];
+	frameStatistics.sortedMaterialChanges   += cityBlockMaterialChanges[index][1];
+}
 
-    if( ignore_second_time < 2 )
-    {
-      place_people( g_people_left, g_people_positions_left, g_obstacles_left, g_filled_left, 5, firstZ );
-      place_people( g_people_right, g_people_positions_right, g_obstacles_right, g_filled_right, 5, firstZ );
-    }
-    else
-    {
-      for( int i = 0, n = g_people_positions_left->size(); i < n; ++i )
-      {
-        if( (*g_people_positions_left)[i] < viewPosition[2] )
-        {
-          g_people_positions_left += 210;
-        }
-      }
-    }
-  }
+/****************************************************************/
+/* Test the bounding boxes of every city block and pedestrian   */
+/* against the current view frustum, in one batch, recording    */
+/* how many of them are visible in this frame's statistics.     */
+/****************************************************************/
+void CullSceneObjects(GLfloat firstZ)
+{
+	PROFILE_SCOPE("CullSceneObjects");
 
-  march( g_people_left, g_people_positions_left, g_obstacles_left, LHS );
+	Matrix projection, modelview;
+	render_device().get_matrix(GL_PROJECTION, projection);
+	render_device().get_matrix(GL_MODELVIEW, modelview);
 
-  draw_people( g_people_left, g_people_positions_left, LHS );
-  draw_people( g_people_right, g_people_positions_right, RHS );
-*/
-  
-  
-  for (int i = 1; i < NbrOfRoadIterations; i++)
-  {
-  	DrawRoadCube(firstZ, i);
-  	DrawSidewalkCubePair(firstZ,i);
-  	DrawSkyscraper(firstZ, i, RHS);
-	  DrawSkyscraper(firstZ, i, LHS);
-  }
-        
-  draw_people( new_people_left,  obstacles_left );
-  draw_people( new_people_right, obstacles_right );
+	sceneCuller.clear();
+	for (int i = 1; i < NbrOfRoadIterations; i++)
+		sceneCuller.add( cityBlockBounds[i].translated(0.0, 0.0, CityBlockOrigin(firstZ, i)) );
+	cull_people();
 
-	DrawCityFarPlaneCube();
-	glDisable(GL_LIGHTING);
-	glDisable(GL_LIGHT0);
-  
-	if (firstTime)
-		firstTime = false;
+	sceneCuller.reset_counters();
+	sceneCuller.cull( Frustum(projection, modelview) );
+
+	frameStatistics.visibleObjects = sceneCuller.get_visible_count();
+	frameStatistics.culledObjects  = sceneCuller.get_culled_count();
+}
+
+/*************************************************************/
+/* Draw everything submitted to the render queue so far, and */
+/* add its material changes to this frame's statistics.      */
+/*************************************************************/
+void FlushRenderQueue()
+{
+	PROFILE_SCOPE("FlushRenderQueue");
+
+	renderQueue.flush();
+
+	frameStatistics.unsortedMaterialChanges += renderQueue.get_unsorted_state_changes();
+	frameStatistics.sortedMaterialChanges   += renderQueue.get_sorted_state_changes();
 }
 
 /**************************************************/
@@ -923,23 +1097,18 @@ void DrawIntersection(GLfloat firstZ)
 	GLfloat matSpecular[]  = { RoadColor[0], RoadColor[1], RoadColor[2], 1.0 };
 	GLfloat matEmission[]  = { 0.0, 0.0, 0.0, 0.0 };
 	GLfloat matShininess[] = { 0.3 };
-	glMaterialfv(GL_FRONT, GL_AMBIENT,   matAmbient);
-	glMaterialfv(GL_FRONT, GL_DIFFUSE,   matDiffuse);
-	glMaterialfv(GL_FRONT, GL_SPECULAR,  matSpecular);
-	glMaterialfv(GL_FRONT, GL_EMISSION,  matEmission);
-	glMaterialfv(GL_FRONT, GL_SHININESS, matShininess);
+	renderQueue.set_material( MaterialKey(matAmbient, matDiffuse, matSpecular, matEmission, matShininess[0]) );
 
 	GLfloat tranZ = firstZ-(0.75*RoadBlockLength);
 	if (firstZ > viewPosition[2]+NbrOfRoadIterations*RoadBlockLength)
 		tranZ -= NbrOfRoadIterations*RoadBlockLength;
 
 	/* Intersecting road cube */
-	glPushMatrix();
-		glColor3f( RoadColor[0], RoadColor[1], RoadColor[2] );
-		glTranslatef( 0.0, Ymin, tranZ );
-		glScalef( IntersectionBlockScale[0], IntersectionBlockScale[1], IntersectionBlockScale[2] );
-		glutSolidCube(RoadBlockLength);
-	glPopMatrix();
+	renderQueue.push();
+		renderQueue.translate( 0.0, Ymin, tranZ );
+		renderQueue.scale( IntersectionBlockScale[0], IntersectionBlockScale[1], IntersectionBlockScale[2] );
+		renderQueue.cube(RoadBlockLength);
+	renderQueue.pop();
 
 	/* Vertical crosswalk cubes */
 	for (j = 0; j < 3; j++)
@@ -947,29 +1116,24 @@ void DrawIntersection(GLfloat firstZ)
 		matAmbient[j] = matDiffuse[j] = matSpecular[j] = RoadLineColor[j];
 		matEmission[j] = 0.0;
 	}
-	glMaterialfv(GL_FRONT, GL_AMBIENT,   matAmbient);
-	glMaterialfv(GL_FRONT, GL_DIFFUSE,   matDiffuse);
-	glMaterialfv(GL_FRONT, GL_SPECULAR,  matSpecular);
-	glMaterialfv(GL_FRONT, GL_EMISSION,  matEmission);
-	glMaterialfv(GL_FRONT, GL_SHININESS, matShininess);
+	renderQueue.set_material( MaterialKey(matAmbient, matDiffuse, matSpecular, matEmission, matShininess[0]) );
 
 	for (j = 0; j < 4; j++)
 	{
-		glPushMatrix();
-			glColor3f( RoadLineColor[0], RoadLineColor[1], RoadLineColor[2] );
+		renderQueue.push();
 			tranZ = firstZ-(0.75*RoadBlockLength);
 			if (firstZ > viewPosition[2]+NbrOfRoadIterations*RoadBlockLength)
 				tranZ -= NbrOfRoadIterations*RoadBlockLength;
 			switch (j)
 			{
-			case 0: { glTranslatef(    CrosswalkDisplacement+CrosswalkWidth, Ymin+0.01, tranZ ); break; }
-			case 1: { glTranslatef(                   CrosswalkDisplacement, Ymin+0.01, tranZ ); break; }
-			case 2: { glTranslatef(                  -CrosswalkDisplacement, Ymin+0.01, tranZ ); break; }
-			case 3: { glTranslatef( -(CrosswalkDisplacement+CrosswalkWidth), Ymin+0.01, tranZ ); break; }
+			case 0: { renderQueue.translate(    CrosswalkDisplacement+CrosswalkWidth, Ymin+0.01, tranZ ); break; }
+			case 1: { renderQueue.translate(                   CrosswalkDisplacement, Ymin+0.01, tranZ ); break; }
+			case 2: { renderQueue.translate(                  -CrosswalkDisplacement, Ymin+0.01, tranZ ); break; }
+			case 3: { renderQueue.translate( -(CrosswalkDisplacement+CrosswalkWidth), Ymin+0.01, tranZ ); break; }
 			}
-			glScalef( VerticalCrosswalkScale[0], VerticalCrosswalkScale[1], VerticalCrosswalkScale[2] );
-			glutSolidCube(RoadBlockLength);
-		glPopMatrix();
+			renderQueue.scale( VerticalCrosswalkScale[0], VerticalCrosswalkScale[1], VerticalCrosswalkScale[2] );
+			renderQueue.cube(RoadBlockLength);
+		renderQueue.pop();
 	}
 
 	/* Horizontal crosswalk cubes (limit strobing/aliasing by  */
@@ -978,8 +1142,7 @@ void DrawIntersection(GLfloat firstZ)
 		(firstZ-viewPosition[2] < 3*RoadBlockLength))
 		for (j = 0; j < 4; j++)
 		{
-			glPushMatrix();
-				glColor3f( RoadLineColor[0], RoadLineColor[1], RoadLineColor[2] );
+			renderQueue.push();
 				tranZ = firstZ-(0.75*RoadBlockLength);
 				if (firstZ > viewPosition[2]+NbrOfRoadIterations*RoadBlockLength)
 					tranZ -= NbrOfRoadIterations*RoadBlockLength;
@@ -990,10 +1153,10 @@ void DrawIntersection(GLfloat firstZ)
 				case 2: { tranZ -= 0.52*RoadBlockLength;                  break; }
 				case 3: { tranZ -= (0.52*RoadBlockLength+CrosswalkWidth); break; }
 				}
-				glTranslatef( 0.0, Ymin+0.01, tranZ );
-				glScalef( HorizCrosswalkScale[0], HorizCrosswalkScale[1], HorizCrosswalkScale[2] );
-				glutSolidCube(RoadBlockLength);
-			glPopMatrix();
+				renderQueue.translate( 0.0, Ymin+0.01, tranZ );
+				renderQueue.scale( HorizCrosswalkScale[0], HorizCrosswalkScale[1], HorizCrosswalkScale[2] );
+				renderQueue.cube(RoadBlockLength);
+			renderQueue.pop();
 		}
 }
 
@@ -1013,23 +1176,18 @@ float DrawRoadCube(GLfloat firstZ, int index)
 	GLfloat matSpecular[]  = { RoadColor[0], RoadColor[1], RoadColor[2], 1.0 };
 	GLfloat matEmission[]  = { 0.0, 0.0, 0.0, 0.0 };
 	GLfloat matShininess[] = { 0.3 };
-	glMaterialfv(GL_FRONT, GL_AMBIENT,   matAmbient);
-	glMaterialfv(GL_FRONT, GL_DIFFUSE,   matDiffuse);
-	glMaterialfv(GL_FRONT, GL_SPECULAR,  matSpecular);
-	glMaterialfv(GL_FRONT, GL_EMISSION,  matEmission);
-	glMaterialfv(GL_FRONT, GL_SHININESS, matShininess);
+	renderQueue.set_material( MaterialKey(matAmbient, matDiffuse, matSpecular, matEmission, matShininess[0]) );
 
 	GLfloat tranZ = firstZ-(0.75*RoadBlockLength)+index*RoadBlockLength;
 	if (firstZ+index*RoadBlockLength > viewPosition[2]+NbrOfRoadIterations*RoadBlockLength)
 		tranZ -= NbrOfRoadIterations*RoadBlockLength;
 
 	/* Road cube */
-	glPushMatrix();
-		glColor3f( RoadColor[0], RoadColor[1], RoadColor[2] );
-		glTranslatef( 0.0, Ymin, tranZ );
-		glScalef( RoadBlockScale[0], RoadBlockScale[1], RoadBlockScale[2] );
-		glutSolidCube(RoadBlockLength);
-	glPopMatrix();
+	renderQueue.push();
+		renderQueue.translate( 0.0, Ymin, tranZ );
+		renderQueue.scale( RoadBlockScale[0], RoadBlockScale[1], RoadBlockScale[2] );
+		renderQueue.cube(RoadBlockLength);
+	renderQueue.pop();
 
 	/* Road white-line cubes */
 	for (j = 0; j < 3; j++)
@@ -1037,22 +1195,17 @@ float DrawRoadCube(GLfloat firstZ, int index)
 		matAmbient[j] = matDiffuse[j] = matSpecular[j] = RoadLineColor[j];
 		matEmission[j] = 0.0;
 	}
-	glMaterialfv(GL_FRONT, GL_AMBIENT,   matAmbient);
-	glMaterialfv(GL_FRONT, GL_DIFFUSE,   matDiffuse);
-	glMaterialfv(GL_FRONT, GL_SPECULAR,  matSpecular);
-	glMaterialfv(GL_FRONT, GL_EMISSION,  matEmission);
-	glMaterialfv(GL_FRONT, GL_SHININESS, matShininess);
+	renderQueue.set_material( MaterialKey(matAmbient, matDiffuse, matSpecular, matEmission, matShininess[0]) );
 	for (j = 0; j < NbrOfLinesPerRoadBlock; j++)
 	{
-		glPushMatrix();
-			glColor3f( RoadLineColor[0], RoadLineColor[1], RoadLineColor[2] );
+		renderQueue.push();
 			tranZ = firstZ-(1.125*RoadBlockLength)+index*RoadBlockLength + j*RoadBlockLength/4;
 			if (firstZ+index*RoadBlockLength > viewPosition[2]+NbrOfRoadIterations*RoadBlockLength)
 				tranZ -= NbrOfRoadIterations*RoadBlockLength;
-			glTranslatef( 0.0, Ymin+0.01, tranZ );
-			glScalef( RoadLineScale[0], RoadLineScale[1], RoadLineScale[2] );
-			glutSolidCube(RoadBlockLength);
-		glPopMatrix();
+			renderQueue.translate( 0.0, Ymin+0.01, tranZ );
+			renderQueue.scale( RoadLineScale[0], RoadLineScale[1], RoadLineScale[2] );
+			renderQueue.cube(RoadBlockLength);
+		renderQueue.pop();
 	}
 
     return( tranZ );
@@ -1072,27 +1225,21 @@ void DrawSidewalkCubePair(GLfloat firstZ, int index)
 	GLfloat matSpecular[] = { SidewalkColor[0], SidewalkColor[1], SidewalkColor[2], 1.0 };
 	GLfloat matEmission[] = { 0.0, 0.0, 0.0, 0.0 };
 	GLfloat matShininess[] = { 0.3 };
-	glMaterialfv(GL_FRONT, GL_AMBIENT,   matAmbient);
-	glMaterialfv(GL_FRONT, GL_DIFFUSE,   matDiffuse);
-	glMaterialfv(GL_FRONT, GL_SPECULAR,  matSpecular);
-	glMaterialfv(GL_FRONT, GL_EMISSION,  matEmission);
-	glMaterialfv(GL_FRONT, GL_SHININESS, matShininess);
+	renderQueue.set_material( MaterialKey(matAmbient, matDiffuse, matSpecular, matEmission, matShininess[0]) );
 
 	GLfloat tranZ = firstZ-(0.75*RoadBlockLength)+index*RoadBlockLength;
 	if (firstZ+index*RoadBlockLength > viewPosition[2]+NbrOfRoadIterations*RoadBlockLength)
 		tranZ -= NbrOfRoadIterations*RoadBlockLength;
-	glPushMatrix();
-		glColor3f( SidewalkColor[0], SidewalkColor[1], SidewalkColor[2] );
-		glTranslatef( -SidewalkDisplacement, Ymin, tranZ );
-		glScalef( SidewalkScale[0], SidewalkScale[1], SidewalkScale[2] );
-		glutSolidCube(RoadBlockLength);
-	glPopMatrix();
-	glPushMatrix();
-		glColor3f( SidewalkColor[0], SidewalkColor[1], SidewalkColor[2] );
-		glTranslatef( SidewalkDisplacement, Ymin, tranZ );
-		glScalef( SidewalkScale[0], SidewalkScale[1], SidewalkScale[2] );
-		glutSolidCube(RoadBlockLength);
-	glPopMatrix();
+	renderQueue.push();
+		renderQueue.translate( -SidewalkDisplacement, Ymin, tranZ );
+		renderQueue.scale( SidewalkScale[0], SidewalkScale[1], SidewalkScale[2] );
+		renderQueue.cube(RoadBlockLength);
+	renderQueue.pop();
+	renderQueue.push();
+		renderQueue.translate( SidewalkDisplacement, Ymin, tranZ );
+		renderQueue.scale( SidewalkScale[0], SidewalkScale[1], SidewalkScale[2] );
+		renderQueue.cube(RoadBlockLength);
+	renderQueue.pop();
 }
 
 /*********************************************************************/
@@ -1114,15 +1261,10 @@ float DrawStreetlight(GLfloat firstZ, int index, SOR roadside)
 	GLfloat matSpecular[] = { LamppostColor[0], LamppostColor[1], LamppostColor[2], 1.0 };
 	GLfloat matEmission[] = { 0.0, 0.0, 0.0, 0.0 };
 	GLfloat matShininess[] = { 0.3 };
-	glMaterialfv(GL_FRONT, GL_AMBIENT,   matAmbient);
-	glMaterialfv(GL_FRONT, GL_DIFFUSE,   matDiffuse);
-	glMaterialfv(GL_FRONT, GL_SPECULAR,  matSpecular);
-	glMaterialfv(GL_FRONT, GL_EMISSION,  matEmission);
-	glMaterialfv(GL_FRONT, GL_SHININESS, matShininess);
+	renderQueue.set_material( MaterialKey(matAmbient, matDiffuse, matSpecular, matEmission, matShininess[0]) );
 
 	/* Draw the ovoid base of the lamppost */
-	glPushMatrix();		// Base
-		glColor3f( LamppostColor[0], LamppostColor[1], LamppostColor[2] );
+	renderQueue.push();		// Base
 		trans[0] = (roadside == RHS) ? (-LamppostDisplacement) : (LamppostDisplacement);
 		trans[1] = Ymin + 0.6;
 		trans[2] = firstZ+(index-1)*RoadBlockLength;
@@ -1130,14 +1272,13 @@ float DrawStreetlight(GLfloat firstZ, int index, SOR roadside)
 			trans[2] += 0.5*RoadBlockLength;
 		if (firstZ+index*RoadBlockLength > viewPosition[2]+NbrOfRoadIterations*RoadBlockLength)
 			trans[2] -= NbrOfRoadIterations*RoadBlockLength;
-		glTranslatef(trans[0],trans[1],trans[2]);
-		glScalef( 0.25, 1.0, 0.25 );
-		glutSolidSphere(1.0, 12, 12);
-	glPopMatrix();
+		renderQueue.translate(trans[0],trans[1],trans[2]);
+		renderQueue.scale( 0.25, 1.0, 0.25 );
+		renderQueue.sphere(1.0, 12, 12);
+	renderQueue.pop();
 
 	/* Draw the vertical pole of the lamppost */
-	glPushMatrix();
-		glColor3f( LamppostColor[0], LamppostColor[1], LamppostColor[2] );
+	renderQueue.push();
 		trans[0] = (roadside == RHS) ? (-LamppostDisplacement) : (LamppostDisplacement);
 		trans[1] = Ymin + 0.6;//LamppostPoleHeight + 0.6;
 		trans[2] = firstZ+(index-1)*RoadBlockLength;
@@ -1145,15 +1286,14 @@ float DrawStreetlight(GLfloat firstZ, int index, SOR roadside)
 			trans[2] += 0.5*RoadBlockLength;
 		if (firstZ+index*RoadBlockLength > viewPosition[2]+NbrOfRoadIterations*RoadBlockLength)
 			trans[2] -= NbrOfRoadIterations*RoadBlockLength;
-		glTranslatef(trans[0],trans[1],trans[2]);
-		glRotatef( -90.0, 1.0, 0.0, 0.0 );
-		glutSolidCone(0.075, LamppostPoleHeight, 12, 1);
-	glPopMatrix();
+		renderQueue.translate(trans[0],trans[1],trans[2]);
+		renderQueue.rotate( -90.0, 1.0, 0.0, 0.0 );
+		renderQueue.cone(0.075, LamppostPoleHeight, 12, 1);
+	renderQueue.pop();
 
 	// Draw the three portions of the "curved" //
 	// beam from which the lamp is suspended   //
-	glPushMatrix();
-		glColor3f( LamppostColor[0], LamppostColor[1], LamppostColor[2] );
+	renderQueue.push();
 		trans[0] = (roadside == RHS) ? (-LamppostDisplacement) : (LamppostDisplacement);
 		trans[1] = Ymin + 5.4;
 		trans[2] = firstZ+(index-1)*RoadBlockLength;
@@ -1161,13 +1301,12 @@ float DrawStreetlight(GLfloat firstZ, int index, SOR roadside)
 			trans[2] += 0.5*RoadBlockLength;
 		if (firstZ+index*RoadBlockLength > viewPosition[2]+NbrOfRoadIterations*RoadBlockLength)
 			trans[2] -= NbrOfRoadIterations*RoadBlockLength;
-		glTranslatef(trans[0],trans[1],trans[2]);
-		glRotatef((roadside == RHS) ? (115.0) : (-115.0), 0.0, 0.0, 1.0);
-		glRotatef( 90.0, 1.0, 0.0, 0.0 );
-		glutSolidCone(0.025, 0.5, 6, 1);
-	glPopMatrix();
-	glPushMatrix();
-		glColor3f( LamppostColor[0], LamppostColor[1], LamppostColor[2] );
+		renderQueue.translate(trans[0],trans[1],trans[2]);
+		renderQueue.rotate((roadside == RHS) ? (115.0) : (-115.0), 0.0, 0.0, 1.0);
+		renderQueue.rotate( 90.0, 1.0, 0.0, 0.0 );
+		renderQueue.cone(0.025, 0.5, 6, 1);
+	renderQueue.pop();
+	renderQueue.push();
 		trans[0] = (roadside == RHS) ? (-(LamppostDisplacement-0.44)) : (LamppostDisplacement-0.44);
 		trans[1] = Ymin + 5.6;
 		trans[2] = firstZ+(index-1)*RoadBlockLength;
@@ -1175,13 +1314,12 @@ float DrawStreetlight(GLfloat firstZ, int index, SOR roadside)
 			trans[2] += 0.5*RoadBlockLength;
 		if (firstZ+index*RoadBlockLength > viewPosition[2]+NbrOfRoadIterations*RoadBlockLength)
 			trans[2] -= NbrOfRoadIterations*RoadBlockLength;
-		glTranslatef(trans[0],trans[1],trans[2]);
-		glRotatef((roadside == RHS) ? (90.0) : (-90.0), 0.0, 0.0, 1.0);
-		glRotatef( 90.0, 1.0, 0.0, 0.0 );
-		glutSolidCone(0.015, 0.35, 6, 1);
-	glPopMatrix();
-	glPushMatrix();
-		glColor3f( LamppostColor[0], LamppostColor[1], LamppostColor[2] );
+		renderQueue.translate(trans[0],trans[1],trans[2]);
+		renderQueue.rotate((roadside == RHS) ? (90.0) : (-90.0), 0.0, 0.0, 1.0);
+		renderQueue.rotate( 90.0, 1.0, 0.0, 0.0 );
+		renderQueue.cone(0.015, 0.35, 6, 1);
+	renderQueue.pop();
+	renderQueue.push();
 		trans[0] = (roadside == RHS) ? (-(LamppostDisplacement-0.74)) : (LamppostDisplacement-0.74);
 		trans[1] = Ymin + 5.6;
 		trans[2] = firstZ+(index-1)*RoadBlockLength;
@@ -1189,16 +1327,16 @@ float DrawStreetlight(GLfloat firstZ, int index, SOR roadside)
 			trans[2] += 0.5*RoadBlockLength;
 		if (firstZ+index*RoadBlockLength > viewPosition[2]+NbrOfRoadIterations*RoadBlockLength)
 			trans[2] -= NbrOfRoadIterations*RoadBlockLength;
-		glTranslatef(trans[0],trans[1],trans[2]);
-		glRotatef((roadside == RHS) ? (60.0) : (-60.0), 0.0, 0.0, 1.0);
-		glRotatef( 90.0, 1.0, 0.0, 0.0 );
-		glutSolidCone( 0.015, 0.35, 6, 1);
-	glPopMatrix();
+		renderQueue.translate(trans[0],trans[1],trans[2]);
+		renderQueue.rotate((roadside == RHS) ? (60.0) : (-60.0), 0.0, 0.0, 1.0);
+		renderQueue.rotate( 90.0, 1.0, 0.0, 0.0 );
+		renderQueue.cone( 0.015, 0.35, 6, 1);
+	renderQueue.pop();
 
 	/* Generate random bus stop signs on the right side of the road */
 	if (roadside == RHS)
 	{
-		bool busStopFlag = (int(GenerateRandomNumber(0.0,7.0))==0);
+		bool busStopFlag = (int(Random<>(citySeed, index, BusStopSign).next(KindAttribute, 0.0, 7.0))==0);
 		if (busStopFlag)
 		{
 			for (i = 0; i < 3; i++)
@@ -1206,49 +1344,33 @@ float DrawStreetlight(GLfloat firstZ, int index, SOR roadside)
 				matAmbient[i]  = matDiffuse[i]= matSpecular[i] = BusStopSignColor[i];
 				matEmission[i] = 0.0;
 			}
-			glMaterialfv(GL_FRONT, GL_AMBIENT,   matAmbient);
-			glMaterialfv(GL_FRONT, GL_DIFFUSE,   matDiffuse);
-			glMaterialfv(GL_FRONT, GL_SPECULAR,  matSpecular);
-			glMaterialfv(GL_FRONT, GL_EMISSION,  matEmission);
-			glMaterialfv(GL_FRONT, GL_SHININESS, matShininess);
-			glPushMatrix();		// Bus stop sign
-				glColor3f( BusStopSignColor[0], BusStopSignColor[1], BusStopSignColor[2] );
+			renderQueue.set_material( MaterialKey(matAmbient, matDiffuse, matSpecular, matEmission, matShininess[0]) );
+			renderQueue.push();		// Bus stop sign
 				trans[0] = -(LamppostDisplacement-0.14);
 				trans[1] = Ymin + 2.8;
 				trans[2] = firstZ-0.2+(0.5*RoadBlockLength)+(index-1)*RoadBlockLength;
 				if (firstZ+index*RoadBlockLength > viewPosition[2]+NbrOfRoadIterations*RoadBlockLength)
 					trans[2] -= NbrOfRoadIterations*RoadBlockLength;
-				glTranslatef(trans[0],trans[1],trans[2]);
-				glScalef( 0.25, 0.25, 0.05 );
-				glutSolidCube( 1.0 );
-			glPopMatrix();
+				renderQueue.translate(trans[0],trans[1],trans[2]);
+				renderQueue.scale( 0.25, 0.25, 0.05 );
+				renderQueue.cube( 1.0 );
+			renderQueue.pop();
 		}
 	}
 
-	glPushMatrix();		// Lamp
+	renderQueue.push();		// Lamp
 		if (timeOfDay == noon)
 		{
 			for (i = 0; i < 3; i++)
 				matAmbient[i] = matDiffuse[i] = matSpecular[i] = matEmission[i] = LampOffColor[i];
-			glMaterialfv(GL_FRONT, GL_AMBIENT,   matAmbient);
-			glMaterialfv(GL_FRONT, GL_DIFFUSE,   matDiffuse);
-			glMaterialfv(GL_FRONT, GL_SPECULAR,  matSpecular);
-			glMaterialfv(GL_FRONT, GL_EMISSION,  matEmission);
-			glMaterialfv(GL_FRONT, GL_SHININESS, matShininess);
-			glColor3f( LampOffColor[0], LampOffColor[1], LampOffColor[2] );
+			renderQueue.set_material( MaterialKey(matAmbient, matDiffuse, matSpecular, matEmission, matShininess[0]) );
 		}
 		else
 		{
 			for (i = 0; i < 3; i++)
 				matAmbient[i] = matDiffuse[i] = matSpecular[i] = matEmission[i] = LampOnColor[i];
-			glMaterialfv(GL_FRONT, GL_AMBIENT,   matAmbient);
-			glMaterialfv(GL_FRONT, GL_DIFFUSE,   matDiffuse);
-			glMaterialfv(GL_FRONT, GL_SPECULAR,  matSpecular);
-			glMaterialfv(GL_FRONT, GL_EMISSION,  matEmission);
-			glMaterialfv(GL_FRONT, GL_SHININESS, matShininess);
-			glColor3f( LampOnColor[0], LampOnColor[1], LampOnColor[2] );
+			renderQueue.set_material( MaterialKey(matAmbient, matDiffuse, matSpecular, matEmission, matShininess[0]) );
 		}
-		glColorMaterial(GL_FRONT_AND_BACK, GL_EMISSION);
 		trans[0] = (roadside == RHS) ? (-(LamppostDisplacement-0.94)) : (LamppostDisplacement-0.94);
 		trans[1] = Ymin + 5.4;
 		trans[2] = firstZ+(index-1)*RoadBlockLength;
@@ -1256,9 +1378,9 @@ float DrawStreetlight(GLfloat firstZ, int index, SOR roadside)
 			trans[2] += 0.5*RoadBlockLength;
 		if (firstZ+index*RoadBlockLength > viewPosition[2]+NbrOfRoadIterations*RoadBlockLength)
 			trans[2] -= NbrOfRoadIterations*RoadBlockLength;
-		glTranslatef(trans[0],trans[1],trans[2]);
-		glutSolidSphere( 0.2, 12, 12 );
-	glPopMatrix();
+		renderQueue.translate(trans[0],trans[1],trans[2]);
+		renderQueue.sphere( 0.2, 12, 12 );
+	renderQueue.pop();
 
   return trans[2];
 }
@@ -1279,43 +1401,33 @@ void draw_trash_can( Translation t )
 	GLfloat matEmission[4] = { 0.0, 0.0, 0.0, 0.0 };
 	GLfloat matShininess[] = { 0.3 };
 
-  glPushMatrix();
+  renderQueue.push();
     for (int i = 0; i < 3; i++)
     {
       matAmbient[i] = matDiffuse[i] = matSpecular[i] = TrashcanBarrelColor[i];
       matEmission[i] = 0.0;
     }
-    glMaterialfv(GL_FRONT, GL_AMBIENT,   matAmbient);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE,   matDiffuse);
-    glMaterialfv(GL_FRONT, GL_SPECULAR,  matSpecular);
-    glMaterialfv(GL_FRONT, GL_EMISSION,  matEmission);
-    glMaterialfv(GL_FRONT, GL_SHININESS, matShininess);
-    glColor3f( TrashcanBarrelColor[0], TrashcanBarrelColor[1], TrashcanBarrelColor[2] );
-
-    glTranslateft( t );
-    glTranslatef( 0.0f, Ymin+0.8, 0.0f );
-
-    glScalef(0.45, 1.5, 0.45);
-    glutSolidCube(1.0);
-  glPopMatrix();
-  glPushMatrix();
+    renderQueue.set_material( MaterialKey(matAmbient, matDiffuse, matSpecular, matEmission, matShininess[0]) );
+
+    renderQueue.translate( t.x, t.y, t.z );
+    renderQueue.translate( 0.0f, Ymin+0.8, 0.0f );
+
+    renderQueue.scale(0.45, 1.5, 0.45);
+    renderQueue.cube(1.0);
+  renderQueue.pop();
+  renderQueue.push();
     for (int i = 0; i < 3; i++)
     {
       matAmbient[i] = matDiffuse[i] = matSpecular[i] = TrashcanLidColor[i];
       matEmission[i] = 0.0;
     }
-    glMaterialfv(GL_FRONT, GL_AMBIENT,   matAmbient);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE,   matDiffuse);
-    glMaterialfv(GL_FRONT, GL_SPECULAR,  matSpecular);
-    glMaterialfv(GL_FRONT, GL_EMISSION,  matEmission);
-    glMaterialfv(GL_FRONT, GL_SHININESS, matShininess);
-    glColor3f( TrashcanLidColor[0], TrashcanLidColor[1], TrashcanLidColor[2] );
-
-    glTranslateft( t );
-    glTranslatef( 0.0f, Ymin+1.5, 0.0f );
-
-    glutSolidSphere( 0.225, 12, 12 );
-  glPopMatrix();
+    renderQueue.set_material( MaterialKey(matAmbient, matDiffuse, matSpecular, matEmission, matShininess[0]) );
+
+    renderQueue.translate( t.x, t.y, t.z );
+    renderQueue.translate( 0.0f, Ymin+1.5, 0.0f );
+
+    renderQueue.sphere( 0.225, 12, 12 );
+  renderQueue.pop();
 }
 
 void draw_news_stand( Translation t )
@@ -1326,44 +1438,34 @@ void draw_news_stand( Translation t )
 	GLfloat matEmission[4] = { 0.0, 0.0, 0.0, 0.0 };
 	GLfloat matShininess[] = { 0.3 };
 
-  glPushMatrix();
+  renderQueue.push();
     for (int i = 0; i < 3; i++)
     {
       matAmbient[i] = matDiffuse[i] = matSpecular[i] = NewsstandCaseColor[i];
       matEmission[i] = 0.0;
     }
-    glMaterialfv(GL_FRONT, GL_AMBIENT,   matAmbient);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE,   matDiffuse);
-    glMaterialfv(GL_FRONT, GL_SPECULAR,  matSpecular);
-    glMaterialfv(GL_FRONT, GL_EMISSION,  matEmission);
-    glMaterialfv(GL_FRONT, GL_SHININESS, matShininess);
-    glColor3f( NewsstandCaseColor[0], NewsstandCaseColor[1], NewsstandCaseColor[2] );
-
-    glTranslateft( t );
-    glTranslatef( 0.0f, Ymin+1.0, 0.0f );
-
-    glScalef( 0.3, 0.8, 0.7 );
-    glutSolidCube(1.0);
-  glPopMatrix();
-  glPushMatrix();
+    renderQueue.set_material( MaterialKey(matAmbient, matDiffuse, matSpecular, matEmission, matShininess[0]) );
+
+    renderQueue.translate( t.x, t.y, t.z );
+    renderQueue.translate( 0.0f, Ymin+1.0, 0.0f );
+
+    renderQueue.scale( 0.3, 0.8, 0.7 );
+    renderQueue.cube(1.0);
+  renderQueue.pop();
+  renderQueue.push();
     for (int i = 0; i < 3; i++)
     {
       matAmbient[i] = matDiffuse[i] = matSpecular[i] = NewsstandDoorColor[i];
       matEmission[i] = 0.0;
     }
-    glMaterialfv(GL_FRONT, GL_AMBIENT,   matAmbient);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE,   matDiffuse);
-    glMaterialfv(GL_FRONT, GL_SPECULAR,  matSpecular);
-    glMaterialfv(GL_FRONT, GL_EMISSION,  matEmission);
-    glMaterialfv(GL_FRONT, GL_SHININESS, matShininess);
-    glColor3f( NewsstandDoorColor[0], NewsstandDoorColor[1], NewsstandDoorColor[2] );
-
-    glTranslateft( t );
-    glTranslatef( ( t.x > 0 ) ? -0.01f : 0.01f, Ymin+1.0, 0.0f );
-
-    glScalef( 0.3, 0.37, 0.67 );
-    glutSolidCube(1.0);
-  glPopMatrix();
+    renderQueue.set_material( MaterialKey(matAmbient, matDiffuse, matSpecular, matEmission, matShininess[0]) );
+
+    renderQueue.translate( t.x, t.y, t.z );
+    renderQueue.translate( ( t.x > 0 ) ? -0.01f : 0.01f, Ymin+1.0, 0.0f );
+
+    renderQueue.scale( 0.3, 0.37, 0.67 );
+    renderQueue.cube(1.0);
+  renderQueue.pop();
 }
 
 void draw_mailbox( Translation t )
@@ -1374,51 +1476,41 @@ void draw_mailbox( Translation t )
 	GLfloat matEmission[4] = { 0.0, 0.0, 0.0, 0.0 };
 	GLfloat matShininess[] = { 0.3 };
 
-  glPushMatrix();
+  renderQueue.push();
     for (int i = 0; i < 3; i++)
     {
       matAmbient[i] = matDiffuse[i] = matSpecular[i] = MailboxBarrelColor[i];
       matEmission[i] = 0.0;
     }
-    glMaterialfv(GL_FRONT, GL_AMBIENT,   matAmbient);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE,   matDiffuse);
-    glMaterialfv(GL_FRONT, GL_SPECULAR,  matSpecular);
-    glMaterialfv(GL_FRONT, GL_EMISSION,  matEmission);
-    glMaterialfv(GL_FRONT, GL_SHININESS, matShininess);
-    glColor3f( MailboxBarrelColor[0], MailboxBarrelColor[1], MailboxBarrelColor[2] );
-
-    glTranslateft( t );
-    glTranslatef( 0.0f, Ymin+1.0, 0.0f );
-
-    glScalef( 0.5, 1.0, 0.5 );
-    glutSolidCube(1.0);
-  glPopMatrix();
-    glPushMatrix();
+    renderQueue.set_material( MaterialKey(matAmbient, matDiffuse, matSpecular, matEmission, matShininess[0]) );
+
+    renderQueue.translate( t.x, t.y, t.z );
+    renderQueue.translate( 0.0f, Ymin+1.0, 0.0f );
+
+    renderQueue.scale( 0.5, 1.0, 0.5 );
+    renderQueue.cube(1.0);
+  renderQueue.pop();
+    renderQueue.push();
     for (int i = 0; i < 3; i++)
     {
       matAmbient[i] = matDiffuse[i] = matSpecular[i] = MailboxLidColor[i];
       matEmission[i] = 0.0;
     }
-    glMaterialfv(GL_FRONT, GL_AMBIENT,   matAmbient);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE,   matDiffuse);
-    glMaterialfv(GL_FRONT, GL_SPECULAR,  matSpecular);
-    glMaterialfv(GL_FRONT, GL_EMISSION,  matEmission);
-    glMaterialfv(GL_FRONT, GL_SHININESS, matShininess);
-    glColor3f( MailboxLidColor[0], MailboxLidColor[1], MailboxLidColor[2] );
-
-    glTranslateft( t );
-    glTranslatef( 0.0f, Ymin+1.6, 0.0f );
-
-    glScalef(0.475, 0.475, 0.475);
-    glutSolidCube(1.0);
-  glPopMatrix();
+    renderQueue.set_material( MaterialKey(matAmbient, matDiffuse, matSpecular, matEmission, matShininess[0]) );
+
+    renderQueue.translate( t.x, t.y, t.z );
+    renderQueue.translate( 0.0f, Ymin+1.6, 0.0f );
+
+    renderQueue.scale(0.475, 0.475, 0.475);
+    renderQueue.cube(1.0);
+  renderQueue.pop();
 }
 
 
 
 float DrawCityProp(GLfloat firstZ, int index)
 {
-  int frill = int(GenerateRandomNumber(0.0,10.0));
+  int frill = int(Random<>(citySeed, index, CityProp).next(KindAttribute, 0.0, 10.0));
   float rval = 0.0f;
   bool wtf = firstZ+index*RoadBlockLength <= viewPosition[2]+NbrOfRoadIterations*RoadBlockLength;
 
@@ -1494,104 +1586,165 @@ void DrawSkyscraper(GLfloat firstZ, int index, SOR roadside)
 	GLfloat matEmission[4] = { 0.0, 0.0, 0.0, 0.0 };
 	GLfloat matShininess[] = { 1.0 };
 
-	glPushMatrix();
+	Random<> building(citySeed, index, (roadside == RHS) ? RightSkyscraper : LeftSkyscraper);
+
+	renderQueue.push();
 		for (int t = 0; t < 3; t++)
 			if (timeOfDay != noon)
-				buildingColor[t] = GenerateRandomNumber(0.1, 0.25);
+				buildingColor[t] = building.next(RedAttribute+t, 0.1, 0.25);
 			else
-				buildingColor[t] = 0.4 + GenerateRandomNumber(0.1, 0.25);
+				buildingColor[t] = 0.4 + building.next(RedAttribute+t, 0.1, 0.25);
 		for (i = 0; i < 3; i++)
 		{
 			matAmbient[i] = matDiffuse[i] = matSpecular[i] = buildingColor[i];
 			matEmission[i] = 0.0;
 		}
-		glMaterialfv(GL_FRONT, GL_AMBIENT,   matAmbient);
-		glMaterialfv(GL_FRONT, GL_DIFFUSE,   matDiffuse);
-		glMaterialfv(GL_FRONT, GL_SPECULAR,  matSpecular);
-		glMaterialfv(GL_FRONT, GL_EMISSION,  matEmission);
-		glMaterialfv(GL_FRONT, GL_SHININESS, matShininess);
-		glColor3f( buildingColor[0], buildingColor[1], buildingColor[2] );
+		renderQueue.set_material( MaterialKey(matAmbient, matDiffuse, matSpecular, matEmission, matShininess[0]) );
 
 		// Scale the building to be between one-half and twice the //
 		// "normal" height, and 60-90% of the width of a street    //
 		// block (ensuring variable-sized gaps between buildings). //
-		heightScale = GenerateRandomNumber(0.5,2.0);
-		depthScale = GenerateRandomNumber(0.6,0.9);
+		heightScale = building.next(HeightAttribute, 0.5, 2.0);
+		depthScale = building.next(DepthAttribute, 0.6, 0.9);
 
 		if (firstZ+index*RoadBlockLength <= viewPosition[2]+NbrOfRoadIterations*RoadBlockLength)
-			glTranslatef( (roadside == RHS) ? (-SkyscraperDisplacement) : (SkyscraperDisplacement),
+			renderQueue.translate( (roadside == RHS) ? (-SkyscraperDisplacement) : (SkyscraperDisplacement),
 						Ymin+0.5*StoryHeight*heightScale, firstZ-(0.75*RoadBlockLength)+index*RoadBlockLength );
 		else
-			glTranslatef( (roadside == RHS) ? (-SkyscraperDisplacement) : (SkyscraperDisplacement),
+			renderQueue.translate( (roadside == RHS) ? (-SkyscraperDisplacement) : (SkyscraperDisplacement),
 						Ymin+0.5*StoryHeight*heightScale, 
 									firstZ-(NbrOfRoadIterations*RoadBlockLength+0.75*RoadBlockLength)+
 									index*RoadBlockLength );
-		glScalef( 1.0, heightScale, depthScale);
-		glutSolidCube(RoadBlockLength);
-	glPopMatrix();
+		renderQueue.scale( 1.0, heightScale, depthScale);
+		renderQueue.cube(RoadBlockLength);
+	renderQueue.pop();
 
 	// 25 windows per building face, evenly spaced across the face //
+	if (windowRenderMode == InstancedWindows)
+	{
+		DrawSkyscraperWindows(firstZ, index, roadside, heightScale, depthScale);
+		return;
+	}
 	for (int row = -4; row <= 4; row += 2)
 		for (int col = -4; col <= 4; col += 2)
 		{
-				if (timeOfDay == dusk)
-				{
-					windowColor[0] = GenerateRandomNumber(0.86,0.94);
-					windowColor[1] = GenerateRandomNumber(windowColor[0]-0.02,windowColor[0]+0.02);
-					windowColor[2] = GenerateRandomNumber(windowColor[0]-0.02,windowColor[0]+0.02);
-				}
-				else
-				{
-					windowColor[2] = GenerateRandomNumber(0.4,0.5);
-					windowColor[1] = GenerateRandomNumber(windowColor[2]-0.05,windowColor[2]+0.05);
-					windowColor[0] = GenerateRandomNumber(windowColor[2]-0.05,windowColor[2]+0.05);
-				}
+				GenerateWindowColor(index, roadside, row, col, windowColor);
 				for (i = 0; i < 3; i++)
 				{
 					matAmbient[i] = matDiffuse[i] = matSpecular[i] = windowColor[i];
 					matEmission[i] = 0.0;
 				}
-				glMaterialfv(GL_FRONT, GL_AMBIENT,   matAmbient);
-				glMaterialfv(GL_FRONT, GL_DIFFUSE,   matDiffuse);
-				glMaterialfv(GL_FRONT, GL_SPECULAR,  matSpecular);
-				glMaterialfv(GL_FRONT, GL_EMISSION,  matEmission);
-				glMaterialfv(GL_FRONT, GL_SHININESS, matShininess);
-				glColor3f(windowColor[0],windowColor[1],windowColor[2]);
+				renderQueue.set_material( MaterialKey(matAmbient, matDiffuse, matSpecular, matEmission, matShininess[0]) );
 
 			// Window facing road //
-			glPushMatrix();
+			renderQueue.push();
 				if (firstZ+index*RoadBlockLength <= viewPosition[2]+NbrOfRoadIterations*RoadBlockLength)
-					glTranslatef((roadside == RHS) ? (-WindowDisplacement) : (WindowDisplacement),
+					renderQueue.translate((roadside == RHS) ? (-WindowDisplacement) : (WindowDisplacement),
 								Ymin+0.5*StoryHeight*heightScale+row*StoryHeight*heightScale/11, 
 								firstZ-(0.75*RoadBlockLength)+index*RoadBlockLength+
 								col*RoadBlockLength*depthScale/11);
 				else
-					glTranslatef((roadside == RHS) ? (-WindowDisplacement) : (WindowDisplacement),
+					renderQueue.translate((roadside == RHS) ? (-WindowDisplacement) : (WindowDisplacement),
 								Ymin+0.5*StoryHeight*heightScale+row*StoryHeight*heightScale/11, 
 								firstZ-(NbrOfRoadIterations*RoadBlockLength+0.75*RoadBlockLength)+
 								index*RoadBlockLength+col*RoadBlockLength*depthScale/11);
-				glScalef(0.05,1.5,1.5);
-				glutSolidCube(1.0);
-			glPopMatrix();
+				renderQueue.scale(0.05,1.5,1.5);
+				renderQueue.cube(1.0);
+			renderQueue.pop();
 
 			// Window facing viewer //
-			glPushMatrix();
+			renderQueue.push();
 				if (firstZ+index*RoadBlockLength <= viewPosition[2]+NbrOfRoadIterations*RoadBlockLength)
-					glTranslatef((roadside == RHS) ? (-(SkyscraperDisplacement+
+					renderQueue.translate((roadside == RHS) ? (-(SkyscraperDisplacement+
 								col*RoadBlockLength*depthScale/11)) : (SkyscraperDisplacement+
 								col*RoadBlockLength*depthScale/11),
 								Ymin+0.5*StoryHeight*heightScale+row*StoryHeight*heightScale/11, 
 								firstZ-(0.75*RoadBlockLength)+index*RoadBlockLength);
 				else
-					glTranslatef((roadside == RHS) ? (-(SkyscraperDisplacement+col*RoadBlockLength*depthScale/11)) : 
+					renderQueue.translate((roadside == RHS) ? (-(SkyscraperDisplacement+col*RoadBlockLength*depthScale/11)) : 
 											(SkyscraperDisplacement+col*RoadBlockLength*depthScale/11),
 								Ymin+0.5*StoryHeight*heightScale+row*StoryHeight*heightScale/11, 
 								firstZ-(NbrOfRoadIterations*RoadBlockLength+0.75*RoadBlockLength)+
 								index*RoadBlockLength);
-				glScalef(1.5,1.5,1.05*RoadBlockLength*depthScale);
-				glutSolidCube(1.0);
-			glPopMatrix();
+				renderQueue.scale(1.5,1.5,1.05*RoadBlockLength*depthScale);
+				renderQueue.cube(1.0);
+			renderQueue.pop();
+		}
+}
+
+/**************************************************************/
+/* Draw all of a building's windows with a single call: each  */
+/* window's transform and color is added to one per-instance  */
+/* array, with the same random colors as the per-window loop  */
+/* in DrawSkyscraper.                                         */
+/**************************************************************/
+void DrawSkyscraperWindows(GLfloat firstZ, int index, SOR roadside,
+						   GLfloat heightScale, GLfloat depthScale)
+{
+	static CubeInstances windows;
+	GLfloat windowColor[3];
+	GLfloat trans[3];
+	GLfloat roadFacingScale[] = { 0.05, 1.5, 1.5 };
+	GLfloat viewerFacingScale[] = { 1.5, 1.5, GLfloat(1.05*RoadBlockLength*depthScale) };
+	GLfloat matAmbient[4]  = { 0.0, 0.0, 0.0, 1.0 };
+	GLfloat matDiffuse[4]  = { 0.0, 0.0, 0.0, 1.0 };
+	GLfloat matSpecular[4] = { 0.0, 0.0, 0.0, 1.0 };
+	GLfloat matEmission[4] = { 0.0, 0.0, 0.0, 0.0 };
+	GLfloat side = (roadside == RHS) ? -1.0 : 1.0;
+
+	GLfloat tranZ = firstZ-(0.75*RoadBlockLength)+index*RoadBlockLength;
+	if (firstZ+index*RoadBlockLength > viewPosition[2]+NbrOfRoadIterations*RoadBlockLength)
+		tranZ -= NbrOfRoadIterations*RoadBlockLength;
+
+	windows.clear();
+	for (int row = -4; row <= 4; row += 2)
+		for (int col = -4; col <= 4; col += 2)
+		{
+			GenerateWindowColor(index, roadside, row, col, windowColor);
+			if (windows.size() == 0)
+				for (int i = 0; i < 3; i++)
+					matAmbient[i] = matDiffuse[i] = matSpecular[i] = windowColor[i];
+
+			// Window facing road //
+			trans[0] = side*WindowDisplacement;
+			trans[1] = Ymin+0.5*StoryHeight*heightScale+row*StoryHeight*heightScale/11;
+			trans[2] = tranZ+col*RoadBlockLength*depthScale/11;
+			windows.add(trans, roadFacingScale, windowColor);
+
+			// Window facing viewer //
+			trans[0] = side*(SkyscraperDisplacement+col*RoadBlockLength*depthScale/11);
+			trans[2] = tranZ;
+			windows.add(trans, viewerFacingScale, windowColor);
 		}
+
+	/* Specular highlights are shared by the whole building, */
+	/* using the color of its first window.                  */
+	renderQueue.set_material( MaterialKey(matAmbient, matDiffuse, matSpecular, matEmission, 1.0) );
+	renderQueue.cube_instances(windows);
+}
+
+/****************************************************************/
+/* Generate the color of the window in the given row and column */
+/* of a building (both from -4 to 4 in steps of 2): yellowish   */
+/* lights at dusk, and a bluish glass the rest of the day.      */
+/****************************************************************/
+void GenerateWindowColor(int index, SOR roadside, int row, int col, GLfloat windowColor[])
+{
+	int window = 5*((row+4)/2) + (col+4)/2;
+	Random<> glass(citySeed, index, FirstWindow + 25*roadside + window);
+
+	if (timeOfDay == dusk)
+	{
+		windowColor[0] = glass.next(RedAttribute, 0.86, 0.94);
+		windowColor[1] = glass.next(GreenAttribute, windowColor[0]-0.02, windowColor[0]+0.02);
+		windowColor[2] = glass.next(BlueAttribute, windowColor[0]-0.02, windowColor[0]+0.02);
+	}
+	else
+	{
+		windowColor[2] = glass.next(BlueAttribute, 0.4, 0.5);
+		windowColor[1] = glass.next(GreenAttribute, windowColor[2]-0.05, windowColor[2]+0.05);
+		windowColor[0] = glass.next(RedAttribute, windowColor[2]-0.05, windowColor[2]+0.05);
+	}
 }
 
 /**************************************************************/
@@ -1608,7 +1761,7 @@ void DrawCityFarPlaneCube()
 	GLfloat matEmission[4] = { 0.0, 0.0, 0.0, 0.0 };
 	GLfloat matShininess[] = { 0.3 };
 
-	glPushMatrix();
+	renderQueue.push();
 		switch (timeOfDay)
 		{
 		case dawn: { farColor[0] = 0.0; farColor[1] = farColor[2] = 0.6; break; }
@@ -1620,17 +1773,12 @@ void DrawCityFarPlaneCube()
 			matAmbient[i] = matDiffuse[i] = matSpecular[i] = farColor[i];
 			matEmission[i] = 0.0;
 		}
-		glMaterialfv(GL_FRONT, GL_AMBIENT,   matAmbient);
-		glMaterialfv(GL_FRONT, GL_DIFFUSE,   matDiffuse);
-		glMaterialfv(GL_FRONT, GL_SPECULAR,  matSpecular);
-		glMaterialfv(GL_FRONT, GL_EMISSION,  matEmission);
-		glMaterialfv(GL_FRONT, GL_SHININESS, matShininess);
-		glColor3f(farColor[0], farColor[1], farColor[2]);
-
-		glTranslatef( 0.0, Ymin+200.0, viewPosition[2]+NbrOfRoadIterations*RoadBlockLength );
-		glScalef( 20.0, 20.1, 0.01 );
-		glutSolidCube(RoadBlockLength);
-	glPopMatrix();
+		renderQueue.set_material( MaterialKey(matAmbient, matDiffuse, matSpecular, matEmission, matShininess[0]) );
+
+		renderQueue.translate( 0.0, Ymin+200.0, viewPosition[2]+NbrOfRoadIterations*RoadBlockLength );
+		renderQueue.scale( 20.0, 20.1, 0.01 );
+		renderQueue.cube(RoadBlockLength);
+	renderQueue.pop();
 }
 
 /****************************************************************/
@@ -1640,83 +1788,183 @@ void DrawCityFarPlaneCube()
 /****************************************************************/
 void RenderPrecipitation()
 {
+	PROFILE_SCOPE("RenderPrecipitation");
+
+	precipitationStream.reset_counters();
+
+	/* Precipitation fills the view from the current camera, */
+	/* however it is pitched by the incline.                 */
+	Matrix camera;
+	render_device().get_matrix(GL_MODELVIEW, camera);
+
 	if (weatherCondition == snowy)
 	{
-		GLfloat x,y,z;
-		glColor3f(1.0f, 1.0f, 1.0f);
-		glBegin(GL_POINTS);
-
-			/* By repeatedly using the same seed, and then adding a */
-			/* continuously updated increment to each snowflake's   */
-			/* position, actual "snowfall" is simulated.            */
-			srand(99);
-			for (int t = 0; t < 10000; t++)
-			{
-				x = GenerateRandomNumber(Xmin, Xmax) + precipIncrement[0];
-				while (x > Xmax)
-					x -= (Xmax-Xmin);
-				while (x < Xmin)
-					x += (Xmax-Xmin);
-				y = GenerateRandomNumber(Ymin, Ymax) + precipIncrement[1];
-				while (y > Ymax)
-					y -= (Ymax-Ymin);
-				while (y < Ymin)
-					y += (Ymax-Ymin);
-				z = viewPosition[2]+GenerateRandomNumber(-10.0,10.0) + precipIncrement[2];
-				while (z < viewPosition[2]-10.0)
-					z += 20.0;
-				while (z > viewPosition[2]+10.0)
-					z -= 20.0;
-				glVertex3f(x,y,z);
-			}
-		glEnd();
-		glFlush();
+		/* By shifting every snowflake from its place by the same */
+		/* continuously updated increment, wrapping around within */
+		/* the view in front of the viewer, actual "snowfall" is  */
+		/* simulated.                                             */
+		PrecipitationVolume volume(camera, 60.0, AspectRatio, SnowNear, SnowFar);
+
+		if (snowfall.size() == 0)
+			snowfall.generate(SnowSeed, NbrOfSnowflakes);
+		UpdatePrecipitation(workerPool, snowfall, NbrOfSnowflakes, volume, NULL,
+							precipitationStream.map(3*NbrOfSnowflakes*sizeof(float)));
+
+		render_device().color(1.0f, 1.0f, 1.0f);
+		precipitationStream.draw(GL_POINTS, NbrOfSnowflakes);
+		render_device().flush();
 	}
 	else if (weatherCondition == rainy)
 	{
-		GLfloat x,y,z;
 		int nbrOfDrops;
 
 		/* Customize the number of raindrops and their  */
 		/* color, according to the current time-of-day. */
 		switch (timeOfDay)
 		{
-		case dawn: { nbrOfDrops = 10000; glColor3f(0.7f, 0.7f, 0.8f); break; }
-		case noon: { nbrOfDrops = 10000; glColor3f(0.8f, 0.8f, 0.9f); break; }
-		case dusk: { nbrOfDrops = 20000; glColor3f(0.6f, 0.6f, 0.6f); break; }
+		case dawn: { nbrOfDrops = MaxNbrOfRaindrops/2; render_device().color(0.7f, 0.7f, 0.8f); break; }
+		case noon: { nbrOfDrops = MaxNbrOfRaindrops/2; render_device().color(0.8f, 0.8f, 0.9f); break; }
+		case dusk: { nbrOfDrops = MaxNbrOfRaindrops; render_device().color(0.6f, 0.6f, 0.6f); break; }
 		}
-		glBegin(GL_LINES);
 
-			/* By repeatedly using the same seed, and then adding  */
-			/* a continuously updated increment to each raindrop's */
-			/* position, actual "rainfall" is simulated.           */
-			srand(13);
-			for (int t = 0; t < nbrOfDrops; t++)
-			{
-				x = GenerateRandomNumber(Xmin, Xmax) + precipIncrement[0];
-				while (x > Xmax)
-					x -= (Xmax-Xmin);
-				while (x < Xmin)
-					x += (Xmax-Xmin);
-				y = GenerateRandomNumber(Ymin, Ymax) + precipIncrement[1];
-				while (y > Ymax)
-					y -= (Ymax-Ymin);
-				while (y < Ymin)
-					y += (Ymax-Ymin);
-				z = viewPosition[2]+GenerateRandomNumber(0.0,5.0) + precipIncrement[2];
-				while (z < viewPosition[2])
-					z += 5.0;
-				while (z > viewPosition[2]+5.0)
-					z -= 5.0;
-				glVertex3f(x,y,z);
-				glVertex3f(x+0.005,y-0.02,z);
-			}
-		glEnd();
-		glFlush();
+		/* As with snow, but each raindrop is drawn as a short */
+		/* streak, in a shallower part of the view.            */
+		PrecipitationVolume volume(camera, 60.0, AspectRatio, RainNear, RainFar);
+		GLfloat streak[] = { 0.005, -0.02, 0.0 };
+
+		if (rainfall.size() == 0)
+			rainfall.generate(RainSeed, MaxNbrOfRaindrops);
+		UpdatePrecipitation(workerPool, rainfall, nbrOfDrops, volume, streak,
+							precipitationStream.map(6*nbrOfDrops*sizeof(float)));
+
+		precipitationStream.draw(GL_LINES, 2*nbrOfDrops);
+		render_device().flush();
+	}
+
+	frameStatistics.bytesUploaded = precipitationStream.get_bytes_uploaded();
+}
+
+
+/****************************************************************/
+/* Move the splashes and snow puffs on one step, then start new */
+/* ones: splashes at random spots on the road ahead while it is */
+/* raining, and puffs at every pedestrian's feet while it is    */
+/* snowing.  Particles already started run out their lifetimes  */
+/* whatever the weather.                                        */
+/****************************************************************/
+void StepParticles()
+{
+	static unsigned int stepNumber = 0;
+	stepNumber++;
+
+	rainSplashes.update(SimulationStep);
+	snowPuffs.update(SimulationStep);
+
+	if (weatherCondition == rainy)
+	{
+		for (int i = 0; i < NbrOfSplashesPerStep; i++)
+		{
+			Random<> r(RainSeed, stepNumber, i);
+			ParticleEmitter& splash = splashEmitters[i];
+
+			splash.position[0] = r.next(0, -RoadBlockScale[0]*RoadBlockLength/2, RoadBlockScale[0]*RoadBlockLength/2);
+			splash.position[1] = RoadSurfaceY;
+			splash.position[2] = viewPosition[2] + r.next(1, SplashNear, SplashFar);
+			splash.spread[0] = splash.spread[2] = 0.02;
+			splash.velocity[1] = 0.8;
+			splash.velocity_spread[0] = splash.velocity_spread[2] = 0.4;
+			splash.velocity_spread[1] = 0.3;
+			splash.lifetime = Range<>(0.15, 0.3);
+		}
+		rainSplashes.emit(&splashEmitters[0], NbrOfSplashesPerStep, NbrOfDropletsPerSplash);
+	}
+	else if (weatherCondition == snowy)
+	{
+		int nbrOfPeople = pedestrians.size();
+		puffEmitters.resize(nbrOfPeople);
+
+		for (int i = 0; i < nbrOfPeople; i++)
+		{
+			ParticleEmitter& puff = puffEmitters[i];
+
+			puff.position[0] = pedestrians.get_side(i)*2.0;
+			puff.position[1] = PedestrianFeetY;
+			puff.position[2] = pedestrians.get_position(i);
+			puff.spread[0] = puff.spread[2] = 0.15;
+			puff.spread[1] = 0.02;
+			puff.velocity[1] = 0.4;
+			puff.velocity_spread[0] = puff.velocity_spread[2] = 0.3;
+			puff.velocity_spread[1] = 0.2;
+			puff.lifetime = Range<>(0.3, 0.6);
+		}
+		if (nbrOfPeople > 0)
+			snowPuffs.emit(&puffEmitters[0], nbrOfPeople, NbrOfPuffParticlesPerStep);
 	}
 }
 
 
+/****************************************************************/
+/* Draw the splashes and snow puffs as points, alpha of the way */
+/* from the previous simulation step to the current one.  Each  */
+/* particle is taken back along its velocity from where it is,  */
+/* which is near enough over a single step.                     */
+/****************************************************************/
+void RenderParticles(float alpha)
+{
+	PROFILE_SCOPE("RenderParticles");
+
+	float dt = (alpha - 1.0)*SimulationStep;
+
+	splashStream.reset_counters();
+	puffStream.reset_counters();
+
+	render_device().color(0.8f, 0.8f, 0.9f);
+	DrawParticles(rainSplashes, splashStream, dt);
+	render_device().color(1.0f, 1.0f, 1.0f);
+	DrawParticles(snowPuffs, puffStream, dt);
+
+	frameStatistics.particles = rainSplashes.size() + snowPuffs.size();
+	frameStatistics.bytesUploaded = precipitationStream.get_bytes_uploaded() +
+									splashStream.get_bytes_uploaded() + puffStream.get_bytes_uploaded();
+}
+
+void DrawParticles(ParticleSystem& system, StreamBuffer& stream, float dt)
+{
+	if (system.size() == 0)
+		return;
+
+	float* vertices = stream.map(3*system.size()*sizeof(float));
+	stream.draw(GL_POINTS, system.get_points(vertices, dt));
+}
+
+
+/****************************************************************/
+/* Place the first count particles of a field in the volume,    */
+/* shifted by the current precipitation increment, and write    */
+/* them out as vertices, as points or (given a streak) as       */
+/* lines.  Each chunk of particles is a separate task in the    */
+/* pool, writing its own range of the vertex array.             */
+/****************************************************************/
+void UpdatePrecipitation(ThreadPool& pool, PrecipitationField& field, int count,
+						 const PrecipitationVolume& volume, const GLfloat streak[],
+						 float vertices[])
+{
+	int nbrOfChunks = (count + PrecipitationChunk - 1) / PrecipitationChunk;
+
+	pool.run(nbrOfChunks, [&](int chunk)
+	{
+		int first = chunk*PrecipitationChunk;
+		int n = min(PrecipitationChunk, count - first);
+
+		field.update(first, n, volume, precipIncrement);
+		if (streak != NULL)
+			field.get_lines(first, n, streak, vertices);
+		else
+			field.get_points(first, n, vertices);
+	});
+}
+
+
 /*******************************************************************/
 /* Draw the 2-D display panel in the bottom portion of the display */
 /* window, showing relevant data about the course being traversed  */
@@ -1725,10 +1973,12 @@ void RenderPrecipitation()
 /*******************************************************************/
 void DrawDisplayPanel()
 {
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	glOrtho(0.0f, (float)currWindowSize[0], 0.0f, (float)currWindowSize[1], -1.0, 1.0);
-	glMatrixMode(GL_MODELVIEW);
+	PROFILE_SCOPE("DrawDisplayPanel");
+
+	render_device().matrix_mode(GL_PROJECTION);
+	render_device().load_identity();
+	render_device().ortho(0.0f, (float)currWindowSize[0], 0.0f, (float)currWindowSize[1], -1.0, 1.0);
+	render_device().matrix_mode(GL_MODELVIEW);
 
 	/* Customize the font size within the display panel, */
 	/* according to the current window size, thus using  */
@@ -1736,34 +1986,55 @@ void DrawDisplayPanel()
 	/* spaced and a small font whenever space is scarce. */
 
 	/* Draw vertical line to separate the course, and scene output. */
-	glColor3f(0.0f, 0.1f, 0.5f);
-	glBegin(GL_LINES);
-		glVertex2i(0.5*currWindowSize[0],currWindowSize[1]/6);
-		glVertex2i(0.5*currWindowSize[0],0);
-	glEnd();
-
-	/* Update the distance travelled, assuming one refresh */
-	/* every 1/15th of a second at the current speed.      */
-	distanceTravelled += (currentSpeed/54000.0);
+	render_device().color(0.0f, 0.1f, 0.5f);
+	render_device().begin(GL_LINES);
+		render_device().vertex(0.5*currWindowSize[0],currWindowSize[1]/6, 0.0);
+		render_device().vertex(0.5*currWindowSize[0],0, 0.0);
+	render_device().end();
 
 	/* Output current course readouts, starting with the speed. */
-	glColor3f(0.7f, 0.0f, 0.0f);
-	glRasterPos2i(currWindowSize[0]/4, currWindowSize[1]/8);
+	render_device().color(0.7f, 0.0f, 0.0f);
+	render_device().raster_pos(currWindowSize[0]/4, currWindowSize[1]/8);
 
 	/* Output the distance travelled. */
-	glRasterPos2i(currWindowSize[0]/4, currWindowSize[1]/12);
+	render_device().raster_pos(currWindowSize[0]/4, currWindowSize[1]/12);
 
 	/* Output the current incline. */
-	glRasterPos2i(currWindowSize[0]/4, currWindowSize[1]/24);
+	render_device().raster_pos(currWindowSize[0]/4, currWindowSize[1]/24);
 
 	/* Output current scene parameters, starting with the time of day. */
-	glColor3f(0.3f, 0.0f, 0.4f);
+	render_device().color(0.3f, 0.0f, 0.4f);
 	char timeString[5];
-	glRasterPos2i(3*currWindowSize[0]/4, currWindowSize[1]/8);
+	render_device().raster_pos(3*currWindowSize[0]/4, currWindowSize[1]/8);
 
 	/* Output the weather conditions. */
 	char weatherString[6];
-	glRasterPos2i(3*currWindowSize[0]/4, currWindowSize[1]/12);
+	render_device().raster_pos(3*currWindowSize[0]/4, currWindowSize[1]/12);
+}
+
+
+/*****************************************************************/
+/* Print the statistics gathered while rendering the last frame. */
+/*****************************************************************/
+void ReportFrameStatistics()
+{
+	cout << "material changes: " << frameStatistics.unsortedMaterialChanges
+		 << " submitted, " << frameStatistics.sortedMaterialChanges << " after sorting; "
+		 << "objects: " << frameStatistics.visibleObjects << " visible, "
+		 << frameStatistics.culledObjects << " culled; "
+		 << "person triangles: " << frameStatistics.personTriangles << "; "
+		 << "particles: " << frameStatistics.particles << "; "
+		 << "bytes uploaded: " << frameStatistics.bytesUploaded << endl;
+}
+
+
+/*****************************************************************/
+/* Print the percentiles of every profiled scope (when compiled  */
+/* with PROFILING defined).                                      */
+/*****************************************************************/
+void DumpProfile()
+{
+	Profiler::instance().dump(cout);
 }
 
 
@@ -1795,13 +2066,752 @@ void UpdateFog()
 }
 
 
-/******************************************/
-/* Generate a random floating-point value */
-/* between the two parameterized values.  */
-/******************************************/
-float GenerateRandomNumber(float lowerBound, float upperBound)
+/*********************************************************/
+/* Run the named benchmark, returning the program's exit */
+/* status (non-zero if the name is not recognized).      */
+/*********************************************************/
+int RunBenchmark(const char* name)
+{
+	if (strcmp(name, "windows") == 0)
+		BenchmarkSkyscraperWindows();
+	else if (strcmp(name, "frame") == 0)
+		BenchmarkFrame();
+	else if (strcmp(name, "precipitation") == 0)
+		BenchmarkPrecipitation();
+	else if (strcmp(name, "precipitation-stress") == 0)
+		BenchmarkPrecipitationStress();
+	else if (strcmp(name, "particles") == 0)
+		BenchmarkParticles();
+	else if (strcmp(name, "walk") == 0)
+		BenchmarkWalk();
+	else if (strcmp(name, "people") == 0)
+		BenchmarkPeople();
+	else if (strcmp(name, "obstacles") == 0)
+		BenchmarkObstacles();
+	else if (strcmp(name, "steering") == 0)
+		BenchmarkSteering();
+	else if (strcmp(name, "crowd-threads") == 0)
+		BenchmarkCrowdThreads();
+	else if (strcmp(name, "flythrough") == 0)
+		BenchmarkFlythrough();
+	else if (strcmp(name, "animation") == 0)
+		BenchmarkAnimation();
+	else
+	{
+		cout << "Unknown benchmark \"" << name << "\"; available: windows, frame, precipitation, "
+			 << "precipitation-stress, particles, walk, people, obstacles, steering, "
+			 << "crowd-threads, flythrough, animation" << endl;
+		return 1;
+	}
+	return 0;
+}
+
+/*************************************************************/
+/* Make the named device ("gl", "null" or "recording") the   */
+/* one that everything is drawn through, returning false if  */
+/* the name is not recognized.                               */
+/*************************************************************/
+bool SelectRenderDevice(const char* name)
+{
+	if (strcmp(name, "null") == 0)
+		set_render_device(&nullDevice);
+	else if (strcmp(name, "recording") == 0)
+		set_render_device(&recordingDevice);
+	else if (strcmp(name, "gl") != 0)
+	{
+		cout << "Unknown device \"" << name << "\"; available: gl, null, recording" << endl;
+		return false;
+	}
+	return true;
+}
+
+/****************************************************************/
+/* Time whole frames (scene update and Display) under each kind */
+/* of weather, driving forward from the viewer's starting       */
+/* position.  With the recording device, the commands issued in */
+/* the last frame of each run are reported as well.             */
+/****************************************************************/
+void BenchmarkFrame()
+{
+	const int NbrOfFrames = 300;
+	const weather conditions[] = { sunny, rainy, snowy };
+	const char* names[] = { "frame/sunny", "frame/rainy", "frame/snowy" };
+	weather savedCondition = weatherCondition;
+
+	for (int c = 0; c < 3; c++)
+	{
+		weatherCondition = conditions[c];
+		Stopwatch timer;
+		for (int f = 0; f < NbrOfFrames; f++)
+		{
+			StepSimulation();
+			DrawFrame(1.0);
+		}
+		render_device().finish();
+		report_benchmark(names[c], timer.elapsed_ms()/NbrOfFrames, "ms/frame");
+
+		if (&render_device() == &recordingDevice)
+			ReportRecordedCommands(names[c]);
+	}
+
+	weatherCondition = savedCondition;
+}
+
+/**************************************************************/
+/* Print how many times each command was issued in the last   */
+/* frame captured by the recording device.                    */
+/**************************************************************/
+void ReportRecordedCommands(const char* prefix)
+{
+	for (int i = 0; i < RenderDevice::COMMAND_COUNT; i++)
+	{
+		RenderDevice::Command command = RenderDevice::Command(i);
+		if (recordingDevice.get_call_count(command) == 0)
+			continue;
+
+		string name = string(prefix) + "/" + RenderDevice::command_name(command);
+		report_benchmark(name.c_str(), recordingDevice.get_call_count(command), "calls");
+	}
+}
+
+/**************************************************************/
+/* Time the skyscrapers of every road block, drawn first with */
+/* the per-window loop and then with one instanced batch per  */
+/* building, from the viewer's starting position.             */
+/**************************************************************/
+void BenchmarkSkyscraperWindows()
+{
+	const int NbrOfFrames = 200;
+	const WindowMode modes[] = { LoopedWindows, InstancedWindows };
+	const char* names[] = { "windows/looped", "windows/instanced" };
+	WindowMode savedMode = windowRenderMode;
+
+	render_device().matrix_mode(GL_PROJECTION);
+	render_device().load_identity();
+	render_device().perspective(60.0, AspectRatio, 0.1, 300.0);
+	render_device().matrix_mode(GL_MODELVIEW);
+	render_device().load_identity();
+	render_device().look_at(viewPosition[0], viewPosition[1], viewPosition[2],
+			  viewPosition[0], viewPosition[1]+lookAtYDelta, viewPosition[2]+1,
+			  0.0, 1.0, 0.0);
+	render_device().enable(GL_LIGHTING);
+	render_device().enable(GL_LIGHT0);
+
+	citySeed = 1;
+	for (int m = 0; m < 2; m++)
+	{
+		windowRenderMode = modes[m];
+		Stopwatch timer;
+		for (int f = 0; f < NbrOfFrames; f++)
+		{
+			render_device().clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			for (int i = 1; i < NbrOfRoadIterations; i++)
+			{
+				DrawSkyscraper(0.0, i, RHS);
+				DrawSkyscraper(0.0, i, LHS);
+			}
+			renderQueue.flush();
+			render_device().finish();
+		}
+		report_benchmark(names[m], timer.elapsed_ms()/NbrOfFrames, "ms/frame");
+	}
+
+	windowRenderMode = savedMode;
+}
+
+
+/****************************************************************/
+/* Time the precipitation update (shifting and wrapping every   */
+/* raindrop) on its own and together with building the vertex   */
+/* array that is drawn, at 20,000 and 200,000 drops, looking    */
+/* down the z-axis from the origin.                             */
+/****************************************************************/
+void BenchmarkPrecipitation()
+{
+	const int NbrOfFrames = 200;
+	const int counts[] = { 20000, 200000 };
+	GLfloat streak[] = { 0.005, -0.02, 0.0 };
+	Matrix camera;
+	camera.look_at(0.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0, 1.0, 0.0);
+	PrecipitationVolume volume(camera, 60.0, AspectRatio, RainNear, RainFar);
+
+	for (int c = 0; c < 2; c++)
+	{
+		PrecipitationField field;
+		vector<float> vertices(6*counts[c]);
+		field.generate(RainSeed, counts[c]);
+		GLfloat offset[] = { 0.0, 0.0, 0.0 };
+		char name[64];
+
+		Stopwatch timer;
+		for (int f = 0; f < NbrOfFrames; f++)
+		{
+			for (int i = 0; i < 3; i++)
+				offset[i] += rainIncrementDelta[i];
+			field.update(0, counts[c], volume, offset);
+		}
+		sprintf(name, "precipitation/update/%d", counts[c]);
+		report_benchmark(name, 1.0e6*timer.elapsed_ms()/(double(NbrOfFrames)*counts[c]), "ns/drop");
+
+		timer.reset();
+		for (int f = 0; f < NbrOfFrames; f++)
+		{
+			for (int i = 0; i < 3; i++)
+				offset[i] += rainIncrementDelta[i];
+			field.update(0, counts[c], volume, offset);
+			field.get_lines(0, counts[c], streak, &vertices[0]);
+		}
+		sprintf(name, "precipitation/vertices/%d", counts[c]);
+		report_benchmark(name, 1.0e6*timer.elapsed_ms()/(double(NbrOfFrames)*counts[c]), "ns/drop");
+	}
+}
+
+
+/***************************************************************/
+/* Stress the threaded precipitation path: from 10 thousand to */
+/* a million raindrops, shifted and written into the stream    */
+/* buffer every frame, with every thread count from one up to  */
+/* the number of hardware threads (in powers of two).          */
+/***************************************************************/
+void BenchmarkPrecipitationStress()
+{
+	const int NbrOfFrames = 50;
+	const int counts[] = { 10000, 30000, 100000, 300000, 1000000 };
+	const int NbrOfCounts = sizeof(counts)/sizeof(counts[0]);
+	GLfloat streak[] = { 0.005, -0.02, 0.0 };
+	GLfloat savedIncrement[3];
+	Matrix camera;
+	camera.look_at(0.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0, 1.0, 0.0);
+	PrecipitationVolume volume(camera, 60.0, AspectRatio, RainNear, RainFar);
+	int maxThreads = workerPool.get_thread_count();
+
+	PrecipitationField field;
+	field.generate(RainSeed, counts[NbrOfCounts-1]);
+	for (int i = 0; i < 3; i++)
+		savedIncrement[i] = precipIncrement[i];
+
+	for (int threads = 1; ; threads = min(2*threads, maxThreads))
+	{
+		ThreadPool pool(threads);
+
+		for (int c = 0; c < NbrOfCounts; c++)
+		{
+			Stopwatch timer;
+			for (int f = 0; f < NbrOfFrames; f++)
+			{
+				for (int i = 0; i < 3; i++)
+					precipIncrement[i] += rainIncrementDelta[i];
+				UpdatePrecipitation(pool, field, counts[c], volume, streak,
+									precipitationStream.map(6*counts[c]*sizeof(float)));
+				precipitationStream.draw(GL_LINES, 2*counts[c]);
+			}
+			render_device().finish();
+
+			char name[64];
+			sprintf(name, "precipitation-stress/%dt/%d", threads, counts[c]);
+			report_benchmark(name, timer.elapsed_ms()/NbrOfFrames, "ms/frame");
+		}
+
+		if (threads == maxThreads)
+			break;
+	}
+
+	for (int i = 0; i < 3; i++)
+		precipIncrement[i] = savedIncrement[i];
+}
+
+/****************************************************************/
+/* Time a particle system running at its capacity of 100,000:   */
+/* every step a thousand emitters start ten particles each, as  */
+/* many as have died since the step before, and every particle  */
+/* is moved on.                                                 */
+/****************************************************************/
+void BenchmarkParticles()
+{
+	const int NbrOfSteps = 200;
+	const int NbrOfEmitters = 1000;
+	const int Capacity = 100000;
+	vector<ParticleEmitter> emitters(NbrOfEmitters);
+	ParticleSystem system(Capacity, SplashGravity, RainSeed);
+
+	for (int e = 0; e < NbrOfEmitters; e++)
+	{
+		emitters[e].position[0] = e;
+		emitters[e].spread[0] = emitters[e].spread[2] = 0.5;
+		emitters[e].velocity[1] = 2.0;
+		emitters[e].velocity_spread[0] = emitters[e].velocity_spread[2] = 1.0;
+		emitters[e].lifetime = Range<>(0.5, 1.0);
+	}
+
+	/* Fill the pool before timing, so that only the steady state is. */
+	while (system.size() < Capacity)
+		system.emit(&emitters[0], NbrOfEmitters, 10);
+
+	double emitted = 0.0, moved = 0.0;
+	Stopwatch timer;
+	for (int f = 0; f < NbrOfSteps; f++)
+	{
+		moved += system.size();
+		system.update(SimulationStep);
+		emitted += system.emit(&emitters[0], NbrOfEmitters, 10);
+	}
+	double elapsed = timer.elapsed_ms();
+
+	report_benchmark("particles/step", elapsed/NbrOfSteps, "ms/step");
+	report_benchmark("particles/per-particle", 1.0e6*elapsed/(moved + emitted), "ns/particle");
+	report_benchmark("particles/emitted", emitted/NbrOfSteps, "particles/step");
+}
+
+
+/****************************************************************/
+/* Time animating 10,000 pedestrians for a step, each as a      */
+/* Person evaluating its own easing curves, and as a crowd      */
+/* posed from the shared walk cycle, reporting the size of a    */
+/* Person and what building one allocates as well.              */
+/****************************************************************/
+void BenchmarkWalk()
+{
+	const int NbrOfSteps = 100;
+	const int NbrOfPeople = 10000;
+
+	vector<Person> people;
+	people.reserve(NbrOfPeople);
+	AllocationCounter start = AllocationCounter::snapshot();
+	people.resize(NbrOfPeople);
+	AllocationCounter counts = AllocationCounter::snapshot() - start;
+	report_benchmark("walk/person-bytes", sizeof(Person), "bytes");
+	report_benchmark("walk/person-allocations", double(counts.allocations)/NbrOfPeople, "allocations/person");
+
+	Stopwatch timer;
+	for (int f = 0; f < NbrOfSteps; f++)
+		for (int i = 0; i < NbrOfPeople; i++)
+			people[i].animate();
+	report_benchmark("walk/person-animate", 1.0e6*timer.elapsed_ms()/(double(NbrOfSteps)*NbrOfPeople), "ns/person");
+
+	Crowd crowd;
+	for (int i = 0; i < NbrOfPeople; i++)
+	{
+		Random<> r(g_pedestrian_seed, 0, i);
+		crowd.add(i, 1, 1, r.next(0), r.next(1, g_walk_rate));
+	}
+	timer.reset();
+	for (int f = 0; f < NbrOfSteps; f++)
+		crowd.step(g_person_delta);
+	report_benchmark("walk/crowd-step", 1.0e6*timer.elapsed_ms()/(double(NbrOfSteps)*NbrOfPeople), "ns/person");
+}
+
+
+/****************************************************************/
+/* Time drawing crowds of 100 and 1,000 pedestrians spread      */
+/* along the sidewalks ahead of the viewer, person by person    */
+/* and in instanced batches, reporting the draw calls each      */
+/* takes as well.                                               */
+/****************************************************************/
+void BenchmarkPeople()
+{
+	const int NbrOfFrames = 20;
+	const int counts[] = { 100, 1000 };
+	const PeopleMode modes[] = { LoopedPeople, InstancedPeople };
+	const char* names[] = { "people/looped", "people/instanced" };
+
+	render_device().matrix_mode(GL_PROJECTION);
+	render_device().load_identity();
+	render_device().perspective(60.0, AspectRatio, 0.1, 300.0);
+	render_device().matrix_mode(GL_MODELVIEW);
+	render_device().load_identity();
+	render_device().look_at(0.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0, 1.0, 0.0);
+	render_device().enable(GL_LIGHTING);
+	render_device().enable(GL_LIGHT0);
+
+	for (int c = 0; c < 2; c++)
+	{
+		Crowd crowd;
+		for (int i = 0; i < counts[c]; i++)
+		{
+			Random<> r(g_pedestrian_seed, 0, i);
+			crowd.add(1.0 + 100.0*i/counts[c], (i%2 == 0) ? 1 : -1, 1, r.next(0), r.next(1, g_walk_rate));
+		}
+		crowd.step(g_person_delta);
+
+		for (int m = 0; m < 2; m++)
+		{
+			float  pose[Joint::COUNT];
+			Matrix parts[Person::PART_COUNT];
+			PersonBatch batch;
+			int calls = 0;
+
+			Stopwatch timer;
+			for (int f = 0; f < NbrOfFrames; f++)
+			{
+				calls = 0;
+				batch.clear();
+				for (int i = 0; i < counts[c]; i++)
+				{
+					Matrix model;
+					model.translate(crowd.get_side(i)*2.0, -0.8, crowd.get_position(i));
+					crowd.update_lod(i, crowd.get_position(i));
+
+					crowd.get_pose(i, pose);
+					Person::pose_parts(pose, model, parts);
+					if (modes[m] == InstancedPeople)
+						batch.add(parts, crowd.get_lod(i));
+					else
+					{
+						Person::draw_parts(parts, crowd.get_lod(i));
+						calls += Person::PART_COUNT;
+					}
+				}
+				if (modes[m] == InstancedPeople)
+					calls = batch.draw();
+				render_device().finish();
+			}
+
+			char name[64];
+			sprintf(name, "%s/%d", names[m], counts[c]);
+			report_benchmark(name, timer.elapsed_ms()/NbrOfFrames, "ms/frame");
+			sprintf(name, "%s/%d/draws", names[m], counts[c]);
+			report_benchmark(name, calls, "calls");
+		}
+	}
+}
+
+
+/****************************************************************/
+/* Time keeping 10,000 sidewalk obstacles in order as the       */
+/* viewer drives past them, and looking up the gaps between     */
+/* them, with a list that is re-sorted every step and scanned   */
+/* for every lookup, and with the obstacle index.               */
+/****************************************************************/
+void BenchmarkObstacles()
 {
+	const int NbrOfSteps = 200;
+	const int NbrOfObstacles = 10000;
+	const int NbrOfQueries = 1000;
+	const float Spacing = 2.0*RoadBlockLength/3.0;
+	const float LoopLength = NbrOfObstacles*Spacing;
+	const float Speed = 50.0;
+
+	list<float> sorted;
+	ObstacleIndex index;
+	for (int i = 0; i < NbrOfObstacles; i++)
+	{
+		float z = Random<>(RainSeed, 0, i).next(0, i*Spacing, (i + 1)*Spacing);
+		sorted.push_front(z);
+		index.insert(z);
+	}
+	sorted.sort();
+
+	int found[2] = { 0, 0 };
+	double recycling[2] = { 0.0, 0.0 }, querying[2] = { 0.0, 0.0 };
+	Stopwatch timer;
+	for (int f = 0; f < NbrOfSteps; f++)
+	{
+		float camera = f*Speed;
+
+		timer.reset();
+		for (list<float>::iterator i = sorted.begin(); i != sorted.end(); ++i)
+			if (*i < camera)
+				*i += LoopLength;
+		sorted.sort();
+		recycling[0] += timer.elapsed_ms();
 
-	return (lowerBound + ((upperBound - lowerBound) * 
-				(float(rand()) / RAND_MAX)));
+		timer.reset();
+		for (int q = 0; q < NbrOfQueries; q++)
+		{
+			float z = camera + Random<>(RainSeed, 1, f).next(q, 0.0f, LoopLength);
+			for (list<float>::iterator i1 = sorted.begin(), i2 = ++sorted.begin(); i2 != sorted.end(); ++i1, ++i2)
+			{
+				if (z > *i1 + g_threshold && z < *i2 - g_threshold)
+				{
+					found[0] += (*i2 - *i1 - 2*g_threshold > 10.0f);
+					break;
+				}
+			}
+		}
+		querying[0] += timer.elapsed_ms();
+
+		timer.reset();
+		index.recycle(camera, LoopLength);
+		recycling[1] += timer.elapsed_ms();
+
+		timer.reset();
+		for (int q = 0; q < NbrOfQueries; q++)
+			found[1] += is_valid_spot(index, camera + Random<>(RainSeed, 1, f).next(q, 0.0f, LoopLength));
+		querying[1] += timer.elapsed_ms();
+	}
+
+	report_benchmark("obstacles/list/recycle", recycling[0]/NbrOfSteps, "ms/step");
+	report_benchmark("obstacles/list/query", 1.0e6*querying[0]/(double(NbrOfSteps)*NbrOfQueries), "ns/query");
+	report_benchmark("obstacles/index/recycle", recycling[1]/NbrOfSteps, "ms/step");
+	report_benchmark("obstacles/index/query", 1.0e6*querying[1]/(double(NbrOfSteps)*NbrOfQueries), "ns/query");
+	if (found[0] != found[1])
+		cerr << "obstacles: the list found " << found[0] << " free spots, the index " << found[1] << endl;
+}
+
+
+/****************************************************************/
+/* Time steering crowds of 100 to 10,000 pedestrians along      */
+/* sidewalks with as many people and obstacles to the block as  */
+/* the city has, against letting them walk straight on, and     */
+/* count how many end up facing the other way.                  */
+/****************************************************************/
+void BenchmarkSteering()
+{
+	const int NbrOfSteps = 100;
+	const int counts[] = { 100, 1000, 10000 };
+	const float PeopleSpacing = RoadBlockLength/5.0;
+	const float ObstacleSpacing = RoadBlockLength/1.5;
+
+	for (int c = 0; c < 3; c++)
+	{
+		float length = counts[c]/2*PeopleSpacing;
+		ObstacleIndex left, right;
+		for (int i = 0; i*ObstacleSpacing < length; i++)
+		{
+			Random<> r(g_pedestrian_seed, 1, i);
+			left.insert(r.next(0, i*ObstacleSpacing, (i + 1)*ObstacleSpacing));
+			right.insert(r.next(1, i*ObstacleSpacing, (i + 1)*ObstacleSpacing));
+		}
+
+		/* The people are added in the order a steered crowd keeps */
+		/* them in (the left sidewalk first, each in order of Z),  */
+		/* so that nobody is moved and each person is at the same */
+		/* place in both crowds.                                   */
+		vector< pair<float, int> > order;
+		for (int i = 0; i < counts[c]; i++)
+		{
+			Random<> r(g_pedestrian_seed, 0, i);
+			order.push_back(make_pair((i%2 == 0 ? 0.0f : 2.0f*length) + r.next(3, 0.0f, length), i));
+		}
+		sort(order.begin(), order.end());
+
+		Crowd walking(g_threshold, g_pedestrian_spacing), steered(g_threshold, g_pedestrian_spacing);
+		for (int k = 0; k < counts[c]; k++)
+		{
+			int i = order[k].second;
+			Random<> r(g_pedestrian_seed, 0, i);
+			int side = (i%2 == 0) ? 1 : -1;
+			int direction = (r.next(2) < 0.5) ? 1 : -1;
+			float z = r.next(3, 0.0f, length);
+			walking.add(z, side, direction, r.next(0), r.next(1, g_walk_rate));
+			steered.add(z, side, direction, r.next(0), r.next(1, g_walk_rate));
+		}
+
+		Stopwatch timer;
+		for (int f = 0; f < NbrOfSteps; f++)
+			walking.step(g_person_delta);
+		double straight = timer.elapsed_ms();
+
+		timer.reset();
+		for (int f = 0; f < NbrOfSteps; f++)
+			steered.step(g_person_delta, left, right);
+		double steering = timer.elapsed_ms();
+
+		int reversed = 0;
+		for (int i = 0; i < counts[c]; i++)
+			reversed += (steered.get_direction(i) != walking.get_direction(i));
+
+		char name[64];
+		sprintf(name, "steering/%d/straight", counts[c]);
+		report_benchmark(name, 1.0e6*straight/(double(NbrOfSteps)*counts[c]), "ns/person");
+		sprintf(name, "steering/%d/steered", counts[c]);
+		report_benchmark(name, 1.0e6*steering/(double(NbrOfSteps)*counts[c]), "ns/person");
+		sprintf(name, "steering/%d/reversed", counts[c]);
+		report_benchmark(name, reversed, "people");
+	}
+}
+
+
+/****************************************************************/
+/* Time steering 100,000 pedestrians with every thread count    */
+/* from one up to the number of hardware threads (at least      */
+/* four, in powers of two), checking that every count walks     */
+/* everyone to exactly where a serial step does, and report     */
+/* how busy each thread was.                                    */
+/****************************************************************/
+void BenchmarkCrowdThreads()
+{
+	const int NbrOfSteps = 50;
+	const int NbrOfPeople = 100000;
+	const float PeopleSpacing = RoadBlockLength/5.0;
+	const float ObstacleSpacing = RoadBlockLength/1.5;
+	const float Length = NbrOfPeople/2*PeopleSpacing;
+	int maxThreads = max(workerPool.get_thread_count(), 4);
+
+	ObstacleIndex left, right;
+	for (int i = 0; i*ObstacleSpacing < Length; i++)
+	{
+		Random<> r(g_pedestrian_seed, 1, i);
+		left.insert(r.next(0, i*ObstacleSpacing, (i + 1)*ObstacleSpacing));
+		right.insert(r.next(1, i*ObstacleSpacing, (i + 1)*ObstacleSpacing));
+	}
+
+	Crowd start(g_threshold, g_pedestrian_spacing);
+	for (int i = 0; i < NbrOfPeople; i++)
+	{
+		Random<> r(g_pedestrian_seed, 0, i);
+		start.add(r.next(3, 0.0f, Length), (i%2 == 0) ? 1 : -1, (r.next(2) < 0.5) ? 1 : -1,
+				  r.next(0), r.next(1, g_walk_rate));
+	}
+
+	Crowd serial = start;
+	Stopwatch timer;
+	for (int f = 0; f < NbrOfSteps; f++)
+		serial.step(g_person_delta, left, right);
+	double serialTime = timer.elapsed_ms();
+	report_benchmark("crowd-threads/serial", serialTime/NbrOfSteps, "ms/step");
+
+	for (int threads = 1; ; threads = min(2*threads, maxThreads))
+	{
+		ThreadPool pool(threads);
+		Crowd crowd = start;
+		vector<double> utilization(threads, 0.0);
+
+		timer.reset();
+		for (int f = 0; f < NbrOfSteps; f++)
+		{
+			crowd.step(g_person_delta, left, right, pool);
+			for (int t = 0; t < threads; t++)
+				utilization[t] += pool.get_utilization(t)/NbrOfSteps;
+		}
+		double elapsed = timer.elapsed_ms();
+
+		char name[64];
+		sprintf(name, "crowd-threads/%dt", threads);
+		report_benchmark(name, elapsed/NbrOfSteps, "ms/step");
+		sprintf(name, "crowd-threads/%dt/speedup", threads);
+		report_benchmark(name, serialTime/elapsed, "x");
+		for (int t = 0; t < threads; t++)
+		{
+			sprintf(name, "crowd-threads/%dt/thread%d", threads, t);
+			report_benchmark(name, 100.0*utilization[t], "% busy");
+		}
+
+		for (int i = 0; i < NbrOfPeople; i++)
+		{
+			if (crowd.get_position(i) != serial.get_position(i) ||
+				crowd.get_direction(i) != serial.get_direction(i))
+			{
+				cerr << "crowd-threads: with " << threads << " threads, person " << i
+					 << " ends up elsewhere than in a serial step" << endl;
+				break;
+			}
+		}
+
+		if (threads == maxThreads)
+			break;
+	}
+}
+
+
+/****************************************************************/
+/* Drive through the city under each kind of weather, warming   */
+/* up first, and count the heap allocations, frees and bytes    */
+/* allocated by whole frames (scene update and drawing), which  */
+/* should be none: pedestrians leaving the view are replaced in */
+/* the same slots of the crowd, and every other buffer is kept  */
+/* between frames.                                              */
+/****************************************************************/
+void BenchmarkFlythrough()
+{
+	const int NbrOfWarmUpFrames = 100;
+	const int NbrOfFrames = 1000;
+	const weather conditions[] = { sunny, rainy, snowy };
+	const char* names[] = { "flythrough/sunny", "flythrough/rainy", "flythrough/snowy" };
+	weather savedCondition = weatherCondition;
+
+	for (int c = 0; c < 3; c++)
+	{
+		weatherCondition = conditions[c];
+		for (int f = 0; f < NbrOfWarmUpFrames; f++)
+		{
+			StepSimulation();
+			DrawFrame(1.0);
+		}
+
+		int spawned = pedestrians.get_spawn_count();
+		AllocationCounter start = AllocationCounter::snapshot();
+		for (int f = 0; f < NbrOfFrames; f++)
+		{
+			StepSimulation();
+			DrawFrame(1.0);
+		}
+		render_device().finish();
+		AllocationCounter counts = AllocationCounter::snapshot() - start;
+
+		char name[64];
+		sprintf(name, "%s/allocations", names[c]);
+		report_benchmark(name, counts.allocations, "total");
+		sprintf(name, "%s/frees", names[c]);
+		report_benchmark(name, counts.frees, "total");
+		sprintf(name, "%s/bytes", names[c]);
+		report_benchmark(name, counts.bytes, "total");
+		sprintf(name, "%s/respawned", names[c]);
+		report_benchmark(name, pedestrians.get_spawn_count() - spawned, "people");
+	}
+
+	weatherCondition = savedCondition;
+}
+
+
+/****************************************************************/
+/* Time swinging the joints of 10,000 pedestrians for a step,   */
+/* one Animation at a time through animate_range() and all at   */
+/* once through an AnimationSystem, first with every joint on   */
+/* the walk's easing and then with the easings mixed, checking  */
+/* that both ways come to the same angles.                      */
+/****************************************************************/
+void BenchmarkAnimation()
+{
+	typedef float (*Easing)(float, float, int, int);
+
+	const int NbrOfSteps = 100;
+	const int NbrOfTweens = 10000*Joint::COUNT;
+	const Easing easings[AnimationSystem::EASING_COUNT] = {
+		Linear::tween,
+		Quadratic::ease_in, Quadratic::ease_out, Quadratic::ease_in_and_out,
+		Cubic::ease_in, Cubic::ease_out, Cubic::ease_in_and_out
+	};
+	const char* names[] = { "animation/walk", "animation/mixed" };
+
+	for (int m = 0; m < 2; m++)
+	{
+		vector<float> angles(NbrOfTweens, 0.0f), batched(NbrOfTweens, 0.0f);
+		vector<Animation> animations(NbrOfTweens);
+		vector<int> easing(NbrOfTweens);
+		AnimationSystem system;
+
+		for (int k = 0; k < NbrOfTweens; k++)
+		{
+			const JointSwing& s = Person::swing(k%Joint::COUNT);
+
+			easing[k] = (m == 0) ? AnimationSystem::QuadraticInAndOut : k%AnimationSystem::EASING_COUNT;
+			animations[k] = Animation(angles[k], s.first, s.frames);
+			system.add(batched[k], AnimationSystem::Easing(easing[k]), s.first, s.frames, s.range);
+		}
+
+		Stopwatch timer;
+		for (int f = 0; f < NbrOfSteps; f++)
+			for (int k = 0; k < NbrOfTweens; k++)
+				animations[k].animate_range(&Person::swing(k%Joint::COUNT).range, easings[easing[k]]);
+		double elapsed = timer.elapsed_ms();
+
+		timer.reset();
+		for (int f = 0; f < NbrOfSteps; f++)
+			system.update();
+		double batched_elapsed = timer.elapsed_ms();
+
+		int mismatches = 0;
+		for (int k = 0; k < NbrOfTweens; k++)
+			if (angles[k] != batched[k])
+				mismatches++;
+
+		char name[64];
+		sprintf(name, "%s/animate-range", names[m]);
+		report_benchmark(name, 1.0e6*elapsed/(double(NbrOfSteps)*NbrOfTweens), "ns/tween");
+		sprintf(name, "%s/system", names[m]);
+		report_benchmark(name, 1.0e6*batched_elapsed/(double(NbrOfSteps)*NbrOfTweens), "ns/tween");
+		sprintf(name, "%s/mismatches", names[m]);
+		report_benchmark(name, mismatches, "tweens");
+	}
 }
\ No newline at end of file
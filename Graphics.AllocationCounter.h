@@ -0,0 +1,88 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include <new>
+#include <atomic>
+#include <cstdlib>
+
+namespace Graphics
+{
+  // Counts every allocation and free made through operator new and
+  // delete, on any thread, so that a stretch of code can be shown to make
+  // none: take a snapshot before it and compare it with one after.
+  class AllocationCounter
+  {
+  public:
+    long long allocations;
+    long long frees;
+    long long bytes;
+
+    // The counts so far.
+    static AllocationCounter snapshot()
+    {
+      AllocationCounter c;
+      c.allocations = AllocationCounter::counts()[0].load( std::memory_order_relaxed );
+      c.frees       = AllocationCounter::counts()[1].load( std::memory_order_relaxed );
+      c.bytes       = AllocationCounter::counts()[2].load( std::memory_order_relaxed );
+      return( c );
+    }
+
+    // What was counted between two snapshots.
+    AllocationCounter operator-( const AllocationCounter& before ) const
+    {
+      AllocationCounter c;
+      c.allocations = this->allocations - before.allocations;
+      c.frees       = this->frees - before.frees;
+      c.bytes       = this->bytes - before.bytes;
+      return( c );
+    }
+
+    static void count_allocation( std::size_t size )
+    {
+      AllocationCounter::counts()[0].fetch_add( 1, std::memory_order_relaxed );
+      AllocationCounter::counts()[2].fetch_add( ( long long )( size ), std::memory_order_relaxed );
+    }
+
+    static void count_free()
+    {
+      AllocationCounter::counts()[1].fetch_add( 1, std::memory_order_relaxed );
+    }
+
+  private:
+    // Allocations, frees and bytes allocated.  Plain atomics with no
+    // constructor to run, so they can be counted into before main().
+    static std::atomic<long long>* counts()
+    {
+      static std::atomic<long long> c[3];
+      return( c );
+    }
+  };
+
+  void* counted_allocation( std::size_t size )
+  {
+    AllocationCounter::count_allocation( size );
+
+    void* p = std::malloc( size ? size : 1 );
+    if( p == 0 ) throw std::bad_alloc();
+    return( p );
+  }
+
+  void counted_free( void* p )
+  {
+    if( p == 0 ) return;
+
+    AllocationCounter::count_free();
+    std::free( p );
+  }
+}
+
+// Every allocation in the program goes through the counter.  (Over-aligned
+// allocations use the library's own operators, and are not counted.)
+void* operator new( std::size_t size )                    { return( Graphics::counted_allocation( size ) ); }
+void* operator new[]( std::size_t size )                  { return( Graphics::counted_allocation( size ) ); }
+void  operator delete( void* p ) noexcept                 { Graphics::counted_free( p ); }
+void  operator delete[]( void* p ) noexcept               { Graphics::counted_free( p ); }
+void  operator delete( void* p, std::size_t ) noexcept    { Graphics::counted_free( p ); }
+void  operator delete[]( void* p, std::size_t ) noexcept  { Graphics::counted_free( p ); }
+
+#endif
@@ -1,3 +1,6 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
 #include <cmath>
 
 #include "Graphics.Range.h"
@@ -8,6 +11,34 @@ using namespace std;
 
 namespace Graphics
 {
+  // Moves a tween that swings back and forth across range on a frame.  A
+  // tween that has run its n frames and come to rest at either end of
+  // the range turns back toward the other end, starting from where it
+  // is; one under way moves on a frame, and one just finished settles at
+  // end.  Returns whether it turned.  Everything that swings, from an
+  // Animation to the walk cycle, swings through this so that they all
+  // agree to the bit.
+  inline bool swing_range( float& value, float& start, float& end, int& i, int n,
+                           const Range<>& range, float (*f)( float, float, int, int ) )
+  {
+    bool turned = false;
+
+    if( i >= n && ( value == range.min || value == range.max ) )
+    {
+      end    = ( value == range.min ) ? range.max : range.min;
+      start  = value;
+      i      = 0;
+      turned = true;
+    }
+
+    if( i < n )
+      value = f( start, end - start, ++i, n );
+    else if( i == n )
+      value = end;
+
+    return( turned );
+  }
+
   class Animation
   {
   public:
@@ -16,6 +47,14 @@ namespace Graphics
     float*  value;
     int     i, n;
 
+    // Bound to nothing, to be assigned one that is.
+    Animation()
+    {
+      this->value = 0;
+      this->start = this->end = 0.0f;
+      this->i     = this->n   = 0;
+    }
+
     Animation( float& value )
     {
       this->value = &value;
@@ -57,17 +96,9 @@ namespace Graphics
       return( this->i < this->n );
     }
 
-    void animate_range( Range<>* r, float (*f)( float, float, int, int ) )
+    void animate_range( const Range<>* r, float (*f)( float, float, int, int ) )
     {
-      if( !this->is_animating() )
-      {
-        if( (*this->value) == r->min )
-          this->redirect_to( r->max, this->n );
-        else if( (*this->value) == r->max )
-          this->redirect_to( r->min, this->n );
-      }
-
-      this->animate( f );
+      swing_range( *this->value, this->start, this->end, this->i, this->n, *r, f );
     }
 
   };
@@ -131,4 +162,6 @@ namespace Graphics
     }
 
   };
-}
\ No newline at end of file
+}
+
+#endif
\ No newline at end of file
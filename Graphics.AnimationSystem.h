@@ -0,0 +1,344 @@
+#ifndef ANIMATION_SYSTEM_H
+#define ANIMATION_SYSTEM_H
+
+#include <vector>
+#include <limits>
+
+#if defined( __SSE2__ ) || defined( _M_X64 )
+#include <emmintrin.h>
+#define ANIMATION_SYSTEM_USE_SSE2
+#endif
+
+#include "Graphics.Range.h"
+#include "Graphics.Animation.h"
+
+namespace Graphics
+{
+  // Every tween of a scene, advanced together.  Where an Animation is an
+  // object of its own, calling its easing through a function pointer and
+  // writing wherever its value lives, the system keeps the start, end,
+  // value and frame of each tween in separate arrays, one set of arrays
+  // per easing.  update() is then one loop per easing, with the easing
+  // inlined into it and run four (with SSE2) tweens at a time, followed
+  // by one pass that copies the values out to their targets.
+  //
+  // The system owns the values: each target is written on every update
+  // and never read after the tween is added, and it must stay where it is
+  // for as long as the system holds the tween.  The values it produces
+  // are the same, to the bit, as Animation's.
+  //
+  // Nothing in the scene runs through it yet: people are posed from the
+  // crowd's walk cycle.  BenchmarkAnimation weighs it against Animation.
+  class AnimationSystem
+  {
+  public:
+    enum Easing
+    {
+      Linear,
+      QuadraticIn, QuadraticOut, QuadraticInAndOut,
+      CubicIn, CubicOut, CubicInAndOut,
+      EASING_COUNT
+    };
+
+    AnimationSystem()
+    {
+      this->count = 0;
+    }
+
+    // Tweens target from its current value to end over frames frames,
+    // as Animation::animate() does, after which it stays at end.
+    void add( float& target, Easing easing, float end, int frames )
+    {
+      // Nothing equals NaN, so the tween never turns back.
+      float none = std::numeric_limits<float>::quiet_NaN();
+
+      this->add( target, easing, end, frames, none, none );
+    }
+
+    // Swings target back and forth across range, as
+    // Animation::animate_range() does, having first tweened from its
+    // current value to first over frames frames.
+    void add( float& target, Easing easing, float first, int frames, const Range<>& range )
+    {
+      this->add( target, easing, first, frames, range.min, range.max );
+    }
+
+    void clear()
+    {
+      for( int e = 0; e < EASING_COUNT; e++ )
+        this->groups[e].clear();
+
+      this->count = 0;
+    }
+
+    int size()
+    {
+      return( this->count );
+    }
+
+    // Moves every tween on a frame and writes each value to its target.
+    void update()
+    {
+      AnimationSystem::advance<LinearEasing>( this->groups[Linear] );
+      AnimationSystem::advance<QuadraticInEasing>( this->groups[QuadraticIn] );
+      AnimationSystem::advance<QuadraticOutEasing>( this->groups[QuadraticOut] );
+      AnimationSystem::advance<InAndOutEasing<QuadraticInEasing, QuadraticOutEasing> >( this->groups[QuadraticInAndOut] );
+      AnimationSystem::advance<CubicInEasing>( this->groups[CubicIn] );
+      AnimationSystem::advance<CubicOutEasing>( this->groups[CubicOut] );
+      AnimationSystem::advance<InAndOutEasing<CubicInEasing, CubicOutEasing> >( this->groups[CubicInAndOut] );
+
+      for( int e = 0; e < EASING_COUNT; e++ )
+      {
+        Group& g = this->groups[e];
+
+        for( int k = 0; k < g.count; k++ )
+          *g.target[k] = g.value[k];
+      }
+    }
+
+  private:
+    // The tweens of one easing.  The arrays are padded to a whole number
+    // of vectors; the padding holds finished tweens of 0.
+    struct Group
+    {
+      std::vector<float>  start;
+      std::vector<float>  end;
+      std::vector<float>  value;
+      std::vector<float>  low;   // The range a tween swings across, or NaN.
+      std::vector<float>  high;
+      std::vector<int>    i;
+      std::vector<int>    n;
+      std::vector<float*> target;
+      int                 count;
+
+      Group()
+      {
+        this->count = 0;
+      }
+
+      void clear()
+      {
+        this->start.clear(); this->end.clear(); this->value.clear();
+        this->low.clear();   this->high.clear();
+        this->i.clear();     this->n.clear();
+        this->target.clear();
+        this->count = 0;
+      }
+
+      void resize( int padded )
+      {
+        this->start.resize( padded, 0.0f ); this->end.resize( padded, 0.0f ); this->value.resize( padded, 0.0f );
+        this->low.resize( padded, 0.0f );   this->high.resize( padded, 0.0f );
+        this->i.resize( padded, 0 );        this->n.resize( padded, 0 );
+      }
+    };
+
+    Group groups[EASING_COUNT];
+    int   count;
+
+    static int padded_size( int n )
+    {
+      return( ( n + 3 ) & ~3 );
+    }
+
+    void add( float& target, Easing easing, float end, int frames, float low, float high )
+    {
+      Group& g = this->groups[easing];
+      int    k = g.count++;
+
+      g.resize( AnimationSystem::padded_size( g.count ) );
+      g.start[k] = target;
+      g.end[k]   = end;
+      g.value[k] = target;
+      g.low[k]   = low;
+      g.high[k]  = high;
+      g.i[k]     = 0;
+      g.n[k]     = frames;
+      g.target.push_back( &target );
+
+      this->count++;
+    }
+
+    // The easings, each in the same order of operations as its function
+    // in AnimationLibrary, so that the results match.
+    struct LinearEasing
+    {
+      static float ease( float start, float change, int i, int n )
+      {
+        return( AnimationLibrary::Linear::tween( start, change, i, n ) );
+      }
+
+#if defined( ANIMATION_SYSTEM_USE_SSE2 )
+      static __m128 ease( __m128 start, __m128 change, __m128i i, __m128i n )
+      {
+        __m128 t = AnimationSystem::fraction( i, n );
+        return( _mm_add_ps( _mm_mul_ps( change, t ), start ) );
+      }
+#endif
+    };
+
+    struct QuadraticInEasing
+    {
+      static float ease( float start, float change, int i, int n )
+      {
+        return( AnimationLibrary::Quadratic::ease_in( start, change, i, n ) );
+      }
+
+#if defined( ANIMATION_SYSTEM_USE_SSE2 )
+      static __m128 ease( __m128 start, __m128 change, __m128i i, __m128i n )
+      {
+        __m128 t = AnimationSystem::fraction( i, n );
+        return( _mm_add_ps( _mm_mul_ps( _mm_mul_ps( change, t ), t ), start ) );
+      }
+#endif
+    };
+
+    struct QuadraticOutEasing
+    {
+      static float ease( float start, float change, int i, int n )
+      {
+        return( AnimationLibrary::Quadratic::ease_out( start, change, i, n ) );
+      }
+
+#if defined( ANIMATION_SYSTEM_USE_SSE2 )
+      static __m128 ease( __m128 start, __m128 change, __m128i i, __m128i n )
+      {
+        __m128 t = AnimationSystem::fraction( i, n );
+        __m128 c = _mm_mul_ps( AnimationSystem::negate( change ), t );
+        return( _mm_add_ps( _mm_mul_ps( c, _mm_sub_ps( t, _mm_set1_ps( 2.0f ) ) ), start ) );
+      }
+#endif
+    };
+
+    struct CubicInEasing
+    {
+      static float ease( float start, float change, int i, int n )
+      {
+        return( AnimationLibrary::Cubic::ease_in( start, change, i, n ) );
+      }
+
+#if defined( ANIMATION_SYSTEM_USE_SSE2 )
+      static __m128 ease( __m128 start, __m128 change, __m128i i, __m128i n )
+      {
+        __m128 t = AnimationSystem::fraction( i, n );
+        return( _mm_add_ps( _mm_mul_ps( _mm_mul_ps( _mm_mul_ps( change, t ), t ), t ), start ) );
+      }
+#endif
+    };
+
+    struct CubicOutEasing
+    {
+      static float ease( float start, float change, int i, int n )
+      {
+        return( AnimationLibrary::Cubic::ease_out( start, change, i, n ) );
+      }
+
+#if defined( ANIMATION_SYSTEM_USE_SSE2 )
+      static __m128 ease( __m128 start, __m128 change, __m128i i, __m128i n )
+      {
+        __m128 t = AnimationSystem::fraction( i, n );
+        __m128 c = _mm_mul_ps( _mm_mul_ps( AnimationSystem::negate( change ), t ), t );
+        return( _mm_add_ps( _mm_mul_ps( c, _mm_sub_ps( t, _mm_set1_ps( 2.0f ) ) ), start ) );
+      }
+#endif
+    };
+
+    // Eases in over the first half of the frames and half of the change,
+    // and out over the rest.  Both halves are worked out for every lane
+    // and each lane keeps the one it is in.
+    template<typename In, typename Out>
+    struct InAndOutEasing
+    {
+      static float ease( float start, float change, int i, int n )
+      {
+        float half_change = change/2;
+        int   half_n      = n/2;
+
+        if( i < half_n )
+          return( In::ease( start, half_change, i, half_n ) );
+        else
+          return( Out::ease( start+half_change, change-half_change, i-half_n, n-half_n ) );
+      }
+
+#if defined( ANIMATION_SYSTEM_USE_SSE2 )
+      static __m128 ease( __m128 start, __m128 change, __m128i i, __m128i n )
+      {
+        __m128  half_change = _mm_div_ps( change, _mm_set1_ps( 2.0f ) );
+        __m128i half_n      = _mm_srai_epi32( n, 1 );  // n is never negative.
+
+        __m128 in  = In::ease( start, half_change, i, half_n );
+        __m128 out = Out::ease( _mm_add_ps( start, half_change ), _mm_sub_ps( change, half_change ),
+                                _mm_sub_epi32( i, half_n ), _mm_sub_epi32( n, half_n ) );
+
+        return( AnimationSystem::select( _mm_castsi128_ps( _mm_cmplt_epi32( i, half_n ) ), in, out ) );
+      }
+#endif
+    };
+
+#if defined( ANIMATION_SYSTEM_USE_SSE2 )
+    static __m128 fraction( __m128i i, __m128i n )
+    {
+      return( _mm_div_ps( _mm_cvtepi32_ps( i ), _mm_cvtepi32_ps( n ) ) );
+    }
+
+    static __m128 negate( __m128 v )
+    {
+      return( _mm_xor_ps( v, _mm_set1_ps( -0.0f ) ) );
+    }
+
+    // a where mask is set, otherwise b.
+    static __m128 select( __m128 mask, __m128 a, __m128 b )
+    {
+      return( _mm_or_ps( _mm_and_ps( mask, a ), _mm_andnot_ps( mask, b ) ) );
+    }
+
+    // swing_range(), four tweens at a time: a tween that has finished
+    // turns back across its range from whichever end it is at, and every
+    // tween still under way moves on a frame.
+    template<typename E>
+    static void advance( Group& g )
+    {
+      for( int k = 0, last = AnimationSystem::padded_size( g.count ); k < last; k += 4 )
+      {
+        __m128i i     = _mm_loadu_si128( ( const __m128i* )&g.i[k] );
+        __m128i n     = _mm_loadu_si128( ( const __m128i* )&g.n[k] );
+        __m128  start = _mm_loadu_ps( &g.start[k] );
+        __m128  end   = _mm_loadu_ps( &g.end[k] );
+        __m128  value = _mm_loadu_ps( &g.value[k] );
+        __m128  low   = _mm_loadu_ps( &g.low[k] );
+        __m128  high  = _mm_loadu_ps( &g.high[k] );
+
+        __m128 done    = _mm_castsi128_ps( _mm_cmpeq_epi32( i, n ) );
+        __m128 at_low  = _mm_and_ps( done, _mm_cmpeq_ps( value, low ) );
+        __m128 at_high = _mm_and_ps( done, _mm_cmpeq_ps( value, high ) );
+        __m128 turn    = _mm_or_ps( at_low, at_high );
+
+        start = AnimationSystem::select( turn, value, start );
+        end   = AnimationSystem::select( at_low, high, AnimationSystem::select( at_high, low, end ) );
+        i     = _mm_andnot_si128( _mm_castps_si128( turn ), i );
+
+        // Subtracting the all-ones mask adds one to the moving lanes.
+        __m128i moving = _mm_cmplt_epi32( i, n );
+        i     = _mm_sub_epi32( i, moving );
+        value = AnimationSystem::select( _mm_castsi128_ps( moving ),
+                                         E::ease( start, _mm_sub_ps( end, start ), i, n ), end );
+
+        _mm_storeu_si128( ( __m128i* )&g.i[k], i );
+        _mm_storeu_ps( &g.start[k], start );
+        _mm_storeu_ps( &g.end[k], end );
+        _mm_storeu_ps( &g.value[k], value );
+      }
+    }
+#else
+    // Each tween swings through swing_range().
+    template<typename E>
+    static void advance( Group& g )
+    {
+      for( int k = 0; k < g.count; k++ )
+        swing_range( g.value[k], g.start[k], g.end[k], g.i[k], g.n[k], Range<>( g.low[k], g.high[k] ), E::ease );
+    }
+#endif
+  };
+}
+
+#endif
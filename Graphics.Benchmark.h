@@ -0,0 +1,43 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+namespace Graphics
+{
+  // Wall-clock timer for the -benchmark modes.
+  class Stopwatch
+  {
+  public:
+    Stopwatch()
+    {
+      this->reset();
+    }
+
+    void reset()
+    {
+      this->start = std::chrono::steady_clock::now();
+    }
+
+    double elapsed_ms()
+    {
+      std::chrono::duration<double, std::milli> d = std::chrono::steady_clock::now() - this->start;
+      return( d.count() );
+    }
+
+  private:
+    std::chrono::steady_clock::time_point start;
+  };
+
+  // Prints one benchmark result line: "name  value unit".
+  void report_benchmark( const char* name, double value, const char* unit )
+  {
+    std::cout << std::left << std::setw( 40 ) << name
+              << std::right << std::setw( 12 ) << std::fixed << std::setprecision( 4 ) << value
+              << " " << unit << std::endl;
+  }
+}
+
+#endif
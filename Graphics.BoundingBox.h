@@ -1,23 +1,106 @@
-/*#ifndef BOUNDING_BOX_H
+#ifndef BOUNDING_BOX_H
 #define BOUNDING_BOX_H
 
-#include "Graphics.Point.h"
+#include "Graphics.Matrix.h"
 
 namespace Graphics
 {
+  // Axis-aligned bounding box.  A default-constructed box is empty and
+  // grows to enclose whatever points or boxes it is extended by.
   class BoundingBox
   {
   public:
-    Point<> corners[8];
-    Point<> center;
+    float min[3];
+    float max[3];
 
-    BoundingBox( Point<> center, float height, float width, float depth )
+    BoundingBox()
     {
-      this->center = center;
+      for( int i = 0; i < 3; i++ )
+      {
+        this->min[i] =  1.0e30f;
+        this->max[i] = -1.0e30f;
+      }
+    }
+
+    BoundingBox( const float center[], float width, float height, float depth )
+    {
+      float half[] = { width * 0.5f, height * 0.5f, depth * 0.5f };
+
+      for( int i = 0; i < 3; i++ )
+      {
+        this->min[i] = center[i] - half[i];
+        this->max[i] = center[i] + half[i];
+      }
+    }
+
+    BoundingBox( float min_x, float min_y, float min_z, float max_x, float max_y, float max_z )
+    {
+      this->min[0] = min_x; this->min[1] = min_y; this->min[2] = min_z;
+      this->max[0] = max_x; this->max[1] = max_y; this->max[2] = max_z;
+    }
+
+    bool is_empty() const
+    {
+      return( this->min[0] > this->max[0] );
+    }
+
+    void extend( const float p[] )
+    {
+      for( int i = 0; i < 3; i++ )
+      {
+        if( p[i] < this->min[i] ) this->min[i] = p[i];
+        if( p[i] > this->max[i] ) this->max[i] = p[i];
+      }
+    }
+
+    void extend( const BoundingBox& b )
+    {
+      if( b.is_empty() ) return;
+
+      this->extend( b.min );
+      this->extend( b.max );
+    }
+
+    void get_center( float out[] ) const
+    {
+      for( int i = 0; i < 3; i++ )
+        out[i] = ( this->min[i] + this->max[i] ) * 0.5f;
+    }
+
+    void get_extents( float out[] ) const
+    {
+      for( int i = 0; i < 3; i++ )
+        out[i] = ( this->max[i] - this->min[i] ) * 0.5f;
+    }
+
+    BoundingBox translated( float x, float y, float z ) const
+    {
+      return( BoundingBox( this->min[0] + x, this->min[1] + y, this->min[2] + z,
+                           this->max[0] + x, this->max[1] + y, this->max[2] + z ) );
+    }
+
+    // The box enclosing all eight corners of this one after transformation.
+    BoundingBox transformed( const Matrix& m ) const
+    {
+      BoundingBox b;
+      if( this->is_empty() ) return( b );
+
+      for( int corner = 0; corner < 8; corner++ )
+      {
+        float p[] = {
+          ( corner & 1 ) ? this->max[0] : this->min[0],
+          ( corner & 2 ) ? this->max[1] : this->min[1],
+          ( corner & 4 ) ? this->max[2] : this->min[2]
+        };
+        float q[3];
+
+        m.transform_point( p, q );
+        b.extend( q );
+      }
 
-      this->corners[0] = ;
+      return( b );
     }
   };
 }
 
-#endif*/
\ No newline at end of file
+#endif
\ No newline at end of file
@@ -0,0 +1,217 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <vector>
+#include <cmath>
+
+#if defined( __SSE__ ) || defined( _M_X64 )
+#include <xmmintrin.h>
+#define FRUSTUM_USE_SSE
+#endif
+
+#include "Graphics.Matrix.h"
+#include "Graphics.BoundingBox.h"
+
+namespace Graphics
+{
+  // The six clipping planes of a view volume, each stored as (a, b, c, d)
+  // with the normal pointing inwards, so a point p is inside a plane when
+  // a*p.x + b*p.y + c*p.z + d >= 0.
+  class Frustum
+  {
+  public:
+    float planes[6][4];
+
+    Frustum()
+    {
+      for( int i = 0; i < 6; i++ )
+        for( int j = 0; j < 4; j++ )
+          this->planes[i][j] = ( j == 3 ) ? 1.0f : 0.0f;
+    }
+
+    // Extracts the planes from projection * modelview, which puts them in
+    // the modelling space the modelview was set up for.
+    Frustum( const Matrix& projection, const Matrix& modelview )
+    {
+      Matrix clip = projection * modelview;
+      const float* m = clip.m;
+
+      for( int i = 0; i < 3; i++ )
+      {
+        for( int j = 0; j < 4; j++ )
+        {
+          this->planes[i*2][j]   = m[j*4+3] + m[j*4+i];
+          this->planes[i*2+1][j] = m[j*4+3] - m[j*4+i];
+        }
+      }
+
+      for( int i = 0; i < 6; i++ )
+      {
+        float length = sqrtf( this->planes[i][0] * this->planes[i][0] +
+                              this->planes[i][1] * this->planes[i][1] +
+                              this->planes[i][2] * this->planes[i][2] );
+        if( length > 0.0f )
+          for( int j = 0; j < 4; j++ )
+            this->planes[i][j] /= length;
+      }
+    }
+  };
+
+  // Culls a batch of bounding boxes against a frustum in one pass.  Boxes
+  // are kept as separate center and extent arrays so that four of them are
+  // tested against a plane at a time (with SSE, when it is available).
+  class FrustumCuller
+  {
+  public:
+    FrustumCuller()
+    {
+      this->visible_count = 0;
+      this->culled_count  = 0;
+    }
+
+    void clear()
+    {
+      for( int i = 0; i < 3; i++ )
+      {
+        this->center[i].clear();
+        this->extent[i].clear();
+      }
+      this->visible.clear();
+    }
+
+    // Adds a box to the batch, returning its index.
+    int add( const BoundingBox& box )
+    {
+      float c[3], e[3];
+      box.get_center( c );
+      box.get_extents( e );
+
+      for( int i = 0; i < 3; i++ )
+      {
+        this->center[i].push_back( c[i] );
+        this->extent[i].push_back( e[i] );
+      }
+      this->visible.push_back( 1 );
+
+      return( int( this->visible.size() ) - 1 );
+    }
+
+    int size()
+    {
+      return( int( this->visible.size() ) );
+    }
+
+    // Tests every box added since the last clear.  A box is culled when it
+    // lies entirely on the outside of any one plane.
+    void cull( const Frustum& frustum )
+    {
+      int n = this->size();
+      if( n == 0 ) return;
+
+      // Pad to a multiple of four with boxes that are never culled.
+      int padded = ( n + 3 ) & ~3;
+      for( int i = 0; i < 3; i++ )
+      {
+        this->center[i].resize( padded, 0.0f );
+        this->extent[i].resize( padded, 1.0e30f );
+      }
+      this->visible.resize( padded );
+
+      this->cull_batch( frustum, padded );
+
+      for( int i = 0; i < 3; i++ )
+      {
+        this->center[i].resize( n );
+        this->extent[i].resize( n );
+      }
+      this->visible.resize( n );
+
+      int count = 0;
+      for( int i = 0; i < n; i++ )
+        count += this->visible[i];
+
+      this->visible_count += count;
+      this->culled_count  += n - count;
+    }
+
+    bool is_visible( int index )
+    {
+      return( this->visible[index] != 0 );
+    }
+
+    // Totals over every cull since the counters were last reset.
+    int  get_visible_count() { return( this->visible_count ); }
+    int  get_culled_count()  { return( this->culled_count ); }
+    void reset_counters()    { this->visible_count = this->culled_count = 0; }
+
+  private:
+    std::vector<float>         center[3];
+    std::vector<float>         extent[3];
+    std::vector<unsigned char> visible;
+    int                        visible_count;
+    int                        culled_count;
+
+#ifdef FRUSTUM_USE_SSE
+    void cull_batch( const Frustum& frustum, int n )
+    {
+      const __m128 sign_mask = _mm_set1_ps( -0.0f );
+
+      for( int i = 0; i < n; i += 4 )
+      {
+        __m128 cx = _mm_loadu_ps( &this->center[0][i] );
+        __m128 cy = _mm_loadu_ps( &this->center[1][i] );
+        __m128 cz = _mm_loadu_ps( &this->center[2][i] );
+        __m128 ex = _mm_loadu_ps( &this->extent[0][i] );
+        __m128 ey = _mm_loadu_ps( &this->extent[1][i] );
+        __m128 ez = _mm_loadu_ps( &this->extent[2][i] );
+
+        __m128 outside = _mm_setzero_ps();
+
+        for( int p = 0; p < 6; p++ )
+        {
+          const float* plane = frustum.planes[p];
+          __m128 a = _mm_set1_ps( plane[0] );
+          __m128 b = _mm_set1_ps( plane[1] );
+          __m128 c = _mm_set1_ps( plane[2] );
+
+          __m128 distance = _mm_add_ps( _mm_add_ps( _mm_mul_ps( a, cx ), _mm_mul_ps( b, cy ) ),
+                                        _mm_add_ps( _mm_mul_ps( c, cz ), _mm_set1_ps( plane[3] ) ) );
+          __m128 radius   = _mm_add_ps( _mm_add_ps( _mm_mul_ps( _mm_andnot_ps( sign_mask, a ), ex ),
+                                                    _mm_mul_ps( _mm_andnot_ps( sign_mask, b ), ey ) ),
+                                        _mm_mul_ps( _mm_andnot_ps( sign_mask, c ), ez ) );
+
+          outside = _mm_or_ps( outside, _mm_cmplt_ps( _mm_add_ps( distance, radius ), _mm_setzero_ps() ) );
+        }
+
+        int mask = _mm_movemask_ps( outside );
+        for( int k = 0; k < 4; k++ )
+          this->visible[i+k] = ( mask & ( 1 << k ) ) ? 0 : 1;
+      }
+    }
+#else
+    void cull_batch( const Frustum& frustum, int n )
+    {
+      for( int i = 0; i < n; i++ )
+        this->visible[i] = 1;
+
+      for( int p = 0; p < 6; p++ )
+      {
+        const float* plane = frustum.planes[p];
+        float a = fabsf( plane[0] ), b = fabsf( plane[1] ), c = fabsf( plane[2] );
+
+        for( int i = 0; i < n; i++ )
+        {
+          float distance = plane[0] * this->center[0][i] + plane[1] * this->center[1][i] +
+                           plane[2] * this->center[2][i] + plane[3];
+          float radius   = a * this->extent[0][i] + b * this->extent[1][i] + c * this->extent[2][i];
+
+          if( distance + radius < 0.0f )
+            this->visible[i] = 0;
+        }
+      }
+    }
+#endif
+  };
+}
+
+#endif
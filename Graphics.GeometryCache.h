@@ -0,0 +1,73 @@
+#ifndef GEOMETRY_CACHE_H
+#define GEOMETRY_CACHE_H
+
+#include <vector>
+
+#include "Graphics.RenderDevice.h"
+
+namespace Graphics
+{
+  // Retained-mode storage for geometry that does not change from frame to
+  // frame.  Each slot is compiled once into a display list (which the driver
+  // keeps as its own vertex/index buffers) and is then replayed with a single
+  // call until the slot is invalidated.
+  class GeometryCache
+  {
+  public:
+    GeometryCache( int count )
+    {
+      this->lists      = 0;
+      this->count      = count;
+      this->bake_count = 0;
+      this->baked.resize( count, false );
+    }
+
+    bool is_baked( int i )
+    {
+      return( this->baked[i] );
+    }
+
+    // Everything drawn between begin_bake() and end_bake() is compiled into
+    // slot i instead of being rendered.
+    void begin_bake( int i )
+    {
+      if( this->lists == 0 )
+        this->lists = render_device().gen_lists( this->count );
+
+      render_device().new_list( this->lists + i, GL_COMPILE );
+    }
+
+    void end_bake( int i )
+    {
+      render_device().end_list();
+
+      this->baked[i] = true;
+      this->bake_count++;
+    }
+
+    void draw( int i )
+    {
+      render_device().call_list( this->lists + i );
+    }
+
+    void invalidate()
+    {
+      for( int i = 0; i < this->count; i++ )
+        this->baked[i] = false;
+    }
+
+    // Number of slots compiled since startup (for diagnostics).
+    int get_bake_count()
+    {
+      return( this->bake_count );
+    }
+
+  private:
+    GLuint            lists;
+    int               count;
+    int               bake_count;
+    std::vector<bool> baked;
+  };
+}
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef INSTANCING_H
+#define INSTANCING_H
+
+#include <vector>
+
+#include "Graphics.BoundingBox.h"
+#include "Graphics.RenderDevice.h"
+
+namespace Graphics
+{
+  // A set of axis-aligned unit cubes that share a material but each have
+  // their own translation, scale and color.  The per-instance array is
+  // expanded against a single cube template and drawn with one call,
+  // with the instance color driving the ambient and diffuse reflectance
+  // (which leaves those two properties of the GL material changed).
+  class CubeInstances
+  {
+  public:
+    CubeInstances() {}
+
+    void clear()
+    {
+      this->instances.clear();
+    }
+
+    void add( const float translation[], const float scale[], const float color[] )
+    {
+      for( int i = 0; i < 3; i++ ) this->instances.push_back( translation[i] );
+      for( int i = 0; i < 3; i++ ) this->instances.push_back( scale[i] );
+      for( int i = 0; i < 3; i++ ) this->instances.push_back( color[i] );
+    }
+
+    int size()
+    {
+      return( int( this->instances.size() / FLOATS_PER_INSTANCE ) );
+    }
+
+    BoundingBox get_bounds() const
+    {
+      BoundingBox b;
+
+      for( size_t i = 0; i < this->instances.size(); i += FLOATS_PER_INSTANCE )
+        b.extend( BoundingBox( &this->instances[i], this->instances[i+3],
+                               this->instances[i+4], this->instances[i+5] ) );
+
+      return( b );
+    }
+
+    // Draws every instance with one call.  The specular, emissive and
+    // shininess properties are taken from the current material.
+    void draw()
+    {
+      int count = this->size();
+      if( count == 0 ) return;
+
+      this->expand();
+
+      RenderDevice& device = render_device();
+
+      device.color_material( GL_FRONT, GL_AMBIENT_AND_DIFFUSE );
+      device.enable( GL_COLOR_MATERIAL );
+
+      device.draw_arrays( GL_QUADS, count * VERTICES_PER_CUBE,
+                          &this->vertices[0], &this->normals[0], &this->colors[0] );
+
+      device.disable( GL_COLOR_MATERIAL );
+    }
+
+    // Corners and normals of a unit cube centered on the origin, as six
+    // counter-clockwise quads (matching glutSolidCube's winding).
+    static void cube_template( float corners[][3], float face_normals[][3] )
+    {
+      int v = 0;
+      for( int axis = 0; axis < 3; axis++ )
+      {
+        int u = ( axis + 1 ) % 3;
+        int w = ( axis + 2 ) % 3;
+
+        for( int sign = 1; sign >= -1; sign -= 2 )
+        {
+          float su[] = { -0.5f,  0.5f, 0.5f, -0.5f };
+          float sw[] = { -0.5f, -0.5f, 0.5f,  0.5f };
+
+          for( int k = 0; k < 4; k++, v++ )
+          {
+            int c = ( sign > 0 ) ? k : 3 - k;
+
+            corners[v][axis] = 0.5f * sign;
+            corners[v][u]    = su[c];
+            corners[v][w]    = sw[c];
+
+            face_normals[v][axis] = float( sign );
+            face_normals[v][u]    = 0.0f;
+            face_normals[v][w]    = 0.0f;
+          }
+        }
+      }
+    }
+
+  private:
+    enum
+    {
+      FLOATS_PER_INSTANCE = 9,
+      VERTICES_PER_CUBE   = 24
+    };
+
+    std::vector<float> instances;
+    std::vector<float> vertices;
+    std::vector<float> normals;
+    std::vector<float> colors;
+
+    void expand()
+    {
+      static float corners[VERTICES_PER_CUBE][3];
+      static float face_normals[VERTICES_PER_CUBE][3];
+      static bool  is_built = false;
+
+      if( !is_built )
+      {
+        cube_template( corners, face_normals );
+        is_built = true;
+      }
+
+      int count = this->size();
+      this->vertices.resize( count * VERTICES_PER_CUBE * 3 );
+      this->normals.resize( count * VERTICES_PER_CUBE * 3 );
+      this->colors.resize( count * VERTICES_PER_CUBE * 3 );
+
+      float* out_v = &this->vertices[0];
+      float* out_n = &this->normals[0];
+      float* out_c = &this->colors[0];
+
+      for( int i = 0; i < count; i++ )
+      {
+        const float* translation = &this->instances[i * FLOATS_PER_INSTANCE];
+        const float* scale       = translation + 3;
+        const float* color       = translation + 6;
+
+        for( int k = 0; k < VERTICES_PER_CUBE; k++ )
+        {
+          for( int j = 0; j < 3; j++ )
+          {
+            *out_v++ = translation[j] + scale[j] * corners[k][j];
+            *out_n++ = face_normals[k][j];
+            *out_c++ = color[j];
+          }
+        }
+      }
+    }
+  };
+}
+
+#endif
@@ -2,6 +2,8 @@
 #ifndef MATERIAL_H
 #define MATERIAL_H
 
+#include "Graphics.RenderDevice.h"
+
 namespace Graphics
 {
   template<typename T = float>
@@ -15,6 +17,9 @@ namespace Graphics
 
     ~Material()
     {
+      if( applied() == this )
+        forget_applied();
+
       if( this->ambient != NULL )
         garbage_collect_array( this->ambient );
       
@@ -30,18 +35,30 @@ namespace Graphics
 
     void apply()
     {
+      // Already loaded into GL, nothing to change
+      if( applied() == this )
+        return;
+
       if( this->ambient != NULL )
-        glMaterialfv( GL_FRONT, GL_AMBIENT, this->ambient );
+        render_device().material( GL_FRONT, GL_AMBIENT, this->ambient );
       
       if( this->diffuse != NULL )
-        glMaterialfv( GL_FRONT, GL_DIFFUSE, this->diffuse );
+        render_device().material( GL_FRONT, GL_DIFFUSE, this->diffuse );
 
       if( this->specular != NULL )
-        glMaterialfv( GL_FRONT, GL_SPECULAR, this->specular );
+        render_device().material( GL_FRONT, GL_SPECULAR, this->specular );
 
       if( this->shininess != NULL )
-        glMaterialfv( GL_FRONT, GL_SHININESS, this->shininess );
+        render_device().material( GL_FRONT, GL_SHININESS, this->shininess );
 
+      applied() = this;
+    }
+
+    // Must be called by anything that changes the GL material without
+    // going through apply(), so that the next apply() takes effect.
+    static void forget_applied()
+    {
+      applied() = NULL;
     }
 
     void set_ambient( const T a[], int n = 4 )
@@ -69,6 +86,8 @@ namespace Graphics
 
     void set_ambient( T a1, T a2, T a3, T a4 )
     {
+      this->changed();
+
       if( this->ambient != NULL )
         garbage_collect_array( this->ambient );
 
@@ -81,6 +100,8 @@ namespace Graphics
 
     void set_diffuse( T d1, T d2, T d3, T d4 )
     {
+      this->changed();
+
       if( this->diffuse != NULL )
         garbage_collect_array( this->diffuse );
 
@@ -93,6 +114,8 @@ namespace Graphics
 
     void set_specular( T s1, T s2, T s3, T s4 )
     {
+      this->changed();
+
       if( this->specular != NULL )
         garbage_collect_array( this->specular );
 
@@ -106,6 +129,8 @@ namespace Graphics
 
     void set_shininess( T s1 )
     {
+      this->changed();
+
       if( this->shininess != NULL )
         garbage_collect_array( this->shininess );
 
@@ -121,8 +146,23 @@ namespace Graphics
     T* specular;
     T* shininess;
 
+    // The material most recently loaded into GL by apply()
+    static Material*& applied()
+    {
+      static Material* m = NULL;
+      return( m );
+    }
+
+    void changed()
+    {
+      if( applied() == this )
+        forget_applied();
+    }
+
     void set_property( T*& prop, const T a[], int n )
     {
+      this->changed();
+
       if( prop != NULL )
         garbage_collect_array( prop );
 
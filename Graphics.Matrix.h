@@ -0,0 +1,178 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <cmath>
+#include <vector>
+
+namespace Graphics
+{
+  // 4x4 column-major matrix, laid out the way glLoadMatrixf/glMultMatrixf
+  // expect.  The transform functions post-multiply, exactly like their
+  // glTranslatef/glScalef/glRotatef counterparts.
+  class Matrix
+  {
+  public:
+    float m[16];
+
+    Matrix()
+    {
+      this->load_identity();
+    }
+
+    void load_identity()
+    {
+      for( int i = 0; i < 16; i++ )
+        this->m[i] = ( i % 5 == 0 ) ? 1.0f : 0.0f;
+    }
+
+    Matrix operator*( const Matrix& b ) const
+    {
+      Matrix r;
+      for( int col = 0; col < 4; col++ )
+        for( int row = 0; row < 4; row++ )
+          r.m[col*4+row] = this->m[0*4+row] * b.m[col*4+0] +
+                           this->m[1*4+row] * b.m[col*4+1] +
+                           this->m[2*4+row] * b.m[col*4+2] +
+                           this->m[3*4+row] * b.m[col*4+3];
+      return( r );
+    }
+
+    void translate( float x, float y, float z )
+    {
+      for( int row = 0; row < 4; row++ )
+        this->m[12+row] += this->m[row] * x + this->m[4+row] * y + this->m[8+row] * z;
+    }
+
+    void scale( float x, float y, float z )
+    {
+      for( int row = 0; row < 4; row++ )
+      {
+        this->m[row]   *= x;
+        this->m[4+row] *= y;
+        this->m[8+row] *= z;
+      }
+    }
+
+    // Rotation by angle (in degrees) about the axis (x, y, z).
+    void rotate( float angle, float x, float y, float z )
+    {
+      float length = sqrtf( x*x + y*y + z*z );
+      if( length == 0.0f ) return;
+      x /= length; y /= length; z /= length;
+
+      float radians = angle * 0.0174532925f;
+      float c = cosf( radians ), s = sinf( radians ), t = 1.0f - c;
+
+      Matrix r;
+      r.m[0] = t*x*x + c;   r.m[4] = t*x*y - s*z; r.m[8]  = t*x*z + s*y;
+      r.m[1] = t*x*y + s*z; r.m[5] = t*y*y + c;   r.m[9]  = t*y*z - s*x;
+      r.m[2] = t*x*z - s*y; r.m[6] = t*y*z + s*x; r.m[10] = t*z*z + c;
+
+      *this = (*this) * r;
+    }
+
+    // The projection set up by gluPerspective (fovy in degrees).
+    void perspective( float fovy, float aspect, float near_z, float far_z )
+    {
+      float f = 1.0f / tanf( fovy * 0.5f * 0.0174532925f );
+
+      Matrix p;
+      p.m[0]  = f / aspect;
+      p.m[5]  = f;
+      p.m[10] = ( far_z + near_z ) / ( near_z - far_z );
+      p.m[11] = -1.0f;
+      p.m[14] = 2.0f * far_z * near_z / ( near_z - far_z );
+      p.m[15] = 0.0f;
+
+      *this = (*this) * p;
+    }
+
+    // The projection set up by glOrtho.
+    void ortho( float left, float right, float bottom, float top, float near_z, float far_z )
+    {
+      Matrix o;
+      o.m[0]  =  2.0f / ( right - left );
+      o.m[5]  =  2.0f / ( top - bottom );
+      o.m[10] = -2.0f / ( far_z - near_z );
+      o.m[12] = -( right + left ) / ( right - left );
+      o.m[13] = -( top + bottom ) / ( top - bottom );
+      o.m[14] = -( far_z + near_z ) / ( far_z - near_z );
+
+      *this = (*this) * o;
+    }
+
+    // The viewing transform set up by gluLookAt.
+    void look_at( float eye_x, float eye_y, float eye_z,
+                  float center_x, float center_y, float center_z,
+                  float up_x, float up_y, float up_z )
+    {
+      float f[] = { center_x - eye_x, center_y - eye_y, center_z - eye_z };
+      normalize( f );
+
+      float s[] = { f[1] * up_z - f[2] * up_y, f[2] * up_x - f[0] * up_z, f[0] * up_y - f[1] * up_x };
+      normalize( s );
+
+      float u[] = { s[1] * f[2] - s[2] * f[1], s[2] * f[0] - s[0] * f[2], s[0] * f[1] - s[1] * f[0] };
+
+      Matrix v;
+      v.m[0] =  s[0]; v.m[4] =  s[1]; v.m[8]  =  s[2];
+      v.m[1] =  u[0]; v.m[5] =  u[1]; v.m[9]  =  u[2];
+      v.m[2] = -f[0]; v.m[6] = -f[1]; v.m[10] = -f[2];
+
+      *this = (*this) * v;
+      this->translate( -eye_x, -eye_y, -eye_z );
+    }
+
+    // Applies the matrix to the point (x, y, z).
+    void transform_point( const float p[], float out[] ) const
+    {
+      for( int row = 0; row < 3; row++ )
+        out[row] = this->m[row] * p[0] + this->m[4+row] * p[1] + this->m[8+row] * p[2] + this->m[12+row];
+    }
+
+  private:
+    static void normalize( float v[] )
+    {
+      float length = sqrtf( v[0]*v[0] + v[1]*v[1] + v[2]*v[2] );
+      if( length == 0.0f ) return;
+
+      v[0] /= length; v[1] /= length; v[2] /= length;
+    }
+  };
+
+  // CPU-side counterpart of the GL modelview stack.
+  class MatrixStack
+  {
+  public:
+    MatrixStack()
+    {
+      this->stack.push_back( Matrix() );
+    }
+
+    void push()
+    {
+      this->stack.push_back( this->stack.back() );
+    }
+
+    void pop()
+    {
+      if( this->stack.size() > 1 )
+        this->stack.pop_back();
+    }
+
+    Matrix& top()
+    {
+      return( this->stack.back() );
+    }
+
+    void load_identity()                                { this->top().load_identity(); }
+    void translate( float x, float y, float z )         { this->top().translate( x, y, z ); }
+    void scale( float x, float y, float z )             { this->top().scale( x, y, z ); }
+    void rotate( float angle, float x, float y, float z ) { this->top().rotate( angle, x, y, z ); }
+
+  private:
+    std::vector<Matrix> stack;
+  };
+}
+
+#endif
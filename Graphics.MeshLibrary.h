@@ -0,0 +1,284 @@
+#ifndef MESH_LIBRARY_H
+#define MESH_LIBRARY_H
+
+#include <vector>
+#include <map>
+#include <cmath>
+
+#include "Graphics.Matrix.h"
+#include "Graphics.RenderDevice.h"
+#include "Graphics.Instancing.h"
+
+namespace Graphics
+{
+  // A triangle mesh with interleaved positions and normals, uploaded once
+  // into a vertex buffer object.
+  class Mesh
+  {
+  public:
+    Mesh()
+    {
+      this->buffer       = 0;
+      this->vertex_count = 0;
+    }
+
+    void build( const std::vector<float>& vertices )
+    {
+      this->vertex_count = int( vertices.size() / FLOATS_PER_VERTEX );
+      this->buffer       = render_device().create_buffer( &vertices[0], vertices.size() * sizeof( float ) );
+    }
+
+    bool is_built()
+    {
+      return( this->buffer != 0 );
+    }
+
+    int get_triangle_count()
+    {
+      return( this->vertex_count / 3 );
+    }
+
+    // Draws the mesh in the current modelview space.
+    void draw()
+    {
+      render_device().draw_buffer( this->buffer, GL_TRIANGLES, this->vertex_count );
+    }
+
+    // Draws the mesh with a model matrix applied on top of the modelview.
+    void draw( const Matrix& model )
+    {
+      RenderDevice& device = render_device();
+
+      device.push_matrix();
+        device.mult_matrix( model );
+        this->draw();
+      device.pop_matrix();
+    }
+
+    // Draws the mesh once at each of count model matrices, with one call.
+    void draw( const Matrix models[], int count )
+    {
+      render_device().draw_buffer_instanced( this->buffer, GL_TRIANGLES, this->vertex_count, models[0].m, count );
+    }
+
+    enum
+    {
+      FLOATS_PER_VERTEX = 6
+    };
+
+  private:
+    GLuint buffer;
+    int    vertex_count;
+  };
+
+  // One mesh at many model matrices, drawn with one instanced call
+  // whatever their number.  The matrices are kept between frames, so
+  // once reserved nothing is allocated.
+  class MeshInstances
+  {
+  public:
+    void clear()
+    {
+      this->models.clear();
+    }
+
+    void reserve( int count )
+    {
+      this->models.reserve( count );
+    }
+
+    void add( const Matrix& model )
+    {
+      this->models.push_back( model );
+    }
+
+    int size()
+    {
+      return( int( this->models.size() ) );
+    }
+
+    // Draws every instance of the mesh, returning the number of calls.
+    int draw( Mesh& mesh )
+    {
+      if( this->models.empty() ) return( 0 );
+
+      mesh.draw( &this->models[0], this->size() );
+      return( 1 );
+    }
+
+  private:
+    std::vector<Matrix> models;
+  };
+
+  // Unit spheres, cones and cubes, generated once per (slices, stacks)
+  // and drawn in place of glutSolidSphere, glutSolidCone and
+  // glutSolidCube.  Sizes are applied as a scale in the model matrix, so
+  // the meshes are drawn in whatever space the modelview (and any
+  // glTranslatefv/glScalefv before them) has set up.
+  class MeshLibrary
+  {
+  public:
+    // Radius 1, centered on the origin, with its poles on the z axis.
+    Mesh& sphere( int slices, int stacks )
+    {
+      Mesh& mesh = this->spheres[Key( slices, stacks )];
+      if( !mesh.is_built() )
+        mesh.build( MeshLibrary::generate_sphere( slices, stacks ) );
+
+      return( mesh );
+    }
+
+    // Base radius 1 on the z = 0 plane, apex at z = 1.
+    Mesh& cone( int slices, int stacks )
+    {
+      Mesh& mesh = this->cones[Key( slices, stacks )];
+      if( !mesh.is_built() )
+        mesh.build( MeshLibrary::generate_cone( slices, stacks ) );
+
+      return( mesh );
+    }
+
+    // Edge length 1, centered on the origin.
+    Mesh& cube()
+    {
+      if( !this->unit_cube.is_built() )
+        this->unit_cube.build( MeshLibrary::generate_cube() );
+
+      return( this->unit_cube );
+    }
+
+    void draw_sphere( float radius, int slices, int stacks )
+    {
+      Matrix model;
+      model.scale( radius, radius, radius );
+      this->sphere( slices, stacks ).draw( model );
+    }
+
+    void draw_cone( float base, float height, int slices, int stacks )
+    {
+      Matrix model;
+      model.scale( base, base, height );
+      this->cone( slices, stacks ).draw( model );
+    }
+
+    void draw_cube( float size )
+    {
+      Matrix model;
+      model.scale( size, size, size );
+      this->cube().draw( model );
+    }
+
+  private:
+    typedef std::pair<int, int> Key;
+
+    std::map<Key, Mesh> spheres;
+    std::map<Key, Mesh> cones;
+    Mesh                unit_cube;
+
+    static void add_vertex( std::vector<float>& v, const float p[], const float n[] )
+    {
+      v.push_back( p[0] ); v.push_back( p[1] ); v.push_back( p[2] );
+      v.push_back( n[0] ); v.push_back( n[1] ); v.push_back( n[2] );
+    }
+
+    static void add_triangle( std::vector<float>& v, const float a[], const float b[], const float c[],
+                              const float na[], const float nb[], const float nc[] )
+    {
+      add_vertex( v, a, na );
+      add_vertex( v, b, nb );
+      add_vertex( v, c, nc );
+    }
+
+    static std::vector<float> generate_sphere( int slices, int stacks )
+    {
+      std::vector<float> v;
+      const float pi = 3.14159265f;
+
+      for( int i = 0; i < stacks; i++ )
+      {
+        float phi0 = pi * i / stacks, phi1 = pi * ( i + 1 ) / stacks;
+
+        for( int j = 0; j < slices; j++ )
+        {
+          float theta0 = 2.0f * pi * j / slices, theta1 = 2.0f * pi * ( j + 1 ) / slices;
+
+          float a[] = { cosf( theta0 ) * sinf( phi0 ), sinf( theta0 ) * sinf( phi0 ), cosf( phi0 ) };
+          float b[] = { cosf( theta0 ) * sinf( phi1 ), sinf( theta0 ) * sinf( phi1 ), cosf( phi1 ) };
+          float c[] = { cosf( theta1 ) * sinf( phi1 ), sinf( theta1 ) * sinf( phi1 ), cosf( phi1 ) };
+          float d[] = { cosf( theta1 ) * sinf( phi0 ), sinf( theta1 ) * sinf( phi0 ), cosf( phi0 ) };
+
+          // On a unit sphere the normals are the positions; the quads at
+          // the poles collapse into single triangles.
+          if( i < stacks - 1 ) add_triangle( v, a, b, c, a, b, c );
+          if( i > 0 )          add_triangle( v, a, c, d, a, c, d );
+        }
+      }
+
+      return( v );
+    }
+
+    static std::vector<float> generate_cone( int slices, int stacks )
+    {
+      std::vector<float> v;
+      const float pi    = 3.14159265f;
+      const float slant = 1.0f / sqrtf( 2.0f );
+
+      for( int j = 0; j < slices; j++ )
+      {
+        float theta0 = 2.0f * pi * j / slices, theta1 = 2.0f * pi * ( j + 1 ) / slices;
+
+        float n0[] = { cosf( theta0 ) * slant, sinf( theta0 ) * slant, slant };
+        float n1[] = { cosf( theta1 ) * slant, sinf( theta1 ) * slant, slant };
+
+        for( int k = 0; k < stacks; k++ )
+        {
+          float z0 = float( k ) / stacks,  r0 = 1.0f - z0;
+          float z1 = float( k + 1 ) / stacks, r1 = 1.0f - z1;
+
+          float a[] = { r0 * cosf( theta0 ), r0 * sinf( theta0 ), z0 };
+          float b[] = { r0 * cosf( theta1 ), r0 * sinf( theta1 ), z0 };
+          float c[] = { r1 * cosf( theta1 ), r1 * sinf( theta1 ), z1 };
+          float d[] = { r1 * cosf( theta0 ), r1 * sinf( theta0 ), z1 };
+
+          add_triangle( v, a, b, c, n0, n1, n1 );
+          if( k < stacks - 1 ) add_triangle( v, a, c, d, n0, n1, n0 );
+        }
+
+        // The base, facing down the z axis.
+        float center[] = { 0.0f, 0.0f, 0.0f };
+        float down[]   = { 0.0f, 0.0f, -1.0f };
+        float p0[]     = { cosf( theta0 ), sinf( theta0 ), 0.0f };
+        float p1[]     = { cosf( theta1 ), sinf( theta1 ), 0.0f };
+
+        add_triangle( v, center, p1, p0, down, down, down );
+      }
+
+      return( v );
+    }
+
+    static std::vector<float> generate_cube()
+    {
+      std::vector<float> v;
+      float corners[24][3], normals[24][3];
+
+      CubeInstances::cube_template( corners, normals );
+
+      for( int q = 0; q < 24; q += 4 )
+      {
+        add_triangle( v, corners[q], corners[q+1], corners[q+2], normals[q], normals[q+1], normals[q+2] );
+        add_triangle( v, corners[q], corners[q+2], corners[q+3], normals[q], normals[q+2], normals[q+3] );
+      }
+
+      return( v );
+    }
+  };
+
+  // The library shared by every draw routine.
+  MeshLibrary& mesh_library()
+  {
+    static MeshLibrary library;
+    return( library );
+  }
+}
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef PARTICLE_SYSTEM_H
+#define PARTICLE_SYSTEM_H
+
+#include <vector>
+
+#include "Graphics.Range.h"
+#include "Graphics.Random.h"
+
+namespace Graphics
+{
+  // Where a burst of particles starts and how it flies apart.  Particles
+  // start anywhere in the box of half-size spread around position, with a
+  // velocity anywhere in the box of half-size velocity_spread around
+  // velocity, and live for a time in lifetime (in seconds).
+  struct ParticleEmitter
+  {
+    float    position[3];
+    float    spread[3];
+    float    velocity[3];
+    float    velocity_spread[3];
+    Range<>  lifetime;
+
+    ParticleEmitter()
+    {
+      for( int i = 0; i < 3; i++ )
+        this->position[i] = this->spread[i] = this->velocity[i] = this->velocity_spread[i] = 0.0f;
+
+      this->lifetime = Range<>( 1.0f, 1.0f );
+    }
+  };
+
+  // A fixed number of particle slots, allocated once.  Slots of particles
+  // that have died go on a free list and are handed out again by emit(),
+  // so no memory is allocated once the system is built; emitting when
+  // every slot is taken emits fewer particles instead.  The state is kept
+  // as separate arrays, so update() is one pass of plain arithmetic over
+  // the slots in use.
+  class ParticleSystem
+  {
+  public:
+    // Every particle is pulled by gravity (in units per second squared).
+    ParticleSystem( int capacity, const float gravity[], unsigned int seed = 0 )
+    {
+      for( int i = 0; i < 3; i++ )
+      {
+        this->gravity[i] = gravity[i];
+        this->position[i].resize( capacity );
+        this->velocity[i].resize( capacity );
+      }
+      this->age.resize( capacity );
+      this->lifetime.resize( capacity );
+      this->alive.resize( capacity );
+
+      // Popped from the back, so the lowest slots are used first and the
+      // slots in use stay packed towards the front.
+      this->free.reserve( capacity );
+      for( int i = capacity - 1; i >= 0; i-- )
+        this->free.push_back( i );
+
+      this->seed       = seed;
+      this->emitted    = 0;
+      this->high_water = 0;
+      this->count      = 0;
+    }
+
+    int get_capacity() { return( int( this->alive.size() ) ); }
+    int size()         { return( this->count ); }
+
+    // Starts count particles from the emitter, returning how many there
+    // was room for.
+    int emit( const ParticleEmitter& emitter, int count )
+    {
+      int n = 0;
+
+      for( ; n < count && !this->free.empty(); n++ )
+      {
+        int i = this->free.back();
+        this->free.pop_back();
+
+        // Every particle ever emitted has its own random values.
+        Random<> r( this->seed, 0, this->emitted++ );
+        for( int axis = 0; axis < 3; axis++ )
+        {
+          this->position[axis][i] = emitter.position[axis] + r.next( axis, -emitter.spread[axis], emitter.spread[axis] );
+          this->velocity[axis][i] = emitter.velocity[axis] + r.next( 3 + axis, -emitter.velocity_spread[axis], emitter.velocity_spread[axis] );
+        }
+        this->age[i]      = 0.0f;
+        this->lifetime[i] = r.next( 6, emitter.lifetime );
+        this->alive[i]    = 1;
+
+        if( i >= this->high_water )
+          this->high_water = i + 1;
+      }
+
+      this->count += n;
+      return( n );
+    }
+
+    // Starts count particles from each of the emitters in turn, returning
+    // how many there was room for altogether.
+    int emit( const ParticleEmitter emitters[], int emitter_count, int count )
+    {
+      int n = 0;
+      for( int e = 0; e < emitter_count; e++ )
+        n += this->emit( emitters[e], count );
+
+      return( n );
+    }
+
+    // Moves every particle on by dt seconds, freeing those that have
+    // outlived their lifetime.
+    void update( float dt )
+    {
+      float* px = &this->position[0][0];
+      float* py = &this->position[1][0];
+      float* pz = &this->position[2][0];
+      float* vx = &this->velocity[0][0];
+      float* vy = &this->velocity[1][0];
+      float* vz = &this->velocity[2][0];
+      float  gx = this->gravity[0] * dt, gy = this->gravity[1] * dt, gz = this->gravity[2] * dt;
+
+      for( int i = 0; i < this->high_water; i++ )
+      {
+        px[i] += vx[i] * dt;  vx[i] += gx;
+        py[i] += vy[i] * dt;  vy[i] += gy;
+        pz[i] += vz[i] * dt;  vz[i] += gz;
+        this->age[i] += dt;
+      }
+
+      // Dead slots are moved along with the rest above (which keeps that
+      // loop free of branches) and are only told apart here.
+      for( int i = 0; i < this->high_water; i++ )
+      {
+        if( this->alive[i] && this->age[i] >= this->lifetime[i] )
+        {
+          this->alive[i] = 0;
+          this->free.push_back( i );
+          this->count--;
+        }
+      }
+
+      while( this->high_water > 0 && !this->alive[this->high_water - 1] )
+        this->high_water--;
+    }
+
+    // Writes the positions of the living particles, dt seconds on from
+    // where they are (dt may be negative), as xyz vertices, returning how
+    // many were written; vertices must have room for size() of them.
+    int get_points( float vertices[], float dt = 0.0f )
+    {
+      int n = 0;
+
+      for( int i = 0; i < this->high_water; i++ )
+      {
+        if( !this->alive[i] ) continue;
+
+        vertices[3*n]   = this->position[0][i] + this->velocity[0][i] * dt;
+        vertices[3*n+1] = this->position[1][i] + this->velocity[1][i] * dt;
+        vertices[3*n+2] = this->position[2][i] + this->velocity[2][i] * dt;
+        n++;
+      }
+
+      return( n );
+    }
+
+  private:
+    float                       gravity[3];
+    std::vector<float>          position[3];
+    std::vector<float>          velocity[3];
+    std::vector<float>          age;
+    std::vector<float>          lifetime;
+    std::vector<unsigned char>  alive;
+    std::vector<int>            free;
+    unsigned int                seed;
+    unsigned int                emitted;
+    int                         high_water;  // One past the last slot in use.
+    int                         count;
+  };
+}
+
+#endif
@@ -0,0 +1,301 @@
+#ifndef PRECIPITATION_H
+#define PRECIPITATION_H
+
+#include <vector>
+#include <cmath>
+
+#if defined( __AVX2__ )
+#include <immintrin.h>
+#define PRECIPITATION_USE_AVX2
+#elif defined( __SSE2__ ) || defined( _M_X64 )
+#include <emmintrin.h>
+#define PRECIPITATION_USE_SSE2
+#endif
+
+#include "Graphics.Matrix.h"
+#include "Graphics.Random.h"
+
+namespace Graphics
+{
+  // The part of the camera's view that precipitation falls through: the
+  // slab of the view frustum from near to far along the view direction.
+  struct PrecipitationVolume
+  {
+    float eye[3];
+    float right[3];
+    float up[3];
+    float forward[3];
+    float near_z;
+    float far_z;
+    float tan_x;  // Half the width of the slab per unit of depth.
+    float tan_y;  // Half the height of the slab per unit of depth.
+
+    // From a rigid modelview (the camera's look_at) and the perspective
+    // it is seen through.
+    PrecipitationVolume( const Matrix& modelview, float fovy, float aspect, float near_z, float far_z )
+    {
+      const float* m = modelview.m;
+
+      for( int i = 0; i < 3; i++ )
+      {
+        this->right[i]   =  m[4*i];
+        this->up[i]      =  m[4*i+1];
+        this->forward[i] = -m[4*i+2];
+      }
+
+      for( int i = 0; i < 3; i++ )
+        this->eye[i] = -( this->right[i] * m[12] + this->up[i] * m[13] - this->forward[i] * m[14] );
+
+      this->near_z = near_z;
+      this->far_z  = far_z;
+      this->tan_y  = tanf( fovy * 0.5f * 3.14159265f / 180.0f );
+      this->tan_x  = this->tan_y * aspect;
+    }
+  };
+
+  // A field of snowflakes or raindrops that fills the view.  Every
+  // particle has a fixed random place, hashed from its number once: a
+  // depth fraction between the near and far planes, and a fraction across
+  // the width and height of the frustum at that depth.  Particles are
+  // spread evenly in depth, so the frustum's narrow near end is the
+  // densest, and none of them is ever off screen.
+  //
+  // Each frame the field is moved by a common world-space offset, taken
+  // into the camera's axes.  Across the view the offset is divided by
+  // each particle's depth (so nearer particles drift faster, as they
+  // would), and the result wraps around within the slab.  Places and
+  // positions are kept as separate arrays so that the update runs eight
+  // (with AVX2) or four (with SSE2) particles at a time.  Disjoint ranges
+  // of particles can be updated and written out on different threads, as
+  // long as each range starts on a multiple of eight.
+  class PrecipitationField
+  {
+  public:
+    PrecipitationField()
+    {
+      this->count = 0;
+    }
+
+    // Hashes the places of count particles from the seed.
+    void generate( unsigned int seed, int count )
+    {
+      this->count = count;
+
+      int padded = PrecipitationField::padded_size( count );
+      for( int axis = 0; axis < 3; axis++ )
+      {
+        this->place[axis].resize( padded );
+        this->position[axis].resize( padded );
+        Random<>( seed ).fill( axis, 0.0f, 1.0f, &this->place[axis][0], padded );
+      }
+    }
+
+    int size()
+    {
+      return( this->count );
+    }
+
+    // Puts the n particles from first in the volume, moved by offset.
+    // The shifts across the view are not reduced, so the caller keeps
+    // offset within a few thousand units of zero.
+    void update( int first, int n, const PrecipitationVolume& volume, const float offset[] )
+    {
+      if( first + n > this->count ) n = this->count - first;
+      if( n <= 0 ) return;
+
+      double across = 0.0, upward = 0.0, along = 0.0;
+      for( int i = 0; i < 3; i++ )
+      {
+        across += double( offset[i] ) * volume.right[i];
+        upward += double( offset[i] ) * volume.up[i];
+        along  += double( offset[i] ) * volume.forward[i];
+      }
+
+      // The depth shift is the same for every particle, so it is reduced
+      // to [0, 1) in double precision once; place + shift is then in
+      // [0, 2) and one compare wraps it, however far the offset has run.
+      double depth = along / ( volume.far_z - volume.near_z );
+      depth -= floor( depth );
+
+      Step step;
+      step.depth_shift  = float( depth );
+      step.near_z       = volume.near_z;
+      step.depth_range  = volume.far_z - volume.near_z;
+      step.across_shift = float( across / ( 2.0 * volume.tan_x ) );
+      step.upward_shift = float( upward / ( 2.0 * volume.tan_y ) );
+      step.tan_x        = volume.tan_x;
+      step.tan_y        = volume.tan_y;
+      for( int i = 0; i < 3; i++ )
+      {
+        step.eye[i]     = volume.eye[i];
+        step.right[i]   = volume.right[i];
+        step.up[i]      = volume.up[i];
+        step.forward[i] = volume.forward[i];
+      }
+
+      this->update_range( step, first, PrecipitationField::padded_size( n ) );
+    }
+
+    float* get_positions( int axis )
+    {
+      return( &this->position[axis][0] );
+    }
+
+    // Interleaves the n positions from first into xyz vertices, at the
+    // same place in the vertex array (three floats per particle).
+    void get_points( int first, int n, float vertices[] )
+    {
+      for( int i = first; i < first + n; i++ )
+      {
+        vertices[3*i]   = this->position[0][i];
+        vertices[3*i+1] = this->position[1][i];
+        vertices[3*i+2] = this->position[2][i];
+      }
+    }
+
+    // Interleaves the n positions from first into line segments from each
+    // position to that position plus streak, at the same place in the
+    // vertex array (six floats per particle).
+    void get_lines( int first, int n, const float streak[], float vertices[] )
+    {
+      for( int i = first; i < first + n; i++ )
+      {
+        float x = this->position[0][i], y = this->position[1][i], z = this->position[2][i];
+
+        vertices[6*i]   = x;             vertices[6*i+1] = y;             vertices[6*i+2] = z;
+        vertices[6*i+3] = x + streak[0]; vertices[6*i+4] = y + streak[1]; vertices[6*i+5] = z + streak[2];
+      }
+    }
+
+  private:
+    // What the kernel needs that is the same for every particle.
+    struct Step
+    {
+      float depth_shift;
+      float near_z;
+      float depth_range;
+      float across_shift;  // In frustum widths at unit depth.
+      float upward_shift;  // In frustum heights at unit depth.
+      float tan_x;
+      float tan_y;
+      float eye[3];
+      float right[3];
+      float up[3];
+      float forward[3];
+    };
+
+    int                count;
+    std::vector<float> place[3];
+    std::vector<float> position[3];
+
+    // The arrays are padded to a whole number of vectors.
+    static int padded_size( int n )
+    {
+      return( ( n + 7 ) & ~7 );
+    }
+
+#if defined( PRECIPITATION_USE_AVX2 )
+    void update_range( const Step& s, int first, int n )
+    {
+      const __m256 one   = _mm256_set1_ps( 1.0f );
+      const __m256 two   = _mm256_set1_ps( 2.0f );
+      const __m256 shift = _mm256_set1_ps( s.depth_shift );
+      const __m256 front = _mm256_set1_ps( s.near_z );
+      const __m256 range = _mm256_set1_ps( s.depth_range );
+      const __m256 ax    = _mm256_set1_ps( s.across_shift );
+      const __m256 ay    = _mm256_set1_ps( s.upward_shift );
+      const __m256 tx    = _mm256_set1_ps( s.tan_x );
+      const __m256 ty    = _mm256_set1_ps( s.tan_y );
+
+      for( int i = first; i < first + n; i += 8 )
+      {
+        __m256 t = _mm256_add_ps( _mm256_loadu_ps( &this->place[2][i] ), shift );
+        t = _mm256_sub_ps( t, _mm256_and_ps( _mm256_cmp_ps( t, one, _CMP_GE_OQ ), one ) );
+        __m256 d = _mm256_add_ps( front, _mm256_mul_ps( range, t ) );
+
+        __m256 a = _mm256_add_ps( _mm256_loadu_ps( &this->place[0][i] ), _mm256_div_ps( ax, d ) );
+        __m256 b = _mm256_add_ps( _mm256_loadu_ps( &this->place[1][i] ), _mm256_div_ps( ay, d ) );
+        a = _mm256_sub_ps( a, _mm256_floor_ps( a ) );
+        b = _mm256_sub_ps( b, _mm256_floor_ps( b ) );
+
+        __m256 x = _mm256_mul_ps( _mm256_sub_ps( _mm256_mul_ps( two, a ), one ), _mm256_mul_ps( d, tx ) );
+        __m256 y = _mm256_mul_ps( _mm256_sub_ps( _mm256_mul_ps( two, b ), one ), _mm256_mul_ps( d, ty ) );
+
+        for( int axis = 0; axis < 3; axis++ )
+        {
+          __m256 p = _mm256_add_ps( _mm256_mul_ps( _mm256_set1_ps( s.right[axis] ), x ),
+                                    _mm256_mul_ps( _mm256_set1_ps( s.up[axis] ), y ) );
+          p = _mm256_add_ps( p, _mm256_mul_ps( _mm256_set1_ps( s.forward[axis] ), d ) );
+          _mm256_storeu_ps( &this->position[axis][i], _mm256_add_ps( _mm256_set1_ps( s.eye[axis] ), p ) );
+        }
+      }
+    }
+#elif defined( PRECIPITATION_USE_SSE2 )
+    // SSE2 has no floor, so it is truncation, less one wherever that
+    // rounded a negative value up.
+    static __m128 fraction( __m128 v )
+    {
+      __m128 t = _mm_cvtepi32_ps( _mm_cvttps_epi32( v ) );
+      t = _mm_sub_ps( t, _mm_and_ps( _mm_cmpgt_ps( t, v ), _mm_set1_ps( 1.0f ) ) );
+      return( _mm_sub_ps( v, t ) );
+    }
+
+    void update_range( const Step& s, int first, int n )
+    {
+      const __m128 one   = _mm_set1_ps( 1.0f );
+      const __m128 two   = _mm_set1_ps( 2.0f );
+      const __m128 shift = _mm_set1_ps( s.depth_shift );
+      const __m128 front = _mm_set1_ps( s.near_z );
+      const __m128 range = _mm_set1_ps( s.depth_range );
+      const __m128 ax    = _mm_set1_ps( s.across_shift );
+      const __m128 ay    = _mm_set1_ps( s.upward_shift );
+      const __m128 tx    = _mm_set1_ps( s.tan_x );
+      const __m128 ty    = _mm_set1_ps( s.tan_y );
+
+      for( int i = first; i < first + n; i += 4 )
+      {
+        __m128 t = _mm_add_ps( _mm_loadu_ps( &this->place[2][i] ), shift );
+        t = _mm_sub_ps( t, _mm_and_ps( _mm_cmpge_ps( t, one ), one ) );
+        __m128 d = _mm_add_ps( front, _mm_mul_ps( range, t ) );
+
+        __m128 a = fraction( _mm_add_ps( _mm_loadu_ps( &this->place[0][i] ), _mm_div_ps( ax, d ) ) );
+        __m128 b = fraction( _mm_add_ps( _mm_loadu_ps( &this->place[1][i] ), _mm_div_ps( ay, d ) ) );
+
+        __m128 x = _mm_mul_ps( _mm_sub_ps( _mm_mul_ps( two, a ), one ), _mm_mul_ps( d, tx ) );
+        __m128 y = _mm_mul_ps( _mm_sub_ps( _mm_mul_ps( two, b ), one ), _mm_mul_ps( d, ty ) );
+
+        for( int axis = 0; axis < 3; axis++ )
+        {
+          __m128 p = _mm_add_ps( _mm_mul_ps( _mm_set1_ps( s.right[axis] ), x ),
+                                 _mm_mul_ps( _mm_set1_ps( s.up[axis] ), y ) );
+          p = _mm_add_ps( p, _mm_mul_ps( _mm_set1_ps( s.forward[axis] ), d ) );
+          _mm_storeu_ps( &this->position[axis][i], _mm_add_ps( _mm_set1_ps( s.eye[axis] ), p ) );
+        }
+      }
+    }
+#else
+    void update_range( const Step& s, int first, int n )
+    {
+      for( int i = first; i < first + n; i++ )
+      {
+        float t = this->place[2][i] + s.depth_shift;
+        t -= ( t >= 1.0f ) ? 1.0f : 0.0f;
+        float d = s.near_z + s.depth_range * t;
+
+        float a = this->place[0][i] + s.across_shift / d;
+        float b = this->place[1][i] + s.upward_shift / d;
+        a -= floorf( a );
+        b -= floorf( b );
+
+        float x = ( 2.0f * a - 1.0f ) * d * s.tan_x;
+        float y = ( 2.0f * b - 1.0f ) * d * s.tan_y;
+
+        for( int axis = 0; axis < 3; axis++ )
+          this->position[axis][i] = s.eye[axis] + s.right[axis] * x + s.up[axis] * y + s.forward[axis] * d;
+      }
+    }
+#endif
+  };
+}
+
+#endif
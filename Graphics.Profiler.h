@@ -0,0 +1,194 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+namespace Graphics
+{
+  // Timing statistics of one profiled scope, over its recent samples.
+  struct ScopeStatistics
+  {
+    const char* name;
+    int         depth;
+    long        calls;
+    double      p50_ms;
+    double      p95_ms;
+    double      p99_ms;
+  };
+
+  // Hierarchical scope timer.  Each scope is identified by its name and
+  // the scope it was entered from, so the same function profiled from two
+  // callers shows up twice in the tree.  Every scope keeps a rolling
+  // window of its most recent durations, from which percentiles are read.
+  class Profiler
+  {
+  public:
+    static Profiler& instance()
+    {
+      static Profiler profiler;
+      return( profiler );
+    }
+
+    void begin( const char* name )
+    {
+      int parent = this->stack.empty() ? -1 : this->stack.back().node;
+      int node   = this->find_child( parent, name );
+
+      Frame f;
+      f.node  = node;
+      f.start = std::chrono::steady_clock::now();
+      this->stack.push_back( f );
+    }
+
+    void end()
+    {
+      if( this->stack.empty() ) return;
+
+      Frame f = this->stack.back();
+      this->stack.pop_back();
+
+      std::chrono::duration<float, std::milli> d = std::chrono::steady_clock::now() - f.start;
+      this->nodes[f.node].add_sample( d.count() );
+    }
+
+    // Statistics for every scope seen so far, in depth-first order.
+    void get_statistics( std::vector<ScopeStatistics>& out )
+    {
+      out.clear();
+      for( int i = 0, n = int( this->nodes.size() ); i < n; i++ )
+        if( this->nodes[i].parent == -1 )
+          this->collect( i, 0, out );
+    }
+
+    void dump( std::ostream& out )
+    {
+      std::vector<ScopeStatistics> statistics;
+      this->get_statistics( statistics );
+      if( statistics.empty() ) return;
+
+      out << std::left << std::setw( 40 ) << "scope" << std::right
+          << std::setw( 10 ) << "calls" << std::setw( 10 ) << "p50 ms"
+          << std::setw( 10 ) << "p95 ms" << std::setw( 10 ) << "p99 ms" << std::endl;
+
+      for( int i = 0, n = int( statistics.size() ); i < n; i++ )
+      {
+        ScopeStatistics& s = statistics[i];
+        out << std::left << std::setw( 40 ) << ( std::string( 2 * s.depth, ' ' ) + s.name ) << std::right
+            << std::setw( 10 ) << s.calls << std::fixed << std::setprecision( 4 )
+            << std::setw( 10 ) << s.p50_ms << std::setw( 10 ) << s.p95_ms
+            << std::setw( 10 ) << s.p99_ms << std::endl;
+      }
+    }
+
+    void reset()
+    {
+      this->nodes.clear();
+      this->stack.clear();
+    }
+
+  private:
+    enum
+    {
+      WINDOW = 1024  // Samples kept per scope.
+    };
+
+    struct Node
+    {
+      const char*        name;
+      int                parent;
+      long               calls;
+      std::vector<float> samples;
+
+      void add_sample( float ms )
+      {
+        if( this->samples.size() < WINDOW )
+          this->samples.push_back( ms );
+        else
+          this->samples[this->calls % WINDOW] = ms;
+        this->calls++;
+      }
+    };
+
+    struct Frame
+    {
+      int                                   node;
+      std::chrono::steady_clock::time_point start;
+    };
+
+    std::vector<Node>  nodes;
+    std::vector<Frame> stack;
+
+    Profiler() {}
+
+    // Scope names are string literals, so they are compared by address.
+    int find_child( int parent, const char* name )
+    {
+      for( int i = 0, n = int( this->nodes.size() ); i < n; i++ )
+        if( this->nodes[i].parent == parent && this->nodes[i].name == name )
+          return( i );
+
+      Node node;
+      node.name   = name;
+      node.parent = parent;
+      node.calls  = 0;
+      this->nodes.push_back( node );
+
+      return( int( this->nodes.size() ) - 1 );
+    }
+
+    void collect( int node, int depth, std::vector<ScopeStatistics>& out )
+    {
+      Node& n = this->nodes[node];
+
+      std::vector<float> sorted( n.samples );
+      std::sort( sorted.begin(), sorted.end() );
+
+      ScopeStatistics s;
+      s.name   = n.name;
+      s.depth  = depth;
+      s.calls  = n.calls;
+      s.p50_ms = percentile( sorted, 0.50 );
+      s.p95_ms = percentile( sorted, 0.95 );
+      s.p99_ms = percentile( sorted, 0.99 );
+      out.push_back( s );
+
+      for( int i = 0, count = int( this->nodes.size() ); i < count; i++ )
+        if( this->nodes[i].parent == node )
+          this->collect( i, depth + 1, out );
+    }
+
+    static double percentile( const std::vector<float>& sorted, double p )
+    {
+      if( sorted.empty() ) return( 0.0 );
+
+      size_t i = size_t( p * ( sorted.size() - 1 ) + 0.5 );
+      return( sorted[i] );
+    }
+  };
+
+  // Times the enclosing block as a child of whichever scope is active.
+  class ProfileScope
+  {
+  public:
+    ProfileScope( const char* name ) { Profiler::instance().begin( name ); }
+    ~ProfileScope()                  { Profiler::instance().end(); }
+  };
+}
+
+// PROFILE_SCOPE( "name" ) profiles the rest of the enclosing block when
+// the program is compiled with PROFILING defined, and compiles to nothing
+// otherwise.
+#ifdef PROFILING
+#define PROFILE_SCOPE_JOIN2( a, b ) a##b
+#define PROFILE_SCOPE_JOIN( a, b ) PROFILE_SCOPE_JOIN2( a, b )
+#define PROFILE_SCOPE( name ) Graphics::ProfileScope PROFILE_SCOPE_JOIN( profile_scope_, __LINE__ )( name )
+#else
+#define PROFILE_SCOPE( name )
+#endif
+
+#endif
@@ -1,37 +1,87 @@
 #ifndef RANDOM_H
 #define RANDOM_H
 
-#include <cstdlib>
-
 #include "Graphics.Range.h"
 
 namespace Graphics
 {
+  // Counter-based random numbers.  Every value is a hash of its key (a
+  // seed, a block, an object in the block and an attribute of the object)
+  // instead of the next number of a shared sequence, so a key gives the
+  // same value whatever was generated before it, and on any thread.  The
+  // hash is nothing but 32-bit multiplies, shifts and xors, with no
+  // branches, so loops over consecutive keys vectorize.
+  unsigned int random_mix( unsigned int x )
+  {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+
+    return( x );
+  }
+
+  unsigned int random_hash( unsigned int seed, unsigned int block, unsigned int object, unsigned int attribute )
+  {
+    unsigned int h = random_mix( seed + 0x9e3779b9U );
+    h = random_mix( h ^ block );
+    h = random_mix( h ^ object );
+    h = random_mix( h ^ attribute );
+
+    return( h );
+  }
+
+  // In [0, 1), from the top 24 bits of the hash (all a float can hold).
+  float random_unit( unsigned int seed, unsigned int block, unsigned int object, unsigned int attribute )
+  {
+    return( float( random_hash( seed, block, object, attribute ) >> 8 ) * ( 1.0f / 16777216.0f ) );
+  }
+
+  // The random values of one object, by attribute.
   template< typename T = float >
   class Random
   {
   public:
-    Random(){}
+    Random( unsigned int seed = 0, unsigned int block = 0, unsigned int object = 0 )
+    {
+      this->seed   = seed;
+      this->block  = block;
+      this->object = object;
+    }
 
-    T next()
+    T next( unsigned int attribute )
     {
-      return( rand() );
+      return( T( random_unit( this->seed, this->block, this->object, attribute ) ) );
     }
 
-    T next( T max )
+    T next( unsigned int attribute, T max )
     {
-      return( max * (T(rand()) / RAND_MAX) );
+      return( max * this->next( attribute ) );
     }
 
-    T next( T min, T max )
+    T next( unsigned int attribute, T min, T max )
     {
-      return( min + ((max - min) * (T(rand()) / RAND_MAX)) );
+      return( min + ( max - min ) * this->next( attribute ) );
     }
 
-    T next( Range<T> r )
+    T next( unsigned int attribute, Range<T> r )
     {
-      return( r.min + ((r.max - r.min) * (T(rand()) / RAND_MAX)) );
+      return( this->next( attribute, r.min, r.max ) );
     }
+
+    // One attribute of count consecutive objects, starting with this one,
+    // between min and max.
+    void fill( unsigned int attribute, T min, T max, T out[], int count )
+    {
+      for( int i = 0; i < count; i++ )
+        out[i] = min + ( max - min ) * T( random_unit( this->seed, this->block, this->object + i, attribute ) );
+    }
+
+  private:
+    unsigned int seed;
+    unsigned int block;
+    unsigned int object;
   };
 }
 
@@ -0,0 +1,749 @@
+#ifndef RENDER_DEVICE_H
+#define RENDER_DEVICE_H
+
+#include <vector>
+#include <map>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "Graphics.Matrix.h"
+
+namespace Graphics
+{
+  // Everything the scene draws goes through a render device rather than
+  // calling GL directly.  The base class is the null device: it keeps
+  // CPU copies of the modelview and projection stacks (so that matrices
+  // can be read back without a GL context) and otherwise does nothing.
+  // GLRenderDevice forwards every call to GL; RecordingRenderDevice
+  // captures each frame's command stream.
+  class RenderDevice
+  {
+  public:
+    enum Command
+    {
+      MatrixMode, LoadIdentity, PushMatrix, PopMatrix, Translate, Scale, Rotate,
+      MultMatrix, Perspective, LookAt, Ortho,
+      Enable, Disable, ShadeModel, ClearColor, AlphaFunc, PixelStore,
+      Light, Fog, Viewport, Scissor, Clear,
+      SetMaterial, Color, ColorMaterial,
+      Begin, Vertex, End, RasterPos,
+      GenLists, NewList, EndList, CallList,
+      CreateBuffer, DrawBuffer, ReserveInstances, DrawBufferInstanced, DrawArrays,
+      CreateStreamBuffer, DeleteStreamBuffer, DrawStream, Fence, WaitFence,
+      SwapBuffers, Flush, Finish,
+      COMMAND_COUNT
+    };
+
+    static const char* command_name( Command command )
+    {
+      static const char* names[COMMAND_COUNT] = {
+        "matrix_mode", "load_identity", "push_matrix", "pop_matrix", "translate", "scale", "rotate",
+        "mult_matrix", "perspective", "look_at", "ortho",
+        "enable", "disable", "shade_model", "clear_color", "alpha_func", "pixel_store",
+        "light", "fog", "viewport", "scissor", "clear",
+        "material", "color", "color_material",
+        "begin", "vertex", "end", "raster_pos",
+        "gen_lists", "new_list", "end_list", "call_list",
+        "create_buffer", "draw_buffer", "reserve_instances", "draw_buffer_instanced", "draw_arrays",
+        "create_stream_buffer", "delete_stream_buffer", "draw_stream", "fence", "wait_fence",
+        "swap_buffers", "flush", "finish"
+      };
+      return( names[command] );
+    }
+
+    RenderDevice()
+    {
+      this->current   = &this->modelview;
+      this->next_name = 1;
+    }
+
+    virtual ~RenderDevice() {}
+
+    // The matrix on top of the modelview or projection stack.
+    void get_matrix( GLenum mode, Matrix& out )
+    {
+      out = ( mode == GL_PROJECTION ) ? this->projection.top() : this->modelview.top();
+    }
+
+    virtual void matrix_mode( GLenum mode )
+    {
+      this->current = ( mode == GL_PROJECTION ) ? &this->projection : &this->modelview;
+      this->record( MatrixMode );
+    }
+
+    virtual void load_identity()                                { this->current->load_identity(); this->record( LoadIdentity ); }
+    virtual void push_matrix()                                  { this->current->push(); this->record( PushMatrix ); }
+    virtual void pop_matrix()                                   { this->current->pop(); this->record( PopMatrix ); }
+    virtual void translate( float x, float y, float z )         { this->current->translate( x, y, z ); this->record( Translate ); }
+    virtual void scale( float x, float y, float z )             { this->current->scale( x, y, z ); this->record( Scale ); }
+    virtual void rotate( float angle, float x, float y, float z ) { this->current->rotate( angle, x, y, z ); this->record( Rotate ); }
+
+    virtual void mult_matrix( const Matrix& m )
+    {
+      this->current->top() = this->current->top() * m;
+      this->record( MultMatrix );
+    }
+
+    virtual void perspective( float fovy, float aspect, float near_z, float far_z )
+    {
+      this->current->top().perspective( fovy, aspect, near_z, far_z );
+      this->record( Perspective );
+    }
+
+    virtual void ortho( float left, float right, float bottom, float top, float near_z, float far_z )
+    {
+      this->current->top().ortho( left, right, bottom, top, near_z, far_z );
+      this->record( Ortho );
+    }
+
+    virtual void look_at( float eye_x, float eye_y, float eye_z,
+                          float center_x, float center_y, float center_z,
+                          float up_x, float up_y, float up_z )
+    {
+      this->current->top().look_at( eye_x, eye_y, eye_z, center_x, center_y, center_z, up_x, up_y, up_z );
+      this->record( LookAt );
+    }
+
+    virtual void enable( GLenum /* capability */ )                                         { this->record( Enable ); }
+    virtual void disable( GLenum /* capability */ )                                        { this->record( Disable ); }
+    virtual void shade_model( GLenum /* model */ )                                         { this->record( ShadeModel ); }
+    virtual void clear_color( float /* r */, float /* g */, float /* b */, float /* a */ ) { this->record( ClearColor ); }
+    virtual void alpha_func( GLenum /* func */, float /* ref */ )                          { this->record( AlphaFunc ); }
+    virtual void pixel_store( GLenum /* pname */, int /* param */ )                        { this->record( PixelStore ); }
+
+    virtual void light( GLenum /* light */, GLenum /* pname */, const float /* params */[] ) { this->record( Light ); }
+    virtual void fog( GLenum /* pname */, float /* param */ )                                { this->record( Fog ); }
+    virtual void fog( GLenum /* pname */, int /* param */ )                                  { this->record( Fog ); }
+    virtual void fog( GLenum /* pname */, const float /* params */[] )                       { this->record( Fog ); }
+
+    virtual void viewport( int /* x */, int /* y */, int /* width */, int /* height */ ) { this->record( Viewport ); }
+    virtual void scissor( int /* x */, int /* y */, int /* width */, int /* height */ )  { this->record( Scissor ); }
+    virtual void clear( GLbitfield /* mask */ )                                          { this->record( Clear ); }
+
+    virtual void material( GLenum /* face */, GLenum /* pname */, const float /* params */[] ) { this->record( SetMaterial ); }
+    virtual void color( float /* r */, float /* g */, float /* b */ )                          { this->record( Color ); }
+    virtual void color_material( GLenum /* face */, GLenum /* mode */ )                        { this->record( ColorMaterial ); }
+
+    virtual void begin( GLenum /* mode */ )                            { this->record( Begin ); }
+    virtual void vertex( float /* x */, float /* y */, float /* z */ ) { this->record( Vertex ); }
+    virtual void end()                                                 { this->record( End ); }
+    virtual void raster_pos( int /* x */, int /* y */ )                { this->record( RasterPos ); }
+
+    // Display lists, for geometry that is compiled once and replayed.
+    virtual GLuint gen_lists( int count )
+    {
+      GLuint first = this->next_name;
+      this->next_name += count;
+      this->record( GenLists );
+      return( first );
+    }
+
+    virtual void new_list( GLuint /* list */, GLenum /* mode */ ) { this->record( NewList ); }
+    virtual void end_list()                                       { this->record( EndList ); }
+    virtual void call_list( GLuint /* list */ )                   { this->record( CallList ); }
+
+    // A static vertex buffer holding the given bytes.
+    virtual GLuint create_buffer( const void* /* data */, size_t /* bytes */ )
+    {
+      this->record( CreateBuffer );
+      return( this->next_name++ );
+    }
+
+    // Draws count vertices from a buffer of interleaved positions and
+    // normals (six floats per vertex).
+    virtual void draw_buffer( GLuint /* buffer */, GLenum /* mode */, int /* count */ ) { this->record( DrawBuffer ); }
+
+    // Makes room for the model matrices of up to instances instances per
+    // draw_buffer_instanced call, so that drawing that many never has to
+    // grow anything.
+    virtual void reserve_instances( int /* instances */ ) { this->record( ReserveInstances ); }
+
+    // Draws instances copies of count vertices from a buffer (as
+    // draw_buffer does) with one call, each placed by its own model matrix
+    // (sixteen floats, column-major) on top of the modelview, and lit by
+    // GL_LIGHT0 and the current material.
+    virtual void draw_buffer_instanced( GLuint /* buffer */, GLenum /* mode */, int /* count */,
+                                        const float /* models */[], int /* instances */ )
+    {
+      this->record( DrawBufferInstanced );
+    }
+
+    // Draws count vertices from client memory.  normals and colors
+    // (three floats per vertex) may be null.
+    virtual void draw_arrays( GLenum /* mode */, int /* count */, const float /* vertices */[],
+                              const float /* normals */[], const float /* colors */[] )
+    {
+      this->record( DrawArrays );
+    }
+
+    // A vertex buffer that stays mapped for writing for as long as it
+    // exists, so that it can be refilled every frame without mapping or
+    // copying.  The mapping is returned through memory, which is never
+    // null.  The null device maps plain memory, so the scene code writes
+    // to it all the same.
+    virtual GLuint create_stream_buffer( size_t bytes, void** memory )
+    {
+      GLuint buffer = this->next_name++;
+      std::vector<char>& storage = this->stream_storage[buffer];
+
+      storage.resize( bytes );
+      *memory = &storage[0];
+      this->record( CreateStreamBuffer );
+
+      return( buffer );
+    }
+
+    virtual void delete_stream_buffer( GLuint buffer )
+    {
+      this->stream_storage.erase( buffer );
+      this->record( DeleteStreamBuffer );
+    }
+
+    // Draws count vertices (three floats each) starting offset bytes into
+    // a stream buffer.
+    virtual void draw_stream( GLuint /* buffer */, size_t /* offset */, GLenum /* mode */, int /* count */ ) { this->record( DrawStream ); }
+
+    // A fence is passed once the GPU has finished every command issued
+    // before it; wait_fence blocks until then and releases the fence.
+    virtual GLsync fence()                         { this->record( Fence ); return( 0 ); }
+    virtual void   wait_fence( GLsync /* sync */ ) { this->record( WaitFence ); }
+
+    virtual void swap_buffers() { this->record( SwapBuffers ); }
+    virtual void flush()        { this->record( Flush ); }
+    virtual void finish()       { this->record( Finish ); }
+
+  protected:
+    virtual void record( Command /* command */ ) {}
+
+  private:
+    MatrixStack  modelview;
+    MatrixStack  projection;
+    MatrixStack* current;
+    GLuint       next_name;
+
+    std::map<GLuint, std::vector<char> > stream_storage;
+  };
+
+  // Discards every command, for measuring the CPU cost of the scene code.
+  typedef RenderDevice NullRenderDevice;
+
+  // Forwards every command to OpenGL.
+  class GLRenderDevice : public RenderDevice
+  {
+  public:
+    GLRenderDevice()
+    {
+      this->instance_buffer    = 0;
+      this->instance_program   = 0;
+      this->instance_capacity  = 0;
+      this->instancing_tried   = false;
+      this->streaming_tried    = false;
+      this->has_buffer_storage = false;
+      this->has_sync           = false;
+    }
+
+    void matrix_mode( GLenum mode )                     { RenderDevice::matrix_mode( mode ); glMatrixMode( mode ); }
+    void load_identity()                                { RenderDevice::load_identity(); glLoadIdentity(); }
+    void push_matrix()                                  { RenderDevice::push_matrix(); glPushMatrix(); }
+    void pop_matrix()                                   { RenderDevice::pop_matrix(); glPopMatrix(); }
+    void translate( float x, float y, float z )         { RenderDevice::translate( x, y, z ); glTranslatef( x, y, z ); }
+    void scale( float x, float y, float z )             { RenderDevice::scale( x, y, z ); glScalef( x, y, z ); }
+    void rotate( float angle, float x, float y, float z ) { RenderDevice::rotate( angle, x, y, z ); glRotatef( angle, x, y, z ); }
+    void mult_matrix( const Matrix& m )                 { RenderDevice::mult_matrix( m ); glMultMatrixf( m.m ); }
+
+    void perspective( float fovy, float aspect, float near_z, float far_z )
+    {
+      RenderDevice::perspective( fovy, aspect, near_z, far_z );
+      gluPerspective( fovy, aspect, near_z, far_z );
+    }
+
+    void ortho( float left, float right, float bottom, float top, float near_z, float far_z )
+    {
+      RenderDevice::ortho( left, right, bottom, top, near_z, far_z );
+      glOrtho( left, right, bottom, top, near_z, far_z );
+    }
+
+    void look_at( float eye_x, float eye_y, float eye_z,
+                  float center_x, float center_y, float center_z,
+                  float up_x, float up_y, float up_z )
+    {
+      RenderDevice::look_at( eye_x, eye_y, eye_z, center_x, center_y, center_z, up_x, up_y, up_z );
+      gluLookAt( eye_x, eye_y, eye_z, center_x, center_y, center_z, up_x, up_y, up_z );
+    }
+
+    void enable( GLenum capability )                      { glEnable( capability ); }
+    void disable( GLenum capability )                     { glDisable( capability ); }
+    void shade_model( GLenum model )                      { glShadeModel( model ); }
+    void clear_color( float r, float g, float b, float a ) { glClearColor( r, g, b, a ); }
+    void alpha_func( GLenum func, float ref )             { glAlphaFunc( func, ref ); }
+    void pixel_store( GLenum pname, int param )           { glPixelStorei( pname, param ); }
+
+    void light( GLenum light, GLenum pname, const float params[] ) { glLightfv( light, pname, params ); }
+    void fog( GLenum pname, float param )                         { glFogf( pname, param ); }
+    void fog( GLenum pname, int param )                           { glFogi( pname, param ); }
+    void fog( GLenum pname, const float params[] )                { glFogfv( pname, params ); }
+
+    void viewport( int x, int y, int width, int height ) { glViewport( x, y, width, height ); }
+    void scissor( int x, int y, int width, int height )  { glScissor( x, y, width, height ); }
+    void clear( GLbitfield mask )                        { glClear( mask ); }
+
+    void material( GLenum face, GLenum pname, const float params[] ) { glMaterialfv( face, pname, params ); }
+    void color( float r, float g, float b )                         { glColor3f( r, g, b ); }
+    void color_material( GLenum face, GLenum mode )                 { glColorMaterial( face, mode ); }
+
+    void begin( GLenum mode )                { glBegin( mode ); }
+    void vertex( float x, float y, float z ) { glVertex3f( x, y, z ); }
+    void end()                               { glEnd(); }
+    void raster_pos( int x, int y )          { glRasterPos2i( x, y ); }
+
+    GLuint gen_lists( int count )             { return( glGenLists( count ) ); }
+    void   new_list( GLuint list, GLenum mode ) { glNewList( list, mode ); }
+    void   end_list()                         { glEndList(); }
+    void   call_list( GLuint list )           { glCallList( list ); }
+
+    GLuint create_buffer( const void* data, size_t bytes )
+    {
+      GLuint buffer;
+      glGenBuffers( 1, &buffer );
+      glBindBuffer( GL_ARRAY_BUFFER, buffer );
+      glBufferData( GL_ARRAY_BUFFER, bytes, data, GL_STATIC_DRAW );
+      glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+      return( buffer );
+    }
+
+    void draw_buffer( GLuint buffer, GLenum mode, int count )
+    {
+      const GLsizei stride = 6 * sizeof( float );
+
+      glBindBuffer( GL_ARRAY_BUFFER, buffer );
+      glEnableClientState( GL_VERTEX_ARRAY );
+      glEnableClientState( GL_NORMAL_ARRAY );
+
+      glVertexPointer( 3, GL_FLOAT, stride, (const GLvoid*)0 );
+      glNormalPointer( GL_FLOAT, stride, (const GLvoid*)( 3 * sizeof( float ) ) );
+
+      glDrawArrays( mode, 0, count );
+
+      glDisableClientState( GL_NORMAL_ARRAY );
+      glDisableClientState( GL_VERTEX_ARRAY );
+      glBindBuffer( GL_ARRAY_BUFFER, 0 );
+    }
+
+    // The instance buffer keeps one size, set here up front, and is only
+    // grown by a draw of more instances than were reserved.  The first
+    // call also builds the instancing program; without one there is no
+    // buffer to size.
+    void reserve_instances( int instances )
+    {
+      if( !this->instancing_tried )
+      {
+        this->instance_program = GLRenderDevice::build_instance_program();
+        this->instancing_tried = true;
+      }
+
+      if( this->instance_program == 0 || instances <= this->instance_capacity ) return;
+
+      if( this->instance_buffer == 0 )
+        glGenBuffers( 1, &this->instance_buffer );
+
+      glBindBuffer( GL_ARRAY_BUFFER, this->instance_buffer );
+      glBufferData( GL_ARRAY_BUFFER, instances * 16 * sizeof( float ), NULL, GL_STREAM_DRAW );
+      glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+      this->instance_capacity = instances;
+    }
+
+    // The model matrices go into the instance buffer, orphaned (at the
+    // same size, so the driver can hand back a free copy) on every call,
+    // and are read once per instance (through a divisor of 1) as the four
+    // columns of a mat4 attribute.  Where the context cannot instance,
+    // each copy is drawn by itself under its own matrix instead.
+    void draw_buffer_instanced( GLuint buffer, GLenum mode, int count, const float models[], int instances )
+    {
+      const GLsizei stride        = 6 * sizeof( float );
+      const GLsizei matrix_stride = 16 * sizeof( float );
+
+      this->reserve_instances( instances );
+
+      if( this->instance_program == 0 )
+      {
+        for( int i = 0; i < instances; i++ )
+        {
+          glPushMatrix();
+            glMultMatrixf( models + 16 * i );
+            this->draw_buffer( buffer, mode, count );
+          glPopMatrix();
+        }
+        return;
+      }
+
+      glBindBuffer( GL_ARRAY_BUFFER, this->instance_buffer );
+      glBufferData( GL_ARRAY_BUFFER, this->instance_capacity * matrix_stride, NULL, GL_STREAM_DRAW );
+      glBufferSubData( GL_ARRAY_BUFFER, 0, instances * matrix_stride, models );
+      for( int column = 0; column < 4; column++ )
+      {
+        glEnableVertexAttribArray( MODEL_ATTRIBUTE + column );
+        glVertexAttribPointer( MODEL_ATTRIBUTE + column, 4, GL_FLOAT, GL_FALSE, matrix_stride,
+                               (const GLvoid*)( 4 * column * sizeof( float ) ) );
+        glVertexAttribDivisor( MODEL_ATTRIBUTE + column, 1 );
+      }
+
+      glBindBuffer( GL_ARRAY_BUFFER, buffer );
+      glEnableClientState( GL_VERTEX_ARRAY );
+      glEnableClientState( GL_NORMAL_ARRAY );
+      glVertexPointer( 3, GL_FLOAT, stride, (const GLvoid*)0 );
+      glNormalPointer( GL_FLOAT, stride, (const GLvoid*)( 3 * sizeof( float ) ) );
+
+      glUseProgram( this->instance_program );
+      glDrawArraysInstanced( mode, 0, count, instances );
+      glUseProgram( 0 );
+
+      glDisableClientState( GL_NORMAL_ARRAY );
+      glDisableClientState( GL_VERTEX_ARRAY );
+      for( int column = 0; column < 4; column++ )
+      {
+        glVertexAttribDivisor( MODEL_ATTRIBUTE + column, 0 );
+        glDisableVertexAttribArray( MODEL_ATTRIBUTE + column );
+      }
+      glBindBuffer( GL_ARRAY_BUFFER, 0 );
+    }
+
+    void draw_arrays( GLenum mode, int count, const float vertices[],
+                      const float normals[], const float colors[] )
+    {
+      glEnableClientState( GL_VERTEX_ARRAY );
+      glVertexPointer( 3, GL_FLOAT, 0, vertices );
+
+      if( normals )
+      {
+        glEnableClientState( GL_NORMAL_ARRAY );
+        glNormalPointer( GL_FLOAT, 0, normals );
+      }
+
+      if( colors )
+      {
+        glEnableClientState( GL_COLOR_ARRAY );
+        glColorPointer( 3, GL_FLOAT, 0, colors );
+      }
+
+      glDrawArrays( mode, 0, count );
+
+      if( colors )  glDisableClientState( GL_COLOR_ARRAY );
+      if( normals ) glDisableClientState( GL_NORMAL_ARRAY );
+      glDisableClientState( GL_VERTEX_ARRAY );
+    }
+
+    // Immutable storage, mapped persistently and coherently, so writes
+    // through the mapping are seen by the GPU without a flush.  Where the
+    // context lacks ARB_buffer_storage (a legacy context has neither it
+    // nor GL 4.4), or the mapping fails, memory is a staging array
+    // instead, and draw_stream uploads from it.
+    GLuint create_stream_buffer( size_t bytes, void** memory )
+    {
+      const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+      if( !this->streaming_tried )
+      {
+        this->has_buffer_storage = has_version( 4, 4 ) || has_extension( "GL_ARB_buffer_storage" );
+        this->has_sync           = has_version( 3, 2 ) || has_extension( "GL_ARB_sync" );
+        this->streaming_tried    = true;
+      }
+
+      GLuint buffer;
+      glGenBuffers( 1, &buffer );
+      glBindBuffer( GL_ARRAY_BUFFER, buffer );
+
+      *memory = 0;
+      if( this->has_buffer_storage )
+      {
+        glBufferStorage( GL_ARRAY_BUFFER, bytes, NULL, flags );
+        *memory = glMapBufferRange( GL_ARRAY_BUFFER, 0, bytes, flags );
+
+        // Storage is immutable, so a buffer that would not map is
+        // replaced by one the fallback can respecify.
+        if( *memory == 0 )
+        {
+          std::cerr << "GLRenderDevice: a stream buffer would not map; uploading streamed vertices instead" << std::endl;
+          this->has_buffer_storage = false;
+
+          glDeleteBuffers( 1, &buffer );
+          glGenBuffers( 1, &buffer );
+          glBindBuffer( GL_ARRAY_BUFFER, buffer );
+        }
+      }
+
+      if( *memory == 0 )
+      {
+        std::vector<char>& staging = this->staging[buffer];
+
+        staging.resize( bytes );
+        glBufferData( GL_ARRAY_BUFFER, bytes, NULL, GL_STREAM_DRAW );
+        *memory = &staging[0];
+      }
+
+      glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+      return( buffer );
+    }
+
+    void delete_stream_buffer( GLuint buffer )
+    {
+      if( this->staging.erase( buffer ) == 0 )
+      {
+        glBindBuffer( GL_ARRAY_BUFFER, buffer );
+        glUnmapBuffer( GL_ARRAY_BUFFER );
+        glBindBuffer( GL_ARRAY_BUFFER, 0 );
+      }
+      glDeleteBuffers( 1, &buffer );
+    }
+
+    // A staged buffer is orphaned (at the same size, so the driver can
+    // hand back a free copy) and the vertices drawn are copied into it,
+    // so the upload never waits on a draw the GPU has yet to finish.
+    void draw_stream( GLuint buffer, size_t offset, GLenum mode, int count )
+    {
+      std::map<GLuint, std::vector<char> >::iterator staged = this->staging.find( buffer );
+
+      glBindBuffer( GL_ARRAY_BUFFER, buffer );
+      if( staged != this->staging.end() )
+      {
+        glBufferData( GL_ARRAY_BUFFER, staged->second.size(), NULL, GL_STREAM_DRAW );
+        glBufferSubData( GL_ARRAY_BUFFER, offset, count * 3 * sizeof( float ), &staged->second[offset] );
+      }
+      glEnableClientState( GL_VERTEX_ARRAY );
+      glVertexPointer( 3, GL_FLOAT, 0, (const GLvoid*)offset );
+
+      glDrawArrays( mode, 0, count );
+
+      glDisableClientState( GL_VERTEX_ARRAY );
+      glBindBuffer( GL_ARRAY_BUFFER, 0 );
+    }
+
+    // A context without sync objects (before GL 3.2 and ARB_sync) has no
+    // fences to give; its stream buffers are staged and need none.
+    GLsync fence()
+    {
+      if( !this->has_sync ) return( 0 );
+
+      return( glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 ) );
+    }
+
+    void wait_fence( GLsync sync )
+    {
+      if( !sync ) return;
+
+      GLenum status;
+      do
+        status = glClientWaitSync( sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000 );
+      while( status == GL_TIMEOUT_EXPIRED );
+
+      glDeleteSync( sync );
+    }
+
+    void swap_buffers() { glutSwapBuffers(); }
+    void flush()        { glFlush(); }
+    void finish()       { glFinish(); }
+
+  private:
+    enum
+    {
+      // The first of the four attributes a mat4 takes, clear of those
+      // that some drivers alias to gl_Vertex, gl_Normal and gl_Color.
+      MODEL_ATTRIBUTE = 12
+    };
+
+    GLuint instance_buffer;
+    GLuint instance_program;   // 0 where instancing is unavailable.
+    int    instance_capacity;  // Model matrices the instance buffer holds.
+    bool   instancing_tried;
+
+    bool streaming_tried;
+    bool has_buffer_storage;  // Stream buffers are mapped persistently.
+    bool has_sync;
+
+    // The CPU copy of each stream buffer that is not mapped.
+    std::map<GLuint, std::vector<char> > staging;
+
+    // Whether the context is at least version major.minor.
+    static bool has_version( int major, int minor )
+    {
+      const char* version = (const char*)glGetString( GL_VERSION );
+      int         m = 0, n = 0;
+
+      if( version == 0 || sscanf( version, "%d.%d", &m, &n ) != 2 ) return( false );
+
+      return( m > major || ( m == major && n >= minor ) );
+    }
+
+    // Whether the context lists the extension, as a whole word.
+    static bool has_extension( const char* name )
+    {
+      const char* extensions = (const char*)glGetString( GL_EXTENSIONS );
+      size_t      length     = strlen( name );
+
+      for( const char* p = extensions; p != 0 && ( p = strstr( p, name ) ) != 0; p += length )
+        if( ( p == extensions || p[-1] == ' ' ) && ( p[length] == ' ' || p[length] == '\0' ) )
+          return( true );
+
+      return( false );
+    }
+
+    // A vertex shader that places each vertex by its instance's model
+    // matrix and lights it as the fixed-function pipeline would, for one
+    // light and a front material.  Normals are taken through the
+    // cofactors of the model matrix, which is the inverse transpose up to
+    // a scale, so they stay true under the non-uniform scales the body
+    // parts are shaped by.  Everything after the vertex stage (fog
+    // included, through gl_FogFragCoord) is left to the fixed pipeline.
+    // Returns 0, having said why, if the context lacks GLSL 1.20 or
+    // instanced arrays or the shader fails to build.
+    static GLuint build_instance_program()
+    {
+      static const char* source =
+        "#version 120\n"
+        "attribute mat4 model;\n"
+        "void main()\n"
+        "{\n"
+        "  vec4 position = gl_ModelViewMatrix * ( model * gl_Vertex );\n"
+        "  mat3 m        = mat3( model );\n"
+        "  mat3 cofactor = mat3( cross( m[1], m[2] ), cross( m[2], m[0] ), cross( m[0], m[1] ) );\n"
+        "  vec3 normal   = normalize( gl_NormalMatrix * ( cofactor * gl_Normal ) );\n"
+        "  vec4 light    = gl_LightSource[0].position;\n"
+        "  vec3 to_light = normalize( light.xyz - position.xyz * light.w );\n"
+        "  vec3 halfway  = normalize( to_light + vec3( 0.0, 0.0, 1.0 ) );\n"
+        "  float diffuse  = max( dot( normal, to_light ), 0.0 );\n"
+        "  float facing   = max( dot( normal, halfway ), 0.0 );\n"
+        "  float shine    = ( gl_FrontMaterial.shininess > 0.0 ) ? pow( facing, gl_FrontMaterial.shininess ) : 1.0;\n"
+        "  float specular = ( diffuse > 0.0 ) ? shine : 0.0;\n"
+        "  gl_FrontColor  = gl_FrontLightModelProduct.sceneColor + gl_FrontLightProduct[0].ambient +\n"
+        "                   gl_FrontLightProduct[0].diffuse * diffuse + gl_FrontLightProduct[0].specular * specular;\n"
+        "  gl_FrontColor.a = gl_FrontMaterial.diffuse.a;\n"
+        "  gl_Position     = gl_ProjectionMatrix * position;\n"
+        "  gl_FogFragCoord = abs( position.z );\n"
+        "}\n";
+
+      bool can_instance = has_version( 3, 3 ) ||
+                          ( has_version( 2, 1 ) && has_extension( "GL_ARB_instanced_arrays" ) &&
+                                                   has_extension( "GL_ARB_draw_instanced" ) );
+      if( !can_instance )
+      {
+        std::cerr << "GLRenderDevice: no GLSL 1.20 or instanced arrays; drawing instances one at a time" << std::endl;
+        return( 0 );
+      }
+
+      GLint  status;
+      GLchar log[1024];
+
+      GLuint shader = glCreateShader( GL_VERTEX_SHADER );
+      glShaderSource( shader, 1, &source, NULL );
+      glCompileShader( shader );
+      glGetShaderiv( shader, GL_COMPILE_STATUS, &status );
+      if( status != GL_TRUE )
+      {
+        glGetShaderInfoLog( shader, sizeof( log ), NULL, log );
+        std::cerr << "GLRenderDevice: the instancing shader did not compile:" << std::endl << log << std::endl;
+        glDeleteShader( shader );
+        return( 0 );
+      }
+
+      GLuint program = glCreateProgram();
+      glAttachShader( program, shader );
+      glBindAttribLocation( program, MODEL_ATTRIBUTE, "model" );
+      glLinkProgram( program );
+      glDeleteShader( shader );
+      glGetProgramiv( program, GL_LINK_STATUS, &status );
+      if( status != GL_TRUE )
+      {
+        glGetProgramInfoLog( program, sizeof( log ), NULL, log );
+        std::cerr << "GLRenderDevice: the instancing program did not link:" << std::endl << log << std::endl;
+        glDeleteProgram( program );
+        return( 0 );
+      }
+
+      return( program );
+    }
+  };
+
+  // Discards every command, but keeps the command stream of each frame
+  // (a frame ends at swap_buffers) along with per-command call counts.
+  class RecordingRenderDevice : public RenderDevice
+  {
+  public:
+    RecordingRenderDevice()
+    {
+      this->frame_count = 0;
+
+      for( int i = 0; i < COMMAND_COUNT; i++ )
+        this->counts[i] = this->last_counts[i] = 0;
+    }
+
+    // The commands of the last completed frame, in the order issued.
+    const std::vector<Command>& get_frame_commands()
+    {
+      return( this->last_frame );
+    }
+
+    // How many times the command was issued in the last completed frame.
+    int get_call_count( Command command )
+    {
+      return( this->last_counts[command] );
+    }
+
+    int get_frame_count()
+    {
+      return( this->frame_count );
+    }
+
+    void swap_buffers()
+    {
+      RenderDevice::swap_buffers();
+
+      this->last_frame.swap( this->frame );
+      this->frame.clear();
+      this->frame_count++;
+
+      for( int i = 0; i < COMMAND_COUNT; i++ )
+      {
+        this->last_counts[i] = this->counts[i];
+        this->counts[i]      = 0;
+      }
+    }
+
+  protected:
+    void record( Command command )
+    {
+      this->frame.push_back( command );
+      this->counts[command]++;
+    }
+
+  private:
+    std::vector<Command> frame;
+    std::vector<Command> last_frame;
+    int                  counts[COMMAND_COUNT];
+    int                  last_counts[COMMAND_COUNT];
+    int                  frame_count;
+  };
+
+  // The device the scene is currently drawn with; GL unless replaced.
+  RenderDevice*& current_render_device()
+  {
+    static GLRenderDevice gl_device;
+    static RenderDevice*  device = &gl_device;
+    return( device );
+  }
+
+  RenderDevice& render_device()
+  {
+    return( *current_render_device() );
+  }
+
+  void set_render_device( RenderDevice* device )
+  {
+    current_render_device() = device;
+  }
+}
+
+#endif
@@ -0,0 +1,309 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+#include "Graphics.Matrix.h"
+#include "Graphics.RenderDevice.h"
+#include "Graphics.BoundingBox.h"
+#include "Graphics.Material.h"
+#include "Graphics.Instancing.h"
+#include "Graphics.MeshLibrary.h"
+
+namespace Graphics
+{
+  // The complete fixed-function material of a draw submission, compared by
+  // value so that identical materials from different Draw routines share
+  // one key.
+  struct MaterialKey
+  {
+    float ambient[4];
+    float diffuse[4];
+    float specular[4];
+    float emission[4];
+    float shininess;
+
+    MaterialKey() {}
+
+    MaterialKey( const float ambient[], const float diffuse[], const float specular[],
+                 const float emission[], float shininess )
+    {
+      for( int i = 0; i < 4; i++ )
+      {
+        this->ambient[i]  = ambient[i];
+        this->diffuse[i]  = diffuse[i];
+        this->specular[i] = specular[i];
+        this->emission[i] = emission[i];
+      }
+      this->shininess = shininess;
+    }
+
+    bool operator==( const MaterialKey& k ) const
+    {
+      return( memcmp( this, &k, sizeof( MaterialKey ) ) == 0 );
+    }
+
+    void apply() const
+    {
+      RenderDevice& device = render_device();
+
+      device.material( GL_FRONT, GL_AMBIENT,   this->ambient );
+      device.material( GL_FRONT, GL_DIFFUSE,   this->diffuse );
+      device.material( GL_FRONT, GL_SPECULAR,  this->specular );
+      device.material( GL_FRONT, GL_EMISSION,  this->emission );
+      device.material( GL_FRONT, GL_SHININESS, &this->shininess );
+      device.color( this->diffuse[0], this->diffuse[1], this->diffuse[2] );
+    }
+  };
+
+  // Collects primitives tagged with a material key and a modelling
+  // transform, then draws them sorted by material so that every distinct
+  // material is applied once per flush.  Transforms are tracked on the
+  // queue's own matrix stack (relative to the GL modelview at flush time),
+  // which keeps submissions valid while a display list is being compiled.
+  class RenderQueue
+  {
+  public:
+    RenderQueue()
+    {
+      this->current_material = -1;
+      this->batch_count      = 0;
+      this->unsorted_changes = 0;
+      this->sorted_changes   = 0;
+    }
+
+    void push()                                           { this->transform.push(); }
+    void pop()                                            { this->transform.pop(); }
+    void translate( float x, float y, float z )           { this->transform.translate( x, y, z ); }
+    void scale( float x, float y, float z )               { this->transform.scale( x, y, z ); }
+    void rotate( float angle, float x, float y, float z ) { this->transform.rotate( angle, x, y, z ); }
+
+    void set_material( const MaterialKey& key )
+    {
+      for( int i = 0, n = int( this->materials.size() ); i < n; i++ )
+      {
+        if( this->materials[i] == key )
+        {
+          this->current_material = i;
+          return;
+        }
+      }
+
+      this->materials.push_back( key );
+      this->current_material = int( this->materials.size() ) - 1;
+    }
+
+    void cube( float size )
+    {
+      this->submit( Cube, size, 0.0f, 0.0f, 0.0f );
+    }
+
+    void sphere( float radius, int slices, int stacks )
+    {
+      this->submit( Sphere, radius, 0.0f, float( slices ), float( stacks ) );
+    }
+
+    void cone( float base, float height, int slices, int stacks )
+    {
+      this->submit( Cone, base, height, float( slices ), float( stacks ) );
+    }
+
+    // Queues a copy of the instances; their per-instance colors override
+    // the ambient and diffuse parts of the current material.
+    void cube_instances( const CubeInstances& instances )
+    {
+      if( this->batch_count == int( this->batches.size() ) )
+        this->batches.push_back( CubeInstances() );
+
+      this->batches[this->batch_count] = instances;
+      this->submit( Instances, float( this->batch_count ), 0.0f, 0.0f, 0.0f );
+      this->batch_count++;
+    }
+
+    // Draws everything submitted since the last flush, sorted by material.
+    // Returns the number of material changes that were applied.
+    int flush()
+    {
+      int n = int( this->submissions.size() );
+
+      int unsorted = 0;
+      for( int i = 0; i < n; i++ )
+        if( i == 0 || this->submissions[i].material != this->submissions[i-1].material )
+          unsorted++;
+
+      this->sort_by_material();
+
+      int sorted  = 0;
+      int applied = UnknownMaterial;
+      this->bounds = BoundingBox();
+      for( int i = 0; i < n; i++ )
+      {
+        Submission& s = this->submissions[i];
+
+        this->bounds.extend( this->get_bounds( s ).transformed( s.transform ) );
+
+        if( s.material != applied && s.material >= 0 )
+        {
+          this->materials[s.material].apply();
+          applied = s.material;
+          sorted++;
+        }
+
+        this->draw( s );
+
+        // Instance colors overwrite the ambient and diffuse properties.
+        if( s.primitive == Instances )
+          applied = UnknownMaterial;
+      }
+
+      // The GL material no longer matches anything Material<> applied.
+      if( n > 0 )
+        Material<>::forget_applied();
+
+      this->unsorted_changes = unsorted;
+      this->sorted_changes   = sorted;
+
+      this->submissions.clear();
+      this->materials.clear();
+      this->current_material = -1;
+      this->batch_count      = 0;
+
+      return( sorted );
+    }
+
+    // Material changes made by the last flush: the number an unsorted
+    // queue would have needed, and the number actually applied.
+    int get_unsorted_state_changes() { return( this->unsorted_changes ); }
+    int get_sorted_state_changes()   { return( this->sorted_changes ); }
+
+    // The box enclosing everything drawn by the last flush, relative to
+    // the GL modelview at the time of the flush.
+    BoundingBox get_bounds() { return( this->bounds ); }
+
+  private:
+    enum Primitive
+    {
+      Cube, Sphere, Cone, Instances
+    };
+
+    enum
+    {
+      UnknownMaterial = -2
+    };
+
+    struct Submission
+    {
+      int    material;
+      int    primitive;
+      float  params[4];
+      Matrix transform;
+
+    };
+
+    MatrixStack                transform;
+    std::vector<MaterialKey>   materials;
+    std::vector<Submission>    submissions;
+    std::vector<Submission>    sorted;        // Kept between flushes.
+    std::vector<int>           first_of;      // Kept between flushes.
+    std::vector<CubeInstances> batches;
+    int                        current_material;
+    int                        batch_count;
+
+    int                        unsorted_changes;
+    int                        sorted_changes;
+    BoundingBox                bounds;
+
+    // A stable counting sort of the submissions by material (submissions
+    // made before any material was set coming first), through buffers
+    // that are kept between flushes, so that once they have grown to the
+    // size of a frame flushing allocates nothing.
+    void sort_by_material()
+    {
+      int n = int( this->submissions.size() );
+      int m = int( this->materials.size() ) + 1;
+
+      this->first_of.assign( m + 1, 0 );
+      for( int i = 0; i < n; i++ )
+        this->first_of[this->submissions[i].material + 2]++;
+      for( int k = 1; k <= m; k++ )
+        this->first_of[k] += this->first_of[k - 1];
+
+      this->sorted.resize( n );
+      for( int i = 0; i < n; i++ )
+        this->sorted[this->first_of[this->submissions[i].material + 1]++] = this->submissions[i];
+
+      this->submissions.swap( this->sorted );
+    }
+
+    void submit( Primitive primitive, float p0, float p1, float p2, float p3 )
+    {
+      Submission s;
+      s.material  = this->current_material;
+      s.primitive = primitive;
+      s.params[0] = p0;
+      s.params[1] = p1;
+      s.params[2] = p2;
+      s.params[3] = p3;
+      s.transform = this->transform.top();
+
+      this->submissions.push_back( s );
+    }
+
+    // The primitive's extent in its own modelling space.
+    BoundingBox get_bounds( Submission& s )
+    {
+      float origin[] = { 0.0f, 0.0f, 0.0f };
+
+      switch( s.primitive )
+      {
+      case Cube:
+        return( BoundingBox( origin, s.params[0], s.params[0], s.params[0] ) );
+
+      case Sphere:
+        return( BoundingBox( origin, 2.0f * s.params[0], 2.0f * s.params[0], 2.0f * s.params[0] ) );
+
+      case Cone:
+        return( BoundingBox( -s.params[0], -s.params[0], 0.0f, s.params[0], s.params[0], s.params[1] ) );
+
+      case Instances:
+        return( this->batches[int( s.params[0] )].get_bounds() );
+      }
+
+      return( BoundingBox() );
+    }
+
+    void draw( Submission& s )
+    {
+      Matrix model = s.transform;
+
+      switch( s.primitive )
+      {
+      case Cube:
+        model.scale( s.params[0], s.params[0], s.params[0] );
+        mesh_library().cube().draw( model );
+        break;
+
+      case Sphere:
+        model.scale( s.params[0], s.params[0], s.params[0] );
+        mesh_library().sphere( int( s.params[2] ), int( s.params[3] ) ).draw( model );
+        break;
+
+      case Cone:
+        model.scale( s.params[0], s.params[0], s.params[1] );
+        mesh_library().cone( int( s.params[2] ), int( s.params[3] ) ).draw( model );
+        break;
+
+      case Instances:
+        render_device().push_matrix();
+          render_device().mult_matrix( model );
+          this->batches[int( s.params[0] )].draw();
+        render_device().pop_matrix();
+        break;
+      }
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef SIMULATION_CLOCK_H
+#define SIMULATION_CLOCK_H
+
+namespace Graphics
+{
+  // Fixed-timestep clock.  Real time is accumulated between frames and
+  // handed out in whole steps of a fixed length, so the simulation takes
+  // the same steps whatever the frame rate; the time left over is the
+  // fraction of a step that rendering interpolates by.
+  class SimulationClock
+  {
+  public:
+    // After a long stall (a window drag, a breakpoint) at most max_steps
+    // are run and the rest of the backlog is dropped, rather than letting
+    // the simulation spend ever longer catching up.
+    SimulationClock( double step, int max_steps = 10 )
+    {
+      this->step        = step;
+      this->max_steps   = max_steps;
+      this->accumulator = 0.0;
+      this->step_count  = 0;
+    }
+
+    // Adds elapsed seconds of real time, returning how many steps to run.
+    int advance( double elapsed )
+    {
+      this->accumulator += elapsed;
+
+      int steps = int( this->accumulator / this->step );
+      if( steps > this->max_steps )
+      {
+        steps = this->max_steps;
+        this->accumulator = steps * this->step;
+      }
+
+      this->accumulator -= steps * this->step;
+      this->step_count  += steps;
+
+      return( steps );
+    }
+
+    // How far real time is between the last step and the next, from 0 to 1.
+    float get_alpha()
+    {
+      return( float( this->accumulator / this->step ) );
+    }
+
+    double get_step()       { return( this->step ); }
+    long   get_step_count() { return( this->step_count ); }
+
+  private:
+    double step;
+    int    max_steps;
+    double accumulator;
+    long   step_count;
+  };
+}
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef SKELETON_H
+#define SKELETON_H
+
+#include <vector>
+#include <cassert>
+
+#include "Graphics.Matrix.h"
+
+namespace Graphics
+{
+  // A joint of a skeleton.  Each bone hangs from a parent earlier in the
+  // table (or from the model's origin, for a parent of -1): it is turned
+  // about axis by sign times one of the pose's angles (none, for an angle
+  // of -1) at its parent's origin, and then moved out by offset.
+  struct Bone
+  {
+    int   parent;
+    int   angle;
+    float sign;
+    float axis[3];
+    float offset[3];
+  };
+
+  // A mesh drawn at a bone, shaped (placed, scaled and turned) within the
+  // bone's space by a fixed matrix.
+  struct BonePart
+  {
+    int    bone;
+    int    mesh;
+    Matrix shape;
+  };
+
+  // A hierarchy of bones and the parts drawn at them, described by tables
+  // instead of by nested drawing code.  A pose (one angle per posable
+  // joint) is turned into a flat array of part matrices in one pass down
+  // the table, with no matrix stack, so figures can be evaluated anywhere
+  // (on any thread) and their parts drawn in any order or in batches.
+  class Skeleton
+  {
+  public:
+    enum
+    {
+      MAX_BONES = 64
+    };
+
+    // evaluate() works the bones out in a fixed array, in table order, so
+    // there can be no more than MAX_BONES of them and each bone's parent
+    // must already be in the table.
+    int add_bone( int parent, int angle, float sign, float axis_x, float axis_y, float axis_z,
+                  float offset_x, float offset_y, float offset_z )
+    {
+      assert( int( this->bones.size() ) < MAX_BONES );
+      assert( parent >= -1 && parent < int( this->bones.size() ) );
+
+      Bone b;
+      b.parent    = parent;
+      b.angle     = angle;
+      b.sign      = sign;
+      b.axis[0]   = axis_x;   b.axis[1]   = axis_y;   b.axis[2]   = axis_z;
+      b.offset[0] = offset_x; b.offset[1] = offset_y; b.offset[2] = offset_z;
+
+      this->bones.push_back( b );
+      return( int( this->bones.size() ) - 1 );
+    }
+
+    int add_part( int bone, int mesh, const Matrix& shape )
+    {
+      assert( bone >= 0 && bone < int( this->bones.size() ) );
+
+      BonePart p;
+      p.bone  = bone;
+      p.mesh  = mesh;
+      p.shape = shape;
+
+      this->parts.push_back( p );
+      return( int( this->parts.size() ) - 1 );
+    }
+
+    int get_bone_count() const         { return( int( this->bones.size() ) ); }
+    int get_part_count() const         { return( int( this->parts.size() ) ); }
+    int get_part_mesh( int part ) const { return( this->parts[part].mesh ); }
+
+    // Fills in the matrix of every part (in the order they were added)
+    // for the pose, with the whole figure placed by model.
+    void evaluate( const Matrix& model, const float pose[], Matrix out[] ) const
+    {
+      Matrix world[MAX_BONES];
+
+      for( int i = 0, n = int( this->bones.size() ); i < n; i++ )
+      {
+        const Bone& b = this->bones[i];
+
+        world[i] = ( b.parent < 0 ) ? model : world[b.parent];
+        if( b.angle >= 0 )
+          world[i].rotate( b.sign * pose[b.angle], b.axis[0], b.axis[1], b.axis[2] );
+        world[i].translate( b.offset[0], b.offset[1], b.offset[2] );
+      }
+
+      for( int i = 0, n = int( this->parts.size() ); i < n; i++ )
+        out[i] = world[this->parts[i].bone] * this->parts[i].shape;
+    }
+
+  private:
+    std::vector<Bone>     bones;
+    std::vector<BonePart> parts;
+  };
+}
+
+#endif
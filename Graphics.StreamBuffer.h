@@ -0,0 +1,100 @@
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <cstddef>
+
+#include "Graphics.RenderDevice.h"
+
+namespace Graphics
+{
+  // Vertices that are rewritten every frame, in one persistently mapped
+  // buffer split into three regions that are filled in rotation.  Each
+  // region is fenced when it is drawn from and waited on before it is
+  // written again, so the CPU fills one region while the GPU may still
+  // be reading the other two.  Where the device cannot map persistently
+  // it hands back a staging array, and uploads what each draw uses.
+  class StreamBuffer
+  {
+  public:
+    StreamBuffer()
+    {
+      this->buffer         = 0;
+      this->memory         = 0;
+      this->region_bytes   = 0;
+      this->region         = 0;
+      this->bytes_uploaded = 0;
+
+      for( int i = 0; i < REGIONS; i++ )
+        this->fences[i] = 0;
+    }
+
+    // Room for bytes of vertices (three floats each) in the next region,
+    // to be written before draw() is called.
+    float* map( size_t bytes )
+    {
+      if( bytes > this->region_bytes )
+        this->allocate( bytes );
+
+      this->region = ( this->region + 1 ) % REGIONS;
+      render_device().wait_fence( this->fences[this->region] );
+      this->fences[this->region] = 0;
+
+      return( (float*)( (char*)this->memory + this->region * this->region_bytes ) );
+    }
+
+    // Draws count vertices from the region last mapped.
+    void draw( GLenum mode, int count )
+    {
+      RenderDevice& device = render_device();
+
+      device.draw_stream( this->buffer, this->region * this->region_bytes, mode, count );
+      this->fences[this->region] = device.fence();
+
+      this->bytes_uploaded += count * 3 * sizeof( float );
+    }
+
+    // Bytes of vertices drawn since the counter was last reset, which is
+    // what reaches the GPU whether the buffer is mapped or staged.
+    size_t get_bytes_uploaded() { return( this->bytes_uploaded ); }
+    void   reset_counters()     { this->bytes_uploaded = 0; }
+
+  private:
+    enum
+    {
+      REGIONS = 3
+    };
+
+    GLuint buffer;
+    void*  memory;
+    size_t region_bytes;
+    int    region;
+    size_t bytes_uploaded;
+    GLsync fences[REGIONS];
+
+    // Replaces the buffer with one whose regions hold at least bytes,
+    // once the GPU is done with the old one.  Regions grow by doubling, so
+    // this only happens a few times as the vertex count settles.
+    void allocate( size_t bytes )
+    {
+      RenderDevice& device = render_device();
+
+      for( int i = 0; i < REGIONS; i++ )
+      {
+        device.wait_fence( this->fences[i] );
+        this->fences[i] = 0;
+      }
+
+      if( this->buffer != 0 )
+        device.delete_stream_buffer( this->buffer );
+
+      size_t size = ( this->region_bytes > 0 ) ? this->region_bytes : 4096;
+      while( size < bytes )
+        size *= 2;
+
+      this->region_bytes = size;
+      this->buffer       = device.create_stream_buffer( REGIONS * size, &this->memory );
+    }
+  };
+}
+
+#endif
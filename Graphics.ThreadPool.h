@@ -0,0 +1,265 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+namespace Graphics
+{
+  // A fixed set of worker threads for data-parallel loops.  run() deals
+  // the task indices out to the threads in contiguous blocks, so each
+  // thread works through neighbouring tasks, and the calling thread works
+  // alongside them.  A thread that runs out of tasks steals the back half
+  // of the remaining block of another, so threads that finish early take
+  // more of the work.  The time each thread spent in tasks during the last
+  // run is kept, for reporting how well the work was spread.  Tasks are
+  // called through a plain function pointer rather than a std::function,
+  // so running them allocates nothing.
+  class ThreadPool
+  {
+  public:
+    // threads counts the calling thread; 0 means one per hardware thread.
+    ThreadPool( int threads = 0 )
+    {
+      if( threads <= 0 )
+        threads = int( std::thread::hardware_concurrency() );
+      if( threads <= 0 )
+        threads = 1;
+
+      this->task       = 0;
+      this->call       = 0;
+      this->generation = 0;
+      this->idle       = 0;
+      this->stopping   = false;
+      this->elapsed    = 0.0;
+      this->queues     = new Queue[threads];
+
+      for( int i = 0; i < threads; i++ )
+      {
+        this->queues[i].block = 0;
+        this->queues[i].busy  = 0.0;
+        this->queues[i].tasks = 0;
+      }
+
+      for( int i = 1; i < threads; i++ )
+        this->workers.push_back( std::thread( &ThreadPool::worker_loop, this, i ) );
+    }
+
+    ~ThreadPool()
+    {
+      {
+        std::lock_guard<std::mutex> lock( this->mutex );
+        this->stopping = true;
+      }
+      this->wake.notify_all();
+
+      for( int i = 0, n = int( this->workers.size() ); i < n; i++ )
+        this->workers[i].join();
+
+      delete [] this->queues;
+    }
+
+    int get_thread_count()
+    {
+      return( int( this->workers.size() ) + 1 );
+    }
+
+    // Calls task( i ) for every i from 0 to count - 1, spread over the
+    // threads, and returns once every call has finished.
+    template<typename Task>
+    void run( int count, const Task& task )
+    {
+      if( count <= 0 ) return;
+
+      Clock::time_point start = Clock::now();
+      int               threads = this->get_thread_count();
+
+      for( int t = 0; t < threads; t++ )
+      {
+        this->queues[t].busy  = 0.0;
+        this->queues[t].tasks = 0;
+      }
+
+      // A single task is not worth waking anyone for.
+      if( count == 1 || threads == 1 )
+      {
+        this->queues[0].block = ThreadPool::block( 0, count );
+        this->task            = &task;
+        this->call            = &ThreadPool::invoke<Task>;
+        this->work( 0 );
+        this->task            = 0;
+        this->elapsed         = ThreadPool::seconds( start, Clock::now() );
+        return;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock( this->mutex );
+        for( int t = 0; t < threads; t++ )
+          this->queues[t].block = ThreadPool::block( int( ( long long )( count ) * t / threads ),
+                                                     int( ( long long )( count ) * ( t + 1 ) / threads ) );
+        this->task = &task;
+        this->call = &ThreadPool::invoke<Task>;
+        this->idle = 0;
+        this->generation++;
+      }
+      this->wake.notify_all();
+
+      this->work( 0 );
+
+      // Every worker checks in for every run, so none can still be
+      // taking tasks when the next run deals out new blocks.
+      std::unique_lock<std::mutex> lock( this->mutex );
+      while( this->idle < int( this->workers.size() ) )
+        this->done.wait( lock );
+      this->task    = 0;
+      this->elapsed = ThreadPool::seconds( start, Clock::now() );
+    }
+
+    // The fraction of the last run that thread (0 being the calling
+    // thread) spent in tasks, and the number of tasks it ran.
+    double get_utilization( int thread )
+    {
+      return( ( this->elapsed > 0.0 ) ? this->queues[thread].busy / this->elapsed : 0.0 );
+    }
+
+    int get_task_count( int thread )
+    {
+      return( this->queues[thread].tasks );
+    }
+
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    // The block of tasks a thread has left, [first, last), packed into
+    // one word so that it can be taken from by compare-and-swap, and what
+    // the thread has done in the last run.  Each is on its own cache line.
+    struct alignas( 64 ) Queue
+    {
+      std::atomic<unsigned long long> block;
+      double                          busy;
+      int                             tasks;
+    };
+
+    std::vector<std::thread>           workers;
+    std::mutex                         mutex;
+    std::condition_variable            wake;
+    std::condition_variable            done;
+    const void*                        task;
+    void                               ( *call )( const void* task, int i );
+    long                               generation;
+    int                                idle;
+    bool                               stopping;
+    double                             elapsed;  // Of the last run, in seconds.
+    Queue*                             queues;
+
+    template<typename Task>
+    static void invoke( const void* task, int i )
+    {
+      ( *static_cast<const Task*>( task ) )( i );
+    }
+
+    static unsigned long long block( int first, int last )
+    {
+      return( ( ( unsigned long long )( unsigned int )( first ) << 32 ) | ( unsigned int )( last ) );
+    }
+
+    static int first( unsigned long long b ) { return( int( b >> 32 ) ); }
+    static int last( unsigned long long b )  { return( int( b & 0xffffffffu ) ); }
+
+    static double seconds( Clock::time_point from, Clock::time_point to )
+    {
+      return( std::chrono::duration<double>( to - from ).count() );
+    }
+
+    // The next task from the front of the thread's own block, or -1.
+    int take( int thread )
+    {
+      std::atomic<unsigned long long>& b = this->queues[thread].block;
+      unsigned long long               old = b.load();
+
+      while( ThreadPool::first( old ) < ThreadPool::last( old ) )
+      {
+        if( b.compare_exchange_weak( old, ThreadPool::block( ThreadPool::first( old ) + 1, ThreadPool::last( old ) ) ) )
+          return( ThreadPool::first( old ) );
+      }
+
+      return( -1 );
+    }
+
+    // Takes the back half of another thread's block (looking at each of
+    // the others in turn), keeping the rest of it as the thread's own
+    // block and returning its first task, or -1 once every block is empty.
+    int steal( int thread )
+    {
+      int threads = this->get_thread_count();
+
+      for( int k = 1; k < threads; k++ )
+      {
+        std::atomic<unsigned long long>& b = this->queues[( thread + k ) % threads].block;
+        unsigned long long               old = b.load();
+
+        while( ThreadPool::first( old ) < ThreadPool::last( old ) )
+        {
+          int first  = ThreadPool::first( old ), last = ThreadPool::last( old );
+          int middle = first + ( last - first ) / 2;
+
+          if( b.compare_exchange_weak( old, ThreadPool::block( first, middle ) ) )
+          {
+            // Only the thread itself refills its block, and only once it
+            // is empty, when no one else will touch it.
+            this->queues[thread].block.store( ThreadPool::block( middle + 1, last ) );
+            return( middle );
+          }
+        }
+      }
+
+      return( -1 );
+    }
+
+    void work( int thread )
+    {
+      Queue& q = this->queues[thread];
+
+      for( ;; )
+      {
+        int i = this->take( thread );
+        if( i < 0 ) i = this->steal( thread );
+        if( i < 0 ) return;
+
+        Clock::time_point start = Clock::now();
+        this->call( this->task, i );
+        q.busy += ThreadPool::seconds( start, Clock::now() );
+        q.tasks++;
+      }
+    }
+
+    void worker_loop( int thread )
+    {
+      long seen = 0;
+
+      for( ;; )
+      {
+        {
+          std::unique_lock<std::mutex> lock( this->mutex );
+          while( !this->stopping && this->generation == seen )
+            this->wake.wait( lock );
+
+          if( this->stopping ) return;
+          seen = this->generation;
+        }
+
+        this->work( thread );
+
+        std::lock_guard<std::mutex> lock( this->mutex );
+        if( ++this->idle == int( this->workers.size() ) )
+          this->done.notify_one();
+      }
+    }
+  };
+}
+
+#endif
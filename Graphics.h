@@ -222,129 +222,6 @@ namespace Graphics
     {
       return( !( *this == v ) );
     }
-  };
-
-  class ParticleSystem
-  {
-  public:
-    Point<>   location;
-    int     count;
-    Vector *particles;
-    Random<>  r;
-    Range<>   velocity_range;
-    int     display_count, display_max;
-
-    float   chaos;
-
-    float   color[3];
-    float   opacity;
-
-    bool is_clean;
-    bool is_paused;
-
-    void init( float color[], Point<> origin )
-    {
-      this->location = origin; 
-      this->count  = 1500;
-      this->velocity_range = Range<>( 0.0f, 0.010f );
-      this->display_count = 0;
-      this->display_max = 100;
-
-      this->color[0] = color[0];
-      this->color[1] = color[1];
-      this->color[2] = color[2];
-
-      this->chaos = .5f;
-
-      this->is_clean  = false;
-      this->is_paused = false;
-
-      this->generate_points();
-    }
-
-    ParticleSystem( float color[], Point<> origin = Point<>() )
-    {
-      this->init( color, origin );
-    }
-
-    ~ParticleSystem()
-    {
-      this->cleanup();
-    }
-
-    void generate_points()
-    {
-      float velocity;
-      float tick;
-      this->particles = new Vector[count];
-
-      for( int i = 0; i < this->count; i++ )
-      {
-        tick               = ( float(this->count) / 360 ) * i * PI_OVER_180;
-        velocity           = r.next( this->velocity_range );
-        this->particles[i] = Vector( this->location, tick, velocity );
-      }
-    }
-
-    void cleanup()
-    {
-      if( this->is_clean ) return;
-
-      garbage_collect_array( this->particles );
-
-      this->is_clean = true;
-    }
-
-    bool draw( int blur = 0 )
-    {
-      if( this->display_count >= this->display_max )
-      {
-        this->cleanup();
-        return(false);
-      }
-      else
-      {
-        this->set_opacity();
-
-        glColor4f( this->color[0], this->color[1], this->color[2], this->opacity );
-        glBegin( GL_POINTS  );
-          for( int i = 0; i < blur+1; i++ )
-          {
-            for( int j = 0; j < count; j++ )
-            {
-              this->draw_particle(j);
-              this->move(j);
-            }
-          }
-        glEnd();
-
-        if( !this->is_paused )
-          this->display_count++;
-
-        return(true);
-      }
-    }
-
-    void set_opacity()
-    {
-      this->opacity = 1 - float(this->display_count) / this->display_max;
-    }
-
-    void draw_particle( int i )
-    {
-      glVertex2fv( this->particles[i].origin.to_array() );
-    }
-
-    void move( int i )
-    {
-      if( this->is_paused ) return;
-
-      Point<> p = this->particles[i].end_point();
-      p.x += r.next( -this->chaos, this->chaos ) / 100;
-      p.y += r.next( -this->chaos, this->chaos ) / 100;
-
-      this->particles[i].origin = p;
-    }
   };*/
 }
 
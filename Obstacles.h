@@ -0,0 +1,130 @@
+/*********************************************************************/
+/* Filename: Obstacles.h                                             */
+/* The Z values of the streetlights and props along one sidewalk,   */
+/* kept in order so that the gaps between them can be looked up.     */
+/*********************************************************************/
+
+#ifndef OBSTACLES_H
+#define OBSTACLES_H
+
+#include <vector>
+#include <algorithm>
+
+#include "Graphics.Range.h"
+
+// The obstacles along a sidewalk, in increasing Z, stored as a ring
+// exactly as large as the number of obstacles.  As the camera passes
+// obstacles they are moved on ahead of it by a whole loop of the road:
+// the front of the ring becomes its back by moving where the ring
+// starts, so nothing is shifted or re-sorted and the ring stays in
+// order.  Looking up the gap around a Z is a binary search.
+class ObstacleIndex
+{
+public:
+  ObstacleIndex()
+  {
+    this->head = 0;
+  }
+
+  void clear()
+  {
+    this->ring.clear();
+    this->head = 0;
+  }
+
+  int size() const
+  {
+    return( int( this->ring.size() ) );
+  }
+
+  // The ith obstacle, counting from the nearest.
+  float get( int i ) const
+  {
+    return( this->ring[this->slot( i )] );
+  }
+
+  // Adds an obstacle at z, in order.
+  void insert( float z )
+  {
+    // The ring is unrolled so that it starts at its first slot.
+    std::rotate( this->ring.begin(), this->ring.begin() + this->head, this->ring.end() );
+    this->head = 0;
+
+    this->ring.insert( std::upper_bound( this->ring.begin(), this->ring.end(), z ), z );
+  }
+
+  // Moves every obstacle behind z on by distance, which must be at least
+  // the length the obstacles are spread over for them to stay in order
+  // without being moved about (as it is when the road loops).
+  void recycle( float z, float distance )
+  {
+    int n = this->size();
+
+    for( int moved = 0; moved < n && this->get( 0 ) < z; moved++ )
+    {
+      float value = this->get( 0 ) + distance;
+
+      this->head = this->slot( 1 );
+      this->ring[this->slot( n - 1 )] = value;
+
+      // Only an obstacle recycled short of the others is out of place.
+      for( int i = n - 1; i > 0 && this->get( i - 1 ) > value; i-- )
+        std::swap( this->ring[this->slot( i - 1 )], this->ring[this->slot( i )] );
+    }
+  }
+
+  // The number of obstacles at or before z.
+  int count_before( float z ) const
+  {
+    int low = 0, high = this->size();
+
+    while( low < high )
+    {
+      int middle = ( low + high ) / 2;
+      if( this->get( middle ) <= z )
+        low = middle + 1;
+      else
+        high = middle;
+    }
+
+    return( low );
+  }
+
+  // The gap between obstacles that z falls in, keeping clear of each by
+  // clearance, as the number of the obstacle before it (-1 if z is
+  // before the first obstacle, after the last or too close to one).
+  int find_gap( float z, float clearance, Range<>& gap ) const
+  {
+    int after = this->count_before( z );
+    if( after == 0 || after == this->size() ) return( -1 );
+
+    // Built only once it is known not to be inside out, which Range<>
+    // would turn the right way round.
+    float low  = this->get( after - 1 ) + clearance;
+    float high = this->get( after ) - clearance;
+    if( !( z > low && z < high ) ) return( -1 );
+
+    gap = Range<>( low, high );
+    return( after - 1 );
+  }
+
+  // Whether z is in a gap between obstacles, keeping clear of each by
+  // clearance, that is longer than length.
+  bool is_in_gap( float z, float clearance, float length ) const
+  {
+    Range<> gap;
+    return( this->find_gap( z, clearance, gap ) >= 0 && gap.size() > length );
+  }
+
+private:
+  std::vector<float> ring;
+  int                head;  // The slot of the nearest obstacle.
+
+  int slot( int i ) const
+  {
+    int s = this->head + i, n = this->size();
+    return( ( s >= n ) ? s - n : s );
+  }
+};
+
+#endif
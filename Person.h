@@ -17,67 +17,64 @@
 #include "Graphics.Animation.h"
 #include "Graphics.Range.h"
 #include "Graphics.Material.h"
+#include "Graphics.BoundingBox.h"
+#include "Graphics.MeshLibrary.h"
+#include "Graphics.Skeleton.h"
+#include "Graphics.Profiler.h"
 
 using namespace Graphics;
 using namespace Graphics::AnimationLibrary;
 
+// The joints a figure is posed by, in the order of a pose's angles.
+namespace Joint
+{
+  enum Joint
+  {
+    UpperLeftArm, UpperRightArm, LowerLeftArm, LowerRightArm,
+    UpperTorso, Pelvis,
+    UpperLeftLeg, UpperRightLeg, LowerLeftLeg, LowerRightLeg,
+    Head, LeftFoot, RightFoot,
+    COUNT
+  };
+}
+
+// How a joint swings as a person walks: back and forth across its range,
+// crossing it in frames animation frames, having first swung from an
+// angle of 0 to first.
+struct JointSwing
+{
+  Range<> range;
+  float   first;
+  int     frames;
+};
+
 class Person
 {
 private:
-  float SIZE_OF_HEAD;
-  float SIZE_OF_NOSE;
-  float SIZE_OF_NECK;
-  float SIZE_OF_TORSO;
-  float SIZE_OF_LEG;
-  float SIZE_OF_KNEE;
-  float SIZE_OF_ANKLE;
-  float SIZE_OF_FOOT;
-  float SIZE_OF_ELBOW;
-  
-  int FRAMES_PER_ANIMATION;
-
-  Material<>* material_skin;
-
-  Animation* upper_left_arm_animation;
-  Animation* upper_right_arm_animation;
-  Animation* lower_left_arm_animation;
-  Animation* lower_right_arm_animation;
-  Animation* upper_torso_animation;
-  Animation* pelvis_animation;
-  Animation* upper_left_leg_animation;
-  Animation* upper_right_leg_animation;
-  Animation* lower_left_leg_animation;
-  Animation* lower_right_leg_animation;
-  Animation* head_animation;
-  Animation* left_foot_animation;
-  Animation* right_foot_animation;
-
-  Animation* walk_animation;
-  float walk_position;
-  float walk_distance;
-
-  float upper_right_arm_angle;
-  float upper_left_arm_angle;
-  float lower_right_arm_angle;
-  float lower_left_arm_angle;
-  float upper_torso_angle;
-  float pelvis_angle;
-  float upper_left_leg_angle;
-  float upper_right_leg_angle;
-  float lower_left_leg_angle;
-  float lower_right_leg_angle;
-  float head_angle;
-  float left_foot_angle;
-  float right_foot_angle;
-
-  Range<>* upper_arm_range;
-  Range<>* lower_arm_range;
-  Range<>* upper_torso_range;
-  Range<>* pelvis_range;
-  Range<>* upper_leg_range;
-  Range<>* lower_leg_range;
-  Range<>* head_range;
-  Range<>* foot_range;
+  enum
+  {
+    FRAMES_PER_ANIMATION = 15
+  };
+
+  // Which way a joint is swinging.  Where a swing starts and ends
+  // follows from the leg and the joint's range, so only the leg and the
+  // frame it is at are kept.
+  enum Leg
+  {
+    FirstSwing,  // From 0 to the joint's first angle.
+    ToMax,
+    ToMin
+  };
+
+  // Everything animate() touches is held inline, an angle, a leg and a
+  // frame per joint in the order of Joint, so a person is a single small
+  // block of memory with nothing of its own on the heap; the ranges the
+  // joints swing across are shared by everyone.
+  int           lod;
+  float         walk_position;
+  float         angle[Joint::COUNT];
+  unsigned char leg[Joint::COUNT];
+  unsigned char frame[Joint::COUNT];  // Frames into the leg.
 
 
 public:
@@ -86,358 +83,415 @@ public:
     Left,
     Right
   };
+
+  enum BodyPart
+  {
+    Head, Nose, Neck, UpperTorso, UpperArm, Elbow, LowerArm, Hand,
+    LowerTorso, Pelvis, UpperLeg, Knee, LowerLeg, Ankle, Foot,
+    BODY_PART_COUNT
+  };
+
+  enum
+  {
+    LOD_LEVELS = 4,
+    PART_COUNT = 24  // Spheres in the figure's skeleton.
+  };
   
   Person()
   {
-    this->FRAMES_PER_ANIMATION = 15;
-
-    this->material_skin = new Material<>();
-    this->material_skin->set_ambient( 1.0f, 1.0f, 0.0f, 1.0f );
-    this->material_skin->set_diffuse( 1.0f, 1.0f, 0.0f, 1.0f );
-    this->material_skin->set_specular( 1.0f, 1.0f, 1.0f, 1.0f );
-    this->material_skin->set_shininess( 400.0f );
-
-    this->upper_left_arm_angle  = 0.0f;
-    this->upper_right_arm_angle = 0.0f;
-    this->lower_left_arm_angle  = 0.0f;
-    this->lower_right_arm_angle = 0.0f;
-    this->upper_torso_angle     = 0.0f;
-    this->pelvis_angle          = 0.0f;
-    this->upper_left_leg_angle  = 0.0f;
-    this->upper_right_leg_angle = 0.0f;
-    this->lower_left_leg_angle  = 0.0f;
-    this->lower_right_leg_angle = 0.0f;
-    this->head_angle            = 0.0f;
-    this->left_foot_angle       = 0.0f;
-    this->right_foot_angle      = 0.0f;
-
-    this->upper_arm_range   = new Range<>( -8.0f, 8.0f );
-    this->lower_arm_range   = new Range<>( 1.0f, 15.0f );
-    this->upper_torso_range = new Range<>( -2.5f, 2.5f );
-    this->pelvis_range      = new Range<>( -2.5f, 2.5f );
-    this->upper_leg_range   = new Range<>( -15.0f, 15.0f );
-    this->lower_leg_range   = new Range<>( -25.0f, 0.0f );
-    this->head_range        = new Range<>( -45.0f, 45.0f );
-    this->foot_range        = new Range<>( -25.0f, 25.0f );
-
-    this->walk_position  = 0.0f;
-    this->walk_distance  = 1.0f;
-    this->walk_animation = new Animation( this->walk_position, this->walk_distance, this->FRAMES_PER_ANIMATION ); 
-
-    this->upper_left_arm_animation  = new Animation( this->upper_left_arm_angle,  this->upper_arm_range->max, this->FRAMES_PER_ANIMATION );
-    this->upper_right_arm_animation = new Animation( this->upper_right_arm_angle, this->upper_arm_range->min, this->FRAMES_PER_ANIMATION );
-    this->lower_left_arm_animation  = new Animation( this->lower_left_arm_angle,  this->lower_arm_range->max, this->FRAMES_PER_ANIMATION );
-    this->lower_right_arm_animation = new Animation( this->lower_right_arm_angle, this->lower_arm_range->min, this->FRAMES_PER_ANIMATION );
-    this->upper_torso_animation     = new Animation( this->upper_torso_angle,     this->upper_torso_range->max, this->FRAMES_PER_ANIMATION );
-    this->pelvis_animation          = new Animation( this->pelvis_angle,          this->pelvis_range->min, this->FRAMES_PER_ANIMATION );
-    this->upper_left_leg_animation  = new Animation( this->upper_left_leg_angle,  this->upper_leg_range->min, this->FRAMES_PER_ANIMATION );
-    this->upper_right_leg_animation = new Animation( this->upper_right_leg_angle, this->upper_leg_range->max, this->FRAMES_PER_ANIMATION );
-    this->lower_left_leg_animation  = new Animation( this->lower_left_leg_angle,  this->lower_leg_range->min, this->FRAMES_PER_ANIMATION );
-    this->lower_right_leg_animation = new Animation( this->lower_right_leg_angle, this->lower_leg_range->max, this->FRAMES_PER_ANIMATION );
-    this->head_animation            = new Animation( this->head_angle,            this->head_range->max, this->FRAMES_PER_ANIMATION * 2 );
-    this->left_foot_animation       = new Animation( this->left_foot_angle,       this->foot_range->min, this->FRAMES_PER_ANIMATION );
-    this->right_foot_animation      = new Animation( this->right_foot_angle,      this->foot_range->max, this->FRAMES_PER_ANIMATION );
-    
-    SIZE_OF_HEAD  = 1.0f;
-    SIZE_OF_NOSE  = 0.1f;
-    SIZE_OF_NECK  = 0.5f;
-    SIZE_OF_TORSO = 1.0f;
-    SIZE_OF_LEG   = 0.9f;
-    SIZE_OF_KNEE  = 0.6f;
-    SIZE_OF_ANKLE = 0.4f;
-    SIZE_OF_FOOT  = 1.0f;
-    SIZE_OF_ELBOW = 0.5f;
+    this->initialize();
   }
 
-  ~Person(){}
-
-  void animate()
+  // The swing of every joint, shared by everyone.
+  static const JointSwing& swing( int joint )
   {
-    this->upper_left_arm_animation->animate_range( this->upper_arm_range, Quadratic::ease_in_and_out );
-    this->upper_right_arm_animation->animate_range( this->upper_arm_range, Quadratic::ease_in_and_out );
-
-    this->lower_left_arm_animation->animate_range( this->lower_arm_range, Quadratic::ease_in_and_out );
-    this->lower_right_arm_animation->animate_range( this->lower_arm_range, Quadratic::ease_in_and_out );
+    static const JointSwing Swings[Joint::COUNT] = {
+      { Range<>( -8.0f,  8.0f ),   8.0f, FRAMES_PER_ANIMATION },      // UpperLeftArm
+      { Range<>( -8.0f,  8.0f ),  -8.0f, FRAMES_PER_ANIMATION },      // UpperRightArm
+      { Range<>(  1.0f, 15.0f ),  15.0f, FRAMES_PER_ANIMATION },      // LowerLeftArm
+      { Range<>(  1.0f, 15.0f ),   1.0f, FRAMES_PER_ANIMATION },      // LowerRightArm
+      { Range<>( -2.5f,  2.5f ),   2.5f, FRAMES_PER_ANIMATION },      // UpperTorso
+      { Range<>( -2.5f,  2.5f ),  -2.5f, FRAMES_PER_ANIMATION },      // Pelvis
+      { Range<>( -15.0f, 15.0f ), -15.0f, FRAMES_PER_ANIMATION },     // UpperLeftLeg
+      { Range<>( -15.0f, 15.0f ),  15.0f, FRAMES_PER_ANIMATION },     // UpperRightLeg
+      { Range<>( -25.0f, 0.0f ),  -25.0f, FRAMES_PER_ANIMATION },     // LowerLeftLeg
+      { Range<>( -25.0f, 0.0f ),    0.0f, FRAMES_PER_ANIMATION },     // LowerRightLeg
+      { Range<>( -45.0f, 45.0f ),  45.0f, FRAMES_PER_ANIMATION * 2 }, // Head
+      { Range<>( -25.0f, 25.0f ), -25.0f, FRAMES_PER_ANIMATION },     // LeftFoot
+      { Range<>( -25.0f, 25.0f ),  25.0f, FRAMES_PER_ANIMATION }      // RightFoot
+    };
+
+    return( Swings[joint] );
+  }
 
-    this->upper_torso_animation->animate_range( this->upper_torso_range, Quadratic::ease_in_and_out );
-    this->pelvis_animation->animate_range( this->pelvis_range, Quadratic::ease_in_and_out );
+private:
+  void initialize()
+  {
+    this->lod = 0;
 
-    this->upper_left_leg_animation->animate_range( this->upper_leg_range, Quadratic::ease_in_and_out );
-    this->upper_right_leg_animation->animate_range( this->upper_leg_range, Quadratic::ease_in_and_out );
+    for( int j = 0; j < Joint::COUNT; j++ )
+    {
+      this->angle[j] = 0.0f;
+      this->leg[j]   = FirstSwing;
+      this->frame[j] = 0;
+    }
 
-    this->lower_left_leg_animation->animate_range( this->lower_leg_range, Quadratic::ease_in_and_out );
-    this->lower_right_leg_animation->animate_range( this->lower_leg_range, Quadratic::ease_in_and_out );
+    this->walk_position = 0.0f;
+  }
 
-    this->head_animation->animate_range( this->head_range, Quadratic::ease_in_and_out );
+public:
+  ~Person(){}
 
-    this->left_foot_animation->animate_range( this->foot_range, Quadratic::ease_in_and_out );
-    this->right_foot_animation->animate_range( this->foot_range, Quadratic::ease_in_and_out );
+  // Every person shares one skin material, so drawing a crowd applies it
+  // once rather than once per person.
+  static Material<>* skin()
+  {
+    static Material<>* material = 0;
+
+    if( material == 0 )
+    {
+      material = new Material<>();
+      material->set_ambient( 1.0f, 1.0f, 0.0f, 1.0f );
+      material->set_diffuse( 1.0f, 1.0f, 0.0f, 1.0f );
+      material->set_specular( 1.0f, 1.0f, 1.0f, 1.0f );
+      material->set_shininess( 400.0f );
+    }
+
+    return( material );
   }
 
-  /*void walk()
+  // Chooses the level of detail for a person this far from the camera.
+  // Each level begins at a fixed distance, but a person only moves to a
+  // coarser level once past it by a margin, and back to a finer one once
+  // inside it by the same margin, so that people near a boundary do not
+  // flicker between two tessellations.
+  void update_lod( float distance )
   {
-    if( !this->walk_animation->is_animating() )
-      this->walk_animation->reset( this->walk_position + this->walk_distance, this->FRAMES_PER_ANIMATION );
-    
-    this->walk_animation->animate( Linear::tween );
-  }*/
+    this->lod = Person::choose_lod( this->lod, distance );
+  }
 
-  void draw()
+  // The level of detail for a figure this far from the camera that was
+  // drawn at lod before.
+  static int choose_lod( int lod, float distance )
   {
-    this->animate();
-    //this->walk();
+    static const float LodDistances[LOD_LEVELS] = { 0.0f, 12.0f, 30.0f, 70.0f };
+    static const float Hysteresis = 0.1f;
 
-    glPushMatrix();
-      material_skin->apply();
+    while( lod < LOD_LEVELS - 1 && distance > LodDistances[lod + 1] * ( 1.0f + Hysteresis ) )
+      lod++;
 
-      glTranslatef( 0.0f, 0.0f, this->walk_position );
+    while( lod > 0 && distance < LodDistances[lod] * ( 1.0f - Hysteresis ) )
+      lod--;
 
-      glScalef( 0.175f, 0.175f, 0.175f );
-      //glRotatef( 180.0f, 0.0f, 1.0f, 0.0f );
-
-      this->draw_lower_torso();
-    glPopMatrix();
+    return( lod );
   }
 
-  void draw_head()
+  int get_lod()
   {
-    glPushMatrix();
-      glTranslatef( 0.0f, 1.0f, 0.0f );
-
-      this->draw_nose();
-
-      glutSolidSphere( 1.0f, 3, 3 );
-      //glutSolidSphere( 1.0f, 30, 30 );
-    glPopMatrix();
+    return( this->lod );
   }
 
-  void draw_nose()
+  void set_lod( int lod )
   {
-    glPushMatrix();
-      glTranslatef( 0.0f, 0.0f, 1.05f );
-
-      glScalef( 0.1f, 0.1f, 0.1f );
-      glRotatef( 90.0f, 0.0f, 1.0f, 0.0f );
-
-      glutSolidSphere( 1.0f, 3, 3 );
-      //glutSolidSphere( 1.0f, 10, 10 );
-    glPopMatrix();
+    this->lod = lod;
   }
 
-  void draw_neck()
+  // The angle of every joint, in the order of Joint, so that one figure
+  // can be posed as each of a crowd of people in turn.
+  void get_pose( float angle[] )
   {
-    glPushMatrix();
-      glTranslatef( 0.0f, 1.0f, 0.0f );
-
-      this->draw_head();
-
-      glScalef( 0.6f, 0.1f, 0.6f );
-      glRotatef( 90.0f, 1.0f, 0.0f, 0.0f );
-
-      glutSolidSphere( 1.0f, 3, 3 );
-      //glutSolidSphere( 1.0f, 15, 3 );
-    glPopMatrix();
+    for( int j = 0; j < Joint::COUNT; j++ )
+      angle[j] = *this->joint_angle( j );
   }
 
-  void draw_upper_torso()
+  void set_pose( const float angle[] )
   {
-    glPushMatrix();
-	  glTranslatef( 0.0f, 1.5f, 0.0f );
-
-      glRotatef( -this->upper_left_arm_angle, 2.0f, 0.0f, 0.0f );
-      this->draw_upper_arm( Left );
-      glRotatef( this->upper_left_arm_angle, 1.0f, 0.0f, 0.0f );
-
-      glRotatef( -this->upper_right_arm_angle, 2.0f, 0.0f, 0.0f );
-      this->draw_upper_arm( Right );
-      glRotatef( this->upper_right_arm_angle, 1.0f, 0.0f, 0.0f );
-
-	  glRotatef( -this->head_angle, 0.0f, 2.0f, 0.0f );
-      this->draw_neck();
-	  glRotatef( this->head_angle, 0.0f, 1.0f, 0.0f );
-
-      glScalef( 2.0f, 1.0f, 1.0f );
-
-      glutSolidSphere( 1.0f, 3, 3 );
-      //glutSolidSphere( 1.0f, 30, 30 );
-    glPopMatrix();
+    for( int j = 0; j < Joint::COUNT; j++ )
+      *this->joint_angle( j ) = angle[j];
   }
 
-  void draw_upper_arm( Side side )
+  // The number of slices and stacks a body part is tessellated with at
+  // a level of detail.  Level 0 is the full-detail model; coarser levels
+  // cap every part's tessellation.
+  static int tessellation( int lod, BodyPart part )
   {
-    glPushMatrix();
-      glTranslatef( ((side == Left) ? 1 : -1 ) * 1.9f, -1.0f, 0.0f );
-
-      this->draw_elbow( side );
-
-      glScalef( 0.6f, 1.2f, 0.6f );
-
-      glutSolidSphere( 1.0f, 3, 3 );
-      //glutSolidSphere( 1.0f, 15, 15 );
-    glPopMatrix();
+    static const int FullDetail[BODY_PART_COUNT] = {
+      3, 3, 3, 3, 3, 3, 3, 10, 15, 10, 20, 10, 30, 10, 10
+    };
+    static const int Caps[LOD_LEVELS] = { 1000, 10, 6, 4 };
+    static int tiers[LOD_LEVELS][BODY_PART_COUNT];
+    static bool is_built = false;
+
+    if( !is_built )
+    {
+      for( int i = 0; i < LOD_LEVELS; i++ )
+        for( int j = 0; j < BODY_PART_COUNT; j++ )
+          tiers[i][j] = ( FullDetail[j] < Caps[i] ) ? FullDetail[j] : Caps[i];
+      is_built = true;
+    }
+
+    return( tiers[lod][part] );
   }
 
-  void draw_elbow( Side side )
+  // Triangles drawn by every person since the count was last reset.
+  static int& triangle_count()
   {
-    float angle;
-    if( side == Left )
-      angle = this->lower_left_arm_angle;
-    else
-      angle = this->lower_right_arm_angle;
-
-    glPushMatrix();
-      glTranslatef( 0.0f, -1.25f, 0.0f );
+    static int count = 0;
+    return( count );
+  }
 
-      glRotatef( -angle, 2.0f, 0.0f, 0.0f );
-      this->draw_lower_arm();
-      glRotatef( angle, 1.0f, 0.0f, 0.0f );
+  // A conservative box around the figure in any pose, in the space that
+  // draw() is called in.
+  BoundingBox get_bounds()
+  {
+    return( BoundingBox( -0.7f, -1.3f, this->walk_position - 0.6f,
+                          0.7f,  1.4f, this->walk_position + 0.6f ) );
+  }
 
-      glScalef( 0.5f, 0.45f, 0.5f );
+  void animate()
+  {
+    PROFILE_SCOPE( "Person::animate" );
 
-      glutSolidSphere( 1.0f, 3, 3 );
-      //glutSolidSphere( 1.0f, 10, 10 );
-    glPopMatrix();
+    for( int j = 0; j < Joint::COUNT; j++ )
+      this->swing_joint( j );
   }
 
-  void draw_lower_arm()
+private:
+  // Eases a joint one frame along its leg through swing_range(), which
+  // turns it back once it has finished a leg at either end of its range.
+  void swing_joint( int j )
   {
-    glPushMatrix();
-      glTranslatef( 0.0f, -1.0f, 0.0f );
+    const JointSwing& s = Person::swing( j );
 
-      this->draw_hand();
+    float start = ( this->leg[j] == FirstSwing ) ? 0.0f    : ( this->leg[j] == ToMax ) ? s.range.min : s.range.max;
+    float end   = ( this->leg[j] == FirstSwing ) ? s.first : ( this->leg[j] == ToMax ) ? s.range.max : s.range.min;
+    int   i     = this->frame[j];
 
-      glScalef( 0.5f, 1.0f, 0.5f );
+    if( swing_range( this->angle[j], start, end, i, s.frames, s.range, Quadratic::ease_in_and_out ) )
+      this->leg[j] = ( end == s.range.max ) ? ToMax : ToMin;
 
-      glutSolidSphere( 1.0f, 3, 3 );
-      //glutSolidSphere( 1.0f, 15, 15 );
-    glPopMatrix();
+    this->frame[j] = (unsigned char)i;
   }
 
-  void draw_hand()
+  float* joint_angle( int joint )
   {
-    glPushMatrix();
-      glTranslatef( 0.0f, -1.25f, 0.0f );
-
-      glScalef( 0.4f, 1.0f, 0.7f );
-
-      glutSolidSphere( SIZE_OF_ELBOW, 10, 10 );
-    glPopMatrix();
+    return( &this->angle[joint] );
   }
-  void draw_lower_torso()
-  {
-    glPushMatrix();
-      glTranslatef( 0.0f, -SIZE_OF_TORSO * 1.5, 0.0f );
 
-      glRotatef( -this->upper_torso_angle, 0.0f, 0.0f, 2.0f );
-	  draw_upper_torso();
-      glRotatef( this->upper_torso_angle, 0.0f, 0.0f, 1.0f );
+public:
+  // Draws the figure in its current pose.
+  void draw()
+  {
+    PROFILE_SCOPE( "Person::draw" );
 
-      glRotatef( -this->pelvis_angle, 0.0f, 0.0f, 2.0f );
-      draw_pelvis();
-      glRotatef( this->pelvis_angle, 0.0f, 0.0f, 1.0f );
+    float  pose[Joint::COUNT];
+    Matrix model;
+    Matrix parts[PART_COUNT];
 
-      glScalef( 1.5f, 2.0f, 1.25f );
-      glRotatef( 90.0f, 1.0f, 0.0f, 0.0f );
+    this->get_pose( pose );
+    model.translate( 0.0f, 0.0f, this->walk_position );
 
-      glutSolidSphere( SIZE_OF_TORSO, 15, 15 );
-    glPopMatrix();
+    Person::pose_parts( pose, model, parts );
+    Person::draw_parts( parts, this->lod );
   }
 
-  void draw_pelvis()
+  // The matrix of every part of a figure in the pose (angles in the order
+  // of Joint), placed by model, in the order of the skeleton's parts.
+  static void pose_parts( const float pose[], const Matrix& model, Matrix parts[] )
   {
-    glPushMatrix();
-      glTranslatef( 0.0f, -2.0f, 0.0f );
-
-      glRotatef( -this->upper_right_leg_angle, 2.0f, 0.0f, 0.0f );
-      draw_upper_leg( Right );
-      glRotatef( this->upper_right_leg_angle, 1.0f, 0.0f, 0.0f );
-
-      glRotatef( -this->upper_left_leg_angle, 2.0f, 0.0f, 0.0f );
-      glRotatef( this->pelvis_angle, 0.0f, 0.0f, 2.0f );
-      draw_upper_leg( Left );
-      glRotatef( -this->pelvis_angle, 0.0f, 0.0f, 1.0f );
-      glRotatef( this->upper_left_leg_angle, 1.0f, 0.0f, 0.0f );
-
-      glScalef( 1.25f, 1.0f, 1.0f );
+    Matrix figure = model;
+    figure.scale( 0.175f, 0.175f, 0.175f );
 
-      glutSolidSphere( SIZE_OF_TORSO, 10, 10 );
-    glPopMatrix();
+    Person::skeleton().evaluate( figure, pose, parts );
   }
 
-  void draw_upper_leg( Side side )
+  // Draws the parts of a posed figure at a level of detail.
+  static void draw_parts( const Matrix parts[], int lod )
   {
-    glPushMatrix();
-      glTranslatef( ((side == Left) ? 1 : -1 ) * SIZE_OF_LEG, -1.5f, 0.0f );
+    const Skeleton& skeleton = Person::skeleton();
 
-      draw_knee( side );
+    Person::skin()->apply();
 
-      glScalef( 0.8f, 1.5f, 0.8f );
+    for( int i = 0; i < PART_COUNT; i++ )
+    {
+      int detail = Person::tessellation( lod, BodyPart( skeleton.get_part_mesh( i ) ) );
 
-      glutSolidSphere( SIZE_OF_LEG, 20, 20 );
-    glPopMatrix();
+      mesh_library().sphere( detail, detail ).draw( parts[i] );
+      Person::triangle_count() += 2 * detail * ( detail - 1 );
+    }
   }
 
-  void draw_knee( Side side )
+  // The figure's bones and the body parts drawn at them, as unit spheres
+  // shaped and sized within each bone's space.  Limbs swing about x and
+  // the torso about z, at the joint they hang from; the left leg turns
+  // back against the pelvis's swing so that it stays upright.
+  static const Skeleton& skeleton()
   {
-    float angle;
-    if( side == Left )
-      angle = this->lower_left_leg_angle;
-    else
-      angle = this->lower_right_leg_angle;
-
-    glPushMatrix();
-      glTranslatef( 0.0f, -1.25f, 0.0f );
+    static Skeleton skeleton;
+    static bool     is_built = false;
+
+    if( is_built ) return( skeleton );
+
+    int lower_torso = skeleton.add_bone( -1, -1, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, -1.5f, 0.0f );
+    int upper_torso = skeleton.add_bone( lower_torso, Joint::UpperTorso, -1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 1.5f, 0.0f );
+
+    Person::add_part( skeleton, lower_torso, LowerTorso, 0.0f, 0.0f, 0.0f, 1.5f, 2.0f, 1.25f, 90.0f, 1.0f, 0.0f, 0.0f, 1.0f );
+    Person::add_part( skeleton, upper_torso, UpperTorso, 0.0f, 0.0f, 0.0f, 2.0f, 1.0f, 1.0f,  0.0f, 0.0f, 0.0f, 0.0f, 1.0f );
+
+    for( int side = 0; side < 2; side++ )
+    {
+      float x = ( side == 0 ) ? 1.0f : -1.0f;
+
+      int upper_arm = skeleton.add_bone( upper_torso, ( side == 0 ) ? Joint::UpperLeftArm : Joint::UpperRightArm,
+                                         -1.0f, 1.0f, 0.0f, 0.0f, x * 1.9f, -1.0f, 0.0f );
+      int elbow     = skeleton.add_bone( upper_arm, -1, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, -1.25f, 0.0f );
+      int lower_arm = skeleton.add_bone( elbow, ( side == 0 ) ? Joint::LowerLeftArm : Joint::LowerRightArm,
+                                         -1.0f, 1.0f, 0.0f, 0.0f, 0.0f, -1.0f, 0.0f );
+      int hand      = skeleton.add_bone( lower_arm, -1, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, -1.25f, 0.0f );
+
+      Person::add_part( skeleton, upper_arm, UpperArm, 0.0f, 0.0f, 0.0f, 0.6f, 1.2f,  0.6f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f );
+      Person::add_part( skeleton, elbow,     Elbow,    0.0f, 0.0f, 0.0f, 0.5f, 0.45f, 0.5f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f );
+      Person::add_part( skeleton, lower_arm, LowerArm, 0.0f, 0.0f, 0.0f, 0.5f, 1.0f,  0.5f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f );
+      Person::add_part( skeleton, hand,      Hand,     0.0f, 0.0f, 0.0f, 0.4f, 1.0f,  0.7f, 0.0f, 0.0f, 0.0f, 0.0f, 0.5f );
+    }
+
+    int neck = skeleton.add_bone( upper_torso, Joint::Head, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f );
+    int head = skeleton.add_bone( neck, -1, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f );
+    int nose = skeleton.add_bone( head, -1, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.05f );
+
+    Person::add_part( skeleton, neck, Neck, 0.0f, 0.0f, 0.0f, 0.6f, 0.1f, 0.6f, 90.0f, 1.0f, 0.0f, 0.0f, 1.0f );
+    Person::add_part( skeleton, head, Head, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f,  0.0f, 0.0f, 0.0f, 0.0f, 1.0f );
+    Person::add_part( skeleton, nose, Nose, 0.0f, 0.0f, 0.0f, 0.1f, 0.1f, 0.1f, 90.0f, 0.0f, 1.0f, 0.0f, 1.0f );
+
+    int pelvis = skeleton.add_bone( lower_torso, Joint::Pelvis, -1.0f, 0.0f, 0.0f, 1.0f, 0.0f, -2.0f, 0.0f );
+
+    Person::add_part( skeleton, pelvis, Pelvis, 0.0f, 0.0f, 0.0f, 1.25f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f );
+
+    for( int side = 0; side < 2; side++ )
+    {
+      float x = ( side == 0 ) ? 1.0f : -1.0f;
+      int   hip;
+
+      if( side == 0 )
+      {
+        int swing = skeleton.add_bone( pelvis, Joint::UpperLeftLeg, -1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f );
+        hip = skeleton.add_bone( swing, Joint::Pelvis, 1.0f, 0.0f, 0.0f, 1.0f, x * 0.9f, -1.5f, 0.0f );
+      }
+      else
+        hip = skeleton.add_bone( pelvis, Joint::UpperRightLeg, -1.0f, 1.0f, 0.0f, 0.0f, x * 0.9f, -1.5f, 0.0f );
+
+      int knee      = skeleton.add_bone( hip, -1, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, -1.25f, 0.0f );
+      int lower_leg = skeleton.add_bone( knee, ( side == 0 ) ? Joint::LowerLeftLeg : Joint::LowerRightLeg,
+                                         -1.0f, 1.0f, 0.0f, 0.0f, 0.0f, -1.0f, 0.0f );
+      int ankle     = skeleton.add_bone( lower_leg, -1, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, -1.25f, 0.0f );
+      int foot      = skeleton.add_bone( ankle, ( side == 0 ) ? Joint::LeftFoot : Joint::RightFoot,
+                                         -1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f );
+
+      Person::add_part( skeleton, hip,       UpperLeg, 0.0f,  0.0f, 0.0f, 0.8f, 1.5f, 0.8f, 0.0f, 0.0f, 0.0f, 0.0f, 0.9f );
+      Person::add_part( skeleton, knee,      Knee,     0.0f,  0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.6f );
+      Person::add_part( skeleton, lower_leg, LowerLeg, 0.0f,  0.0f, 0.0f, 0.7f, 1.5f, 0.7f, 0.0f, 0.0f, 0.0f, 0.0f, 0.9f );
+      Person::add_part( skeleton, foot,      Ankle,    0.0f,  0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.4f );
+      Person::add_part( skeleton, foot,      Foot,     0.0f, -0.4f, 0.5f, 0.7f, 0.3f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f );
+    }
+
+    is_built = true;
+    return( skeleton );
+  }
 
-      glRotatef( -angle, 2.0f, 0.0f, 0.0f );
-      draw_lower_leg( side );
-      glRotatef( angle, 1.0f, 0.0f, 0.0f );
+private:
+  // A sphere of radius at a bone: moved by (x, y, z), scaled by (sx, sy,
+  // sz) and turned by angle about (ax, ay, az), as glTranslatef, glScalef
+  // and glRotatef would in that order.
+  static void add_part( Skeleton& skeleton, int bone, BodyPart part, float x, float y, float z,
+                        float sx, float sy, float sz, float angle, float ax, float ay, float az, float radius )
+  {
+    Matrix shape;
+    shape.translate( x, y, z );
+    shape.scale( sx, sy, sz );
+    if( angle != 0.0f )
+      shape.rotate( angle, ax, ay, az );
+    shape.scale( radius, radius, radius );
+
+    skeleton.add_part( bone, part, shape );
+  }
+};
 
-      glutSolidSphere( SIZE_OF_KNEE, 10, 10 );
-    glPopMatrix();
+// The parts of many posed figures, gathered by body part and level of
+// detail and drawn with one call for each, so a crowd takes the same
+// number of draw calls however many people are in it.
+class PersonBatch
+{
+public:
+  void clear()
+  {
+    for( int part = 0; part < Person::BODY_PART_COUNT; part++ )
+      for( int lod = 0; lod < Person::LOD_LEVELS; lod++ )
+        this->instances[part][lod].clear();
   }
 
-  void draw_lower_leg( Side side )
+  // Makes room for as many figures as there are people, so that adding
+  // them allocates nothing, and so that the device can take the largest
+  // draw (everyone at one level of detail) without growing anything.
+  void reserve( int people )
   {
-    glPushMatrix();
-      glTranslatef( 0.0f, -1.0f, 0.0f );
+    const Skeleton& skeleton = Person::skeleton();
+    int             parts[Person::BODY_PART_COUNT] = { 0 };
+    int             most = 0;
+
+    for( int i = 0; i < Person::PART_COUNT; i++ )
+      parts[skeleton.get_part_mesh( i )]++;
 
-      draw_ankle( side );
+    for( int part = 0; part < Person::BODY_PART_COUNT; part++ )
+    {
+      for( int lod = 0; lod < Person::LOD_LEVELS; lod++ )
+        this->instances[part][lod].reserve( people * parts[part] );
 
-      glScalef( 0.7f, 1.5f, 0.7f );
+      if( parts[part] > most ) most = parts[part];
+    }
 
-      glutSolidSphere( SIZE_OF_LEG, 30, 30 );
-    glPopMatrix();
+    render_device().reserve_instances( people * most );
   }
 
-  void draw_ankle( Side side )
+  // Adds the parts of a figure posed by Person::pose_parts.
+  void add( const Matrix parts[], int lod )
   {
-    float angle;
-    if( side == Left )
-      angle = this->left_foot_angle;
-    else
-      angle = this->right_foot_angle;
+    const Skeleton& skeleton = Person::skeleton();
 
-    glPushMatrix();
-      glTranslatef( 0.0f, -1.25f, 0.0f );
+    for( int i = 0; i < Person::PART_COUNT; i++ )
+    {
+      int mesh   = skeleton.get_part_mesh( i );
+      int detail = Person::tessellation( lod, Person::BodyPart( mesh ) );
 
-      glRotatef( -angle, 1.0f, 0.0f, 0.0f );
-      draw_foot();
-
-      glutSolidSphere( SIZE_OF_ANKLE, 10, 10 );
-    glPopMatrix();
+      this->instances[mesh][lod].add( parts[i] );
+      Person::triangle_count() += 2 * detail * ( detail - 1 );
+    }
   }
 
-  void draw_foot()
+  // Draws everything added since clear(), returning the number of draw
+  // calls it took.
+  int draw()
   {
-    glPushMatrix();
-      glTranslatef( 0.0f, -SIZE_OF_ANKLE, SIZE_OF_FOOT/2 );
+    int calls = 0;
+
+    Person::skin()->apply();
 
-      glScalef( 0.7f, 0.3f, 1.0f );
+    for( int part = 0; part < Person::BODY_PART_COUNT; part++ )
+    {
+      for( int lod = 0; lod < Person::LOD_LEVELS; lod++ )
+      {
+        MeshInstances& group = this->instances[part][lod];
+        if( group.size() == 0 ) continue;
 
-      glutSolidSphere( SIZE_OF_FOOT, 10, 10 );
-    glPopMatrix();
+        int detail = Person::tessellation( lod, Person::BodyPart( part ) );
+        calls += group.draw( mesh_library().sphere( detail, detail ) );
+      }
+    }
+
+    return( calls );
   }
 
+private:
+  MeshInstances instances[Person::BODY_PART_COUNT][Person::LOD_LEVELS];
 };
 
 #define glutSolidSphere glutSolidSphere